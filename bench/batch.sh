@@ -0,0 +1,66 @@
+#!/bin/bash
+
+# batch.sh - Throughput and latency of per-message sends against batching
+# with a range of batch sizes and flush deadlines. Four nodes on localhost.
+#
+# Usage: bench/batch.sh [messages] [rate]
+#   messages  per node for the throughput runs (default 200000)
+#   rate      per-node msg/s for the latency runs (default 20000)
+#
+# Every run is traced and checked with tools/verify; VERIFY=0 skips that.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MESSAGES=${1:-200000}
+RATE=${2:-20000}
+N=4
+BASE_PORT=${BASE_PORT:-9100}
+VERIFY=${VERIFY:-1}
+
+make -s || exit 1
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+CONFIG="$OUT/cluster.conf"
+for ((i = 0; i < N; i++)); do
+    echo "$i localhost $((BASE_PORT + i))" >> "$CONFIG"
+done
+
+# Run all nodes with the given options and print "throughput p50 p99"
+run() {
+    PIDS=()
+    for ((i = 0; i < N; i++)); do
+        TRACE=()
+        if [ "$VERIFY" != 0 ]; then
+            TRACE=(--trace "$OUT/trace$i.bin")
+        fi
+        ./causal_broadcast $i --config "$CONFIG" --log-level info --payload 64 "${TRACE[@]}" "$@" > "$OUT/log$i.txt" 2>&1 &
+        PIDS+=($!)
+    done
+    wait "${PIDS[@]}"
+    if [ "$VERIFY" != 0 ] && ! tools/verify "$OUT"/trace*.bin > "$OUT/verify.txt"; then
+        echo "delivery order check failed ($*):" >&2
+        cat "$OUT/verify.txt" >&2
+        exit 1
+    fi
+    cat "$OUT"/log*.txt | awk '
+        /^Delivery throughput:/ { t += $3; ct++ }
+        /^send->recv/           { p50 += $4; if ($5 > p99) p99 = $5; cl++ }
+        END { printf "%12.0f %10.1f %10.1f\n", t / ct, p50 / cl, p99 }'
+}
+
+printf "%-22s %12s %10s %10s   %10s %10s\n" "mode" "max msg/s" "p50 (us)" "p99 (us)" "p50 @rate" "p99 @rate"
+for SETTING in "off" "1024:50" "4096:200" "16384:500" "65536:1000"; do
+    if [ "$SETTING" = "off" ]; then
+        LABEL="per-message"
+        BATCH=()
+    else
+        SIZE=${SETTING%%:*}
+        DELAY=${SETTING##*:}
+        LABEL="batch ${SIZE}B/${DELAY}us"
+        BATCH=(--batch-size "$SIZE" --batch-delay "$DELAY")
+    fi
+    MAX=$(run --max-throughput --messages "$MESSAGES" "${BATCH[@]}") || exit 1
+    PACED=$(run --rate "$RATE" --messages $((RATE * 2)) "${BATCH[@]}") || exit 1
+    printf "%-22s %s   %s\n" "$LABEL" "$MAX" "$(echo $PACED | awk '{ printf "%10.1f %10.1f", $2, $3 }')"
+done
@@ -0,0 +1,143 @@
+// bench_alloc - Heap allocations per message on the send, receive and
+// delivery path once buffers have warmed up.
+//
+// Runs a cluster of real Process instances in this program, each on its own
+// thread and connected over localhost TCP, so every message goes through
+// broadcast_message (stamping, encoding, the outbound queue), the socket, the
+// peer's decoder and causal delivery. Simulated network delay lets messages
+// from different senders overtake each other, so many wait in the causal
+// buffer. With io_threads > 0 the processes run pipelined, and every message
+// also crosses a receive thread's ring to the delivery thread.
+//
+// operator new is counted on every thread while the cluster is in steady
+// state: once every node has broadcast its warm-up messages and before any
+// has broadcast its last ones, so connection setup, DONE handling and
+// shutdown are left out. Storage is recycled, so what remains is growth to
+// a new high-water mark: real sockets and thread scheduling can make the
+// delay queue or the causal buffer deeper than ever at any time, and the
+// first message to go that deep takes fresh storage. Exits 1 from one
+// allocation per 100 messages, well below the one or more per message that
+// an allocation on any per-message path adds.
+//
+// Usage: bench/bench_alloc [messages] [num_processes] [io_threads] [base_port]
+//   messages  per node in the measured window (default 2000)
+
+#include "config.h"
+#include "logger.h"
+#include "process.h"
+#include "workload.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static std::atomic<bool> counting(false);
+static std::atomic<long long> allocations(0);
+
+void* operator new(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+// Out of line, or GCC sees the free() of a pointer from operator new and
+// warns of a mismatch
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+// Per node before the measured window. Long enough for every queue, decoder
+// and buffer slot to have grown to its working size, and in pipelined mode
+// for every slot of the inbound rings to have carried a message.
+const int WARMUP_MESSAGES = 20000;
+const int TAIL_MESSAGES = 200;
+const double SEND_RATE = 4000;
+const double MAX_ALLOCATIONS_PER_MESSAGE = 0.01;
+
+int main(int argc, char* argv[]) {
+    int messages = argc > 1 ? atoi(argv[1]) : 2000;
+    int n = argc > 2 ? atoi(argv[2]) : 4;
+    int io_threads = argc > 3 ? atoi(argv[3]) : 0;
+    int base_port = argc > 4 ? atoi(argv[4]) : 9400;
+    if (messages <= 0 || n < 2 || io_threads < 0 || base_port <= 0) {
+        fprintf(stderr, "Usage: %s [messages] [num_processes] [io_threads] [base_port]\n", argv[0]);
+        return 1;
+    }
+
+    Logger::instance().configure(LOG_ERROR, 1, "", 0, n);
+    Logger::instance().start();
+
+    WorkloadConfig workload;
+    workload.message_count = WARMUP_MESSAGES + messages + TAIL_MESSAGES;
+    workload.arrivals = ARRIVAL_FIXED_RATE;
+    workload.rate = SEND_RATE;
+
+    ClusterConfig cluster = ClusterConfig::local(n, base_port);
+    std::vector<std::unique_ptr<Process> > processes;
+    for (int i = 0; i < n; i++) {
+        processes.push_back(std::unique_ptr<Process>(new Process(i, cluster, workload, true)));
+        processes.back()->set_stats_interval(0);
+        processes.back()->set_io_threads(io_threads);
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++) {
+        threads.push_back(std::thread(&Process::run, processes[i].get()));
+    }
+
+    // Open the window when the slowest node is past its warm-up and close it
+    // when the fastest reaches its tail
+    long long window_end = WARMUP_MESSAGES + messages;
+    long long sent_at_open = -1, sent_at_close = -1;
+    while (true) {
+        long long lowest = window_end, highest = 0, total = 0;
+        for (const std::unique_ptr<Process>& p : processes) {
+            long long sent = p->messages_broadcast();
+            lowest = std::min(lowest, sent);
+            highest = std::max(highest, sent);
+            total += sent;
+        }
+        if (sent_at_open < 0 && lowest >= WARMUP_MESSAGES && highest < window_end) {
+            counting = true;
+            sent_at_open = total;
+        } else if (highest >= window_end) {
+            counting = false;
+            sent_at_close = total;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    bool complete = true;
+    for (const std::unique_ptr<Process>& p : processes) {
+        complete = complete && p->is_finished();
+    }
+    Logger::instance().stop();
+
+    if (!complete) {
+        fprintf(stderr, "not every message was delivered\n");
+        return 1;
+    }
+    if (sent_at_open < 0) {
+        fprintf(stderr, "nodes started too far apart to share a measured window; raise messages\n");
+        return 1;
+    }
+    long long measured = sent_at_close - sent_at_open;
+    double per_message = (double)allocations.load() / measured;
+    printf("%lld broadcasts across %d nodes (%s), %lld heap allocations in steady state (%.4f per message)\n",
+           measured, n, io_threads > 0 ? "pipelined" : "single thread", allocations.load(), per_message);
+    return per_message < MAX_ALLOCATIONS_PER_MESSAGE ? 0 : 1;
+}
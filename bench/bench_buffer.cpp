@@ -0,0 +1,158 @@
+// bench_buffer - Delivery time per message for heavily reordered input.
+//
+// Builds a causal history in which every message depends on all earlier
+// ones, shuffles it, and feeds it to a receiver. The same input is run
+// through the original rescanning std::queue buffer and through the
+// indexed DeliveryBuffer.
+//
+// Usage: bench/bench_buffer [num_processes] [sizes...]
+
+#include "delivery_buffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Receiver state shared by both strategies; the receiver is process 0 and
+// never sends
+struct Receiver {
+    std::vector<int> vector_clock;
+    long long delivered;
+
+    explicit Receiver(int n) : vector_clock(n, 0), delivered(0) {}
+
+    bool can_deliver(const Message& msg) const {
+        for (size_t j = 0; j < vector_clock.size(); j++) {
+            if ((int)j != msg.sender_id && msg.vector_clock[j] > vector_clock[j]) {
+                return false;
+            }
+        }
+        return msg.vector_clock[msg.sender_id] == vector_clock[msg.sender_id] + 1;
+    }
+
+    void deliver(const Message& msg) {
+        for (size_t i = 0; i < vector_clock.size(); i++) {
+            vector_clock[i] = std::max(vector_clock[i], msg.vector_clock[i]);
+        }
+        delivered++;
+    }
+};
+
+static std::vector<Message> make_history(int n, int count, std::mt19937& gen) {
+    std::vector<Message> history;
+    std::vector<int> clock(n, 0);
+    std::uniform_int_distribution<> pick(1, n - 1);
+    for (int k = 0; k < count; k++) {
+        Message msg;
+        msg.sender_id = pick(gen);
+        msg.seq_number = clock[msg.sender_id]++;
+        msg.channel = 0;
+        msg.channel_seq = msg.seq_number;
+        msg.vector_clock = clock;
+        msg.data = "Message from P" + std::to_string(msg.sender_id) + " #" + std::to_string(msg.seq_number);
+        history.push_back(msg);
+    }
+    std::shuffle(history.begin(), history.end(), gen);
+    return history;
+}
+
+// The check_buffer loop as it was before DeliveryBuffer
+static double run_rescan(int n, const std::vector<Message>& input) {
+    Receiver rx(n);
+    std::queue<Message> buffer;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (const Message& in : input) {
+        Message msg = in;
+        if (!rx.can_deliver(msg)) {
+            buffer.push(msg);
+            continue;
+        }
+        rx.deliver(msg);
+
+        bool delivered = true;
+        while (delivered && !buffer.empty()) {
+            delivered = false;
+            std::queue<Message> temp_buffer;
+            while (!buffer.empty()) {
+                Message m = buffer.front();
+                buffer.pop();
+                if (rx.can_deliver(m)) {
+                    rx.deliver(m);
+                    delivered = true;
+                } else {
+                    temp_buffer.push(m);
+                }
+            }
+            buffer = temp_buffer;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (rx.delivered != (long long)input.size()) {
+        fprintf(stderr, "rescan: delivered %lld of %zu\n", rx.delivered, input.size());
+        exit(1);
+    }
+    return elapsed / input.size();
+}
+
+static double run_indexed(int n, const std::vector<Message>& input) {
+    Receiver rx(n);
+    DeliveryBuffer buffer(n);
+    Message popped;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (const Message& in : input) {
+        Message msg = in;
+        if (!rx.can_deliver(msg)) {
+            buffer.push(msg);
+            continue;
+        }
+        rx.deliver(msg);
+
+        bool delivered = true;
+        while (delivered && !buffer.empty()) {
+            delivered = false;
+            for (int sender = 0; sender < n; sender++) {
+                Message* head;
+                while ((head = buffer.head(sender)) != NULL && rx.can_deliver(*head)) {
+                    buffer.pop(sender, popped);
+                    rx.deliver(popped);
+                    delivered = true;
+                }
+            }
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (rx.delivered != (long long)input.size()) {
+        fprintf(stderr, "indexed: delivered %lld of %zu\n", rx.delivered, input.size());
+        exit(1);
+    }
+    return elapsed / input.size();
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 4;
+    std::vector<int> sizes;
+    for (int i = 2; i < argc; i++) {
+        sizes.push_back(atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {1000, 2000, 5000, 10000};
+    }
+
+    std::mt19937 gen(6378);
+    printf("%10s %8s %18s %18s %10s\n", "messages", "N", "rescan (ns/msg)", "indexed (ns/msg)", "speedup");
+    for (int count : sizes) {
+        std::vector<Message> input = make_history(n, count, gen);
+        double rescan = run_rescan(n, input);
+        double indexed = run_indexed(n, input);
+        printf("%10d %8d %18.0f %18.0f %9.1fx\n", count, n, rescan, indexed, rescan / indexed);
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+// bench_clock - Wire bytes per message for full and delta-encoded vector
+// clocks as the cluster grows.
+//
+// Simulates a run in which every message is delivered everywhere before the
+// next one is sent, and encodes each message both ways. Two traffic shapes:
+// every process sending equally, and one hot process sending 80% of the
+// messages. Payloads are empty, so the numbers are header plus clock.
+//
+// Usage: bench/bench_clock [messages] [sizes...]
+
+#include "wire.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+struct Result {
+    double full;
+    double delta;
+};
+
+static Result measure(int n, int count, double hot_share, std::mt19937& gen) {
+    std::vector<int> clock(n, 0);
+    std::vector<std::vector<int> > last_sent(n);
+    std::uniform_int_distribution<> pick(0, n - 1);
+    std::uniform_real_distribution<> coin(0, 1);
+
+    std::vector<char> out;
+    long long full_bytes = 0;
+    long long delta_bytes = 0;
+    Message msg;
+    msg.send_time_ns = 0;
+    for (int k = 0; k < count; k++) {
+        msg.sender_id = coin(gen) < hot_share ? 0 : pick(gen);
+        msg.seq_number = clock[msg.sender_id]++;
+        msg.channel = 0;
+        msg.channel_seq = msg.seq_number;
+        msg.vector_clock = clock;
+
+        out.clear();
+        encode_frame(msg, out);
+        full_bytes += out.size();
+
+        out.clear();
+        encode_frame(msg, out, &last_sent[msg.sender_id]);
+        delta_bytes += out.size();
+    }
+
+    Result r = {(double)full_bytes / count, (double)delta_bytes / count};
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    std::vector<int> sizes;
+    for (int i = 2; i < argc; i++) {
+        sizes.push_back(atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {4, 8, 16, 32, 64, 128, 256};
+    }
+
+    std::mt19937 gen(6378);
+    printf("%6s %14s %14s %10s %14s %14s %10s\n", "N", "uniform full", "uniform delta", "saving",
+           "hot full", "hot delta", "saving");
+    for (int n : sizes) {
+        Result uniform = measure(n, count, 0, gen);
+        Result hot = measure(n, count, 0.8, gen);
+        printf("%6d %14.1f %14.1f %9.0f%% %14.1f %14.1f %9.0f%%\n", n,
+               uniform.full, uniform.delta, 100 * (1 - uniform.delta / uniform.full),
+               hot.full, hot.delta, 100 * (1 - hot.delta / hot.full));
+    }
+    return 0;
+}
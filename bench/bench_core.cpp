@@ -0,0 +1,523 @@
+// bench_core - Microbenchmarks for the delivery core, with JSON output that
+// can be kept and compared across commits.
+//
+// Benchmarks, each run for every cluster size and (where it matters) payload
+// size; one iteration is one message:
+//
+//   can_deliver    clock_ready() on a message that is deliverable (full scan),
+//                  for each clock kernel the CPU supports
+//   clock_merge    clock_merge() of a message clock into the local clock,
+//                  likewise
+//   encode         encode_frame() with delta clocks
+//   decode         FrameDecoder::next() on delta-clock frames
+//   deliver        in-order frames through Process::on_receive(): decode,
+//                  can_deliver and deliver_message
+//   check_buffer   the same with frames reordered across senders in blocks
+//                  of depth messages, so most of them wait in the buffer and
+//                  are released by check_buffer
+//
+// The other benchmarks use the kernels picked at startup. Every message
+// depends on all earlier ones and the receiver is process 0,
+// which never sends. Frames for the Process benchmarks keep each link in
+// order, as TCP would.
+//
+// Usage: bench/bench_core [--filter text] [--min-time s] [--sizes n,...]
+//                         [--payloads bytes,...] [--depths d,...] [--json file]
+//        bench/bench_core --compare base.json new.json
+//
+// --json writes the results in the layout of Google Benchmark's JSON output
+// (one benchmark per line); --compare reads two such files and prints the
+// change in time per message for every benchmark they share.
+
+#include "config.h"
+#include "logger.h"
+#include "process.h"
+#include "transport.h"
+#include "vector_clock.h"
+#include "wire.h"
+#include "workload.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Timing for one benchmark. The body runs in passes; each pass times its
+// measured part with start()/stop() and reports how many messages it
+// handled, and passes repeat until min_time of measured time has built up.
+class State {
+private:
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point real_start;
+    double cpu_start;
+
+    static double cpu_now() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+    }
+
+public:
+    double real_ns = 0;
+    double cpu_ns = 0;
+    long long items = 0;
+
+    void start() {
+        real_start = Clock::now();
+        cpu_start = cpu_now();
+    }
+    void stop(long long processed) {
+        cpu_ns += cpu_now() - cpu_start;
+        real_ns += std::chrono::duration<double, std::nano>(Clock::now() - real_start).count();
+        items += processed;
+    }
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(State&)> pass;
+};
+
+struct Result {
+    std::string name;
+    long long iterations;
+    double real_time;                 // ns per message
+    double cpu_time;
+};
+
+// Keeps benchmark results observable so the work is not optimised away
+static volatile long long sink;
+
+// Messages in which each one depends on all earlier ones, from senders
+// 1..n-1 chosen at random. Successive calls continue the same history.
+class History {
+private:
+    std::vector<int> clock;
+    std::mt19937 gen;
+    std::string payload;
+
+public:
+    History(int n, int payload_size) : clock(n, 0), gen(n * 1000003u + payload_size), payload(payload_size, 'x') {}
+
+    void next(Message& msg) {
+        msg.sender_id = std::uniform_int_distribution<>(1, clock.size() - 1)(gen);
+        msg.seq_number = clock[msg.sender_id]++;
+        msg.channel = 0;
+        msg.channel_seq = msg.seq_number;
+        msg.vector_clock = clock;
+        msg.data = payload;
+        msg.send_time_ns = wall_clock_ns();
+    }
+
+    std::mt19937& rng() { return gen; }
+};
+
+// Messages per pass: enough that the first, full-clock delta frame of each
+// sender is a small share
+static int pass_length(int n) {
+    return std::max(4096, 64 * n);
+}
+
+static Benchmark can_deliver_bench(int n, const ClockKernels& kernels) {
+    std::shared_ptr<std::vector<Message> > messages(new std::vector<Message>(pass_length(n)));
+    History history(n, 0);
+    for (Message& msg : *messages) {
+        history.next(msg);
+    }
+    Benchmark b;
+    b.name = "can_deliver/n:" + std::to_string(n) + "/kernel:" + kernels.name;
+    b.pass = [messages, n, kernels](State& state) {
+        // Before message k is delivered the local clock is its clock less
+        // its own entry, so every check scans the whole clock and succeeds
+        ClockKernels saved = clock_kernels;
+        clock_kernels = kernels;
+        std::vector<int> local(n, 0);
+        long long ready = 0;
+        state.start();
+        for (const Message& msg : *messages) {
+            ready += clock_ready(msg.vector_clock, local, msg.sender_id, 0);
+            local[msg.sender_id]++;
+        }
+        state.stop(messages->size());
+        clock_kernels = saved;
+        if (ready != (long long)messages->size()) {
+            fprintf(stderr, "can_deliver/%s: %lld of %zu ready\n", kernels.name, ready, messages->size());
+            exit(1);
+        }
+    };
+    return b;
+}
+
+static Benchmark clock_merge_bench(int n, const ClockKernels& kernels) {
+    std::shared_ptr<std::vector<Message> > messages(new std::vector<Message>(pass_length(n)));
+    History history(n, 0);
+    for (Message& msg : *messages) {
+        history.next(msg);
+    }
+    Benchmark b;
+    b.name = "clock_merge/n:" + std::to_string(n) + "/kernel:" + kernels.name;
+    b.pass = [messages, n, kernels](State& state) {
+        ClockKernels saved = clock_kernels;
+        clock_kernels = kernels;
+        std::vector<int> local(n, 0);
+        state.start();
+        for (const Message& msg : *messages) {
+            clock_merge(local, msg.vector_clock);
+        }
+        state.stop(messages->size());
+        clock_kernels = saved;
+        if (local != messages->back().vector_clock) {
+            fprintf(stderr, "clock_merge/%s: wrong result\n", kernels.name);
+            exit(1);
+        }
+    };
+    return b;
+}
+
+static Benchmark encode_bench(int n, int payload) {
+    std::shared_ptr<std::vector<Message> > messages(new std::vector<Message>(pass_length(n)));
+    History history(n, payload);
+    for (Message& msg : *messages) {
+        history.next(msg);
+    }
+    std::shared_ptr<std::vector<char> > out(new std::vector<char>);
+    Benchmark b;
+    b.name = "encode/n:" + std::to_string(n) + "/payload:" + std::to_string(payload);
+    b.pass = [messages, out, n](State& state) {
+        std::vector<std::vector<int> > bases(n);
+        long long bytes = 0;
+        state.start();
+        for (const Message& msg : *messages) {
+            out->clear();
+            encode_frame(msg, *out, &bases[msg.sender_id]);
+            bytes += out->size();
+        }
+        state.stop(messages->size());
+        sink = bytes;
+    };
+    return b;
+}
+
+static Benchmark decode_bench(int n, int payload) {
+    // One encoded frame per message, each sender's delta-encoded against
+    // its own previous message as on a real link
+    struct Frames {
+        std::vector<char> bytes;
+        std::vector<size_t> offsets;
+        std::vector<int> senders;
+    };
+    std::shared_ptr<Frames> frames(new Frames);
+    History history(n, payload);
+    std::vector<std::vector<int> > bases(n);
+    Message msg;
+    for (int k = 0; k < pass_length(n); k++) {
+        history.next(msg);
+        frames->offsets.push_back(frames->bytes.size());
+        frames->senders.push_back(msg.sender_id);
+        encode_frame(msg, frames->bytes, &bases[msg.sender_id]);
+    }
+    frames->offsets.push_back(frames->bytes.size());
+
+    Benchmark b;
+    b.name = "decode/n:" + std::to_string(n) + "/payload:" + std::to_string(payload);
+    b.pass = [frames, n](State& state) {
+        std::vector<FrameDecoder> decoders(n);
+        Message msg;
+        FrameType type;
+        long long decoded = 0;
+        size_t count = frames->senders.size();
+        state.start();
+        for (size_t k = 0; k < count; k++) {
+            FrameDecoder& decoder = decoders[frames->senders[k]];
+            size_t len = frames->offsets[k + 1] - frames->offsets[k];
+            memcpy(decoder.write_ptr(len), &frames->bytes[frames->offsets[k]], len);
+            decoder.commit(len);
+            decoded += decoder.next(msg, type);
+        }
+        state.stop(count);
+        if (decoded != (long long)count) {
+            fprintf(stderr, "decode: %lld of %zu frames decoded\n", decoded, count);
+            exit(1);
+        }
+    };
+    return b;
+}
+
+// What a Process needs to receive and deliver without sockets: a real clock
+// for its timestamps, and nowhere to send (the receiver never broadcasts)
+class NullTransport : public Transport {
+public:
+    int64_t now_ns() override { return wall_clock_ns(); }
+    void arm_timer(uint64_t, long long) override {}
+    void send(int, const char*, size_t) override {}
+    bool congested() override { return false; }
+    bool drained() override { return true; }
+};
+
+// Process 0 receiving the history as frames from its peers, depth messages
+// at a time with the order across senders shuffled inside each block
+static Benchmark receive_bench(const std::string& name, int n, int payload, int depth) {
+    struct Feed {
+        ClusterConfig cluster;
+        NullTransport transport;
+        std::unique_ptr<Process> process;
+        History history;
+        std::vector<std::vector<int> > bases;
+        std::vector<char> bytes;
+        std::vector<size_t> offsets;
+        std::vector<int> senders;
+        long long fed = 0;
+
+        Feed(int n, int payload) : cluster(ClusterConfig::local(n)), history(n, payload), bases(n) {
+            process.reset(new Process(0, cluster, WorkloadConfig(), false));
+            process->attach(&transport);
+            process->set_stats_interval(0);
+        }
+    };
+    std::shared_ptr<Feed> feed(new Feed(n, payload));
+
+    Benchmark b;
+    b.name = name;
+    b.pass = [feed, name, n, depth](State& state) {
+        int count = std::max(pass_length(n), depth) / depth * depth;
+        std::vector<Message> block(depth);
+        std::vector<int> order(depth);
+        std::vector<std::deque<int> > by_sender(n);
+        feed->bytes.clear();
+        feed->offsets.clear();
+        feed->senders.clear();
+        for (int start = 0; start < count; start += depth) {
+            // Shuffle the block, then give each sender's slots back to its
+            // own messages in order, so every link stays FIFO
+            for (int k = 0; k < depth; k++) {
+                feed->history.next(block[k]);
+                by_sender[block[k].sender_id].push_back(k);
+                order[k] = k;
+            }
+            std::shuffle(order.begin(), order.end(), feed->history.rng());
+            for (int k = 0; k < depth; k++) {
+                std::deque<int>& queue = by_sender[block[order[k]].sender_id];
+                Message& msg = block[queue.front()];
+                queue.pop_front();
+                feed->offsets.push_back(feed->bytes.size());
+                feed->senders.push_back(msg.sender_id);
+                encode_frame(msg, feed->bytes, &feed->bases[msg.sender_id]);
+            }
+        }
+        feed->offsets.push_back(feed->bytes.size());
+
+        Process& process = *feed->process;
+        state.start();
+        for (int k = 0; k < count; k++) {
+            process.on_receive(feed->senders[k], &feed->bytes[feed->offsets[k]],
+                               feed->offsets[k + 1] - feed->offsets[k]);
+        }
+        state.stop(count);
+        feed->fed += count;
+        if (process.messages_delivered() != feed->fed) {
+            fprintf(stderr, "%s: delivered %lld of %lld\n", name.c_str(), process.messages_delivered(), feed->fed);
+            exit(1);
+        }
+    };
+    return b;
+}
+
+static Result run(const Benchmark& bench, double min_time_s) {
+    // One untimed pass to warm caches and grow buffers
+    State warmup;
+    bench.pass(warmup);
+
+    State state;
+    while (state.real_ns < min_time_s * 1e9) {
+        bench.pass(state);
+    }
+    Result r = {bench.name, state.items, state.real_ns / state.items, state.cpu_ns / state.items};
+    return r;
+}
+
+static void write_json(const std::string& path, const std::vector<Result>& results, double min_time_s) {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        fprintf(stderr, "Cannot write %s\n", path.c_str());
+        exit(1);
+    }
+    char date[64];
+    time_t t = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+    out << "{\n  \"context\": {\"date\": \"" << date << "\", \"executable\": \"bench/bench_core\", "
+        << "\"num_cpus\": " << std::thread::hardware_concurrency() << ", \"min_time\": " << min_time_s << "},\n"
+        << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "    {\"name\": \"%s\", \"iterations\": %lld, \"real_time\": %.3f, \"cpu_time\": %.3f, "
+                 "\"time_unit\": \"ns\", \"items_per_second\": %.0f}%s\n",
+                 r.name.c_str(), r.iterations, r.real_time, r.cpu_time, 1e9 / r.real_time,
+                 i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+}
+
+// Name -> real_time from a file written by write_json
+static std::map<std::string, double> read_json(const std::string& path, std::vector<std::string>& names) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        exit(2);
+    }
+    std::map<std::string, double> times;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t time = line.find("\"real_time\": ");
+        if (name == std::string::npos || time == std::string::npos) {
+            continue;
+        }
+        name += 9;
+        std::string key = line.substr(name, line.find('"', name) - name);
+        times[key] = atof(line.c_str() + time + 13);
+        names.push_back(key);
+    }
+    return times;
+}
+
+static int compare(const std::string& base_path, const std::string& new_path) {
+    std::vector<std::string> names, ignored;
+    std::map<std::string, double> base = read_json(base_path, ignored);
+    std::map<std::string, double> next = read_json(new_path, names);
+    printf("%-40s %12s %12s %9s\n", "benchmark", "base ns", "new ns", "change");
+    for (const std::string& name : names) {
+        if (base.count(name)) {
+            printf("%-40s %12.2f %12.2f %+8.1f%%\n", name.c_str(), base[name], next[name],
+                   (next[name] / base[name] - 1) * 100);
+        }
+    }
+    return 0;
+}
+
+static std::vector<int> parse_list(const char* text) {
+    std::vector<int> values;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        values.push_back(atoi(item.c_str()));
+    }
+    return values;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--filter text] [--min-time s] [--sizes n,...] [--payloads bytes,...]\n"
+            "          [--depths d,...] [--json file]\n"
+            "       %s --compare base.json new.json\n",
+            prog, prog);
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string json_path;
+    double min_time_s = 0.2;
+    std::vector<int> sizes = {4, 16, 64, 256};
+    std::vector<int> payloads = {0, 64, 1024};
+    std::vector<int> depths = {8, 64, 512};
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--compare" && i + 2 < argc) {
+            return compare(argv[i + 1], argv[i + 2]);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            min_time_s = atof(argv[++i]);
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            sizes = parse_list(argv[++i]);
+        } else if (arg == "--payloads" && i + 1 < argc) {
+            payloads = parse_list(argv[++i]);
+        } else if (arg == "--depths" && i + 1 < argc) {
+            depths = parse_list(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (int n : sizes) {
+        if (n < 2) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (int d : depths) {
+        if (d < 1) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    Logger::instance().configure(LOG_ERROR, 1, "", 0, 1);
+    Logger::instance().start();
+
+    // Built lazily, so a filter skips the setup of what it excludes
+    std::vector<std::function<Benchmark()> > benches;
+    std::vector<std::string> names;
+    for (int n : sizes) {
+        std::string size = "/n:" + std::to_string(n);
+        for (const ClockKernels& k : supported_clock_kernels()) {
+            std::string kernel = std::string("/kernel:") + k.name;
+            names.push_back("can_deliver" + size + kernel);
+            benches.push_back([n, k] { return can_deliver_bench(n, k); });
+        }
+        for (const ClockKernels& k : supported_clock_kernels()) {
+            std::string kernel = std::string("/kernel:") + k.name;
+            names.push_back("clock_merge" + size + kernel);
+            benches.push_back([n, k] { return clock_merge_bench(n, k); });
+        }
+        for (int p : payloads) {
+            std::string payload = "/payload:" + std::to_string(p);
+            names.push_back("encode" + size + payload);
+            benches.push_back([n, p] { return encode_bench(n, p); });
+            names.push_back("decode" + size + payload);
+            benches.push_back([n, p] { return decode_bench(n, p); });
+            names.push_back("deliver" + size + payload);
+            benches.push_back([n, p] { return receive_bench("deliver/n:" + std::to_string(n) + "/payload:" +
+                                                            std::to_string(p), n, p, 1); });
+            for (int d : depths) {
+                std::string name = "check_buffer" + size + "/depth:" + std::to_string(d) + payload;
+                names.push_back(name);
+                benches.push_back([name, n, p, d] { return receive_bench(name, n, p, d); });
+            }
+        }
+    }
+
+    std::vector<Result> results;
+    printf("%-40s %12s %12s %14s\n", "benchmark", "ns/msg", "cpu ns/msg", "iterations");
+    for (size_t i = 0; i < benches.size(); i++) {
+        if (names[i].find(filter) == std::string::npos) {
+            continue;
+        }
+        Result r = run(benches[i](), min_time_s);
+        printf("%-40s %12.2f %12.2f %14lld\n", r.name.c_str(), r.real_time, r.cpu_time, r.iterations);
+        fflush(stdout);
+        results.push_back(r);
+    }
+    Logger::instance().stop();
+
+    if (!json_path.empty()) {
+        write_json(json_path, results, min_time_s);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+// bench_journal - Journal write overhead and recovery time against journal
+// size.
+//
+// For each size, writes a fresh journal as process 0 of a 4-node cluster
+// would: every message it sends is followed by one delivery from each peer.
+// Appends run flat out while the sync thread commits them in groups; the
+// append time includes waiting for the last group to become durable. The
+// journal is then closed and reopened, which is what a restarting process
+// does, and finally the last 1000 sent messages are read back as they would
+// be for a peer that missed them.
+//
+// Usage: bench/bench_journal [--dir path] [--payload bytes] [messages...]
+
+#include "journal.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    std::string dir = "/tmp";
+    size_t payload = 64;
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--payload") == 0 && i + 1 < argc) {
+            payload = atol(argv[++i]);
+        } else if (atoi(argv[i]) > 0) {
+            sizes.push_back(atoi(argv[i]));
+        } else {
+            fprintf(stderr, "Usage: %s [--dir path] [--payload bytes] [messages...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (sizes.empty()) {
+        sizes = {10000, 100000, 1000000};
+    }
+
+    const int n = 4;
+    const int resend = 1000;
+    std::string path = dir + "/bench_journal." + std::to_string(getpid());
+    printf("%10s %12s %16s %10s %14s %14s %14s\n", "messages", "journal (MB)", "append (ns/rec)",
+           "syncs", "records/sync", "recovery (ms)", "resend (ms)");
+
+    for (int count : sizes) {
+        unlink(path.c_str());
+        Message msg;
+        msg.sender_id = 0;
+        msg.channel = 0;
+        msg.vector_clock.assign(n, 0);
+        msg.data.assign(payload, 'x');
+        msg.send_time_ns = 0;
+
+        std::unique_ptr<Journal> journal(new Journal(path, 0, n));
+        Clock::time_point start = Clock::now();
+        for (int k = 0; k < count; k++) {
+            msg.seq_number = msg.channel_seq = k;
+            msg.vector_clock[0] = k + 1;
+            journal->append_sent(msg);
+            for (int peer = 1; peer < n; peer++) {
+                msg.vector_clock[peer] = k + 1;
+                journal->append_delivered(peer, k);
+            }
+        }
+        journal->sync();
+        double append_ms = ms_since(start);
+        long long records = (long long)count * n;
+        double megabytes = journal->end() / 1048576.0;
+        unsigned long long syncs = journal->syncs();
+        journal.reset();
+
+        start = Clock::now();
+        journal.reset(new Journal(path, 0, n));
+        double recovery_ms = ms_since(start);
+        if (journal->clock()[0] != count || journal->clock()[n - 1] != count) {
+            fprintf(stderr, "recovered clock [%d, ..., %d], expected %d\n",
+                    journal->clock()[0], journal->clock()[n - 1], count);
+            return 1;
+        }
+
+        std::vector<char> frames;
+        start = Clock::now();
+        journal->read_sent(count > resend ? count - resend : 0, frames);
+        double resend_ms = ms_since(start);
+        journal.reset();
+
+        printf("%10d %12.1f %16.0f %10llu %14.0f %14.2f %14.2f\n", count, megabytes,
+               append_ms * 1e6 / records, syncs, syncs ? (double)records / syncs : 0.0,
+               recovery_ms, resend_ms);
+    }
+    unlink(path.c_str());
+    return 0;
+}
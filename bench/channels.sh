@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# channels.sh - What independent channels (--channels) save in ordering
+# wait. Four nodes on localhost with simulated network delay, so messages
+# arrive out of order; with more channels a late message holds up only the
+# messages of its own channel.
+#
+# Usage: bench/channels.sh [rate] [ordering]
+#   rate      per-node msg/s (default 2000)
+#   ordering  fifo | causal (default) | total
+#
+# recv->deliver is the time a message waits for its ordering. Every run is
+# traced and checked with tools/verify; VERIFY=0 skips that. Extra
+# arguments go to every node, e.g. --io-threads 2.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RATE=${1:-2000}
+ORDERING=${2:-causal}
+shift $(($# < 2 ? $# : 2))
+N=4
+BASE_PORT=${BASE_PORT:-9300}
+VERIFY=${VERIFY:-1}
+
+make -s || exit 1
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+CONFIG="$OUT/cluster.conf"
+for ((i = 0; i < N; i++)); do
+    echo "$i localhost $((BASE_PORT + i))" >> "$CONFIG"
+done
+
+# Run all nodes with the given options and print
+# "net-p50 wait-p50 wait-p99"
+run() {
+    PIDS=()
+    for ((i = 0; i < N; i++)); do
+        TRACE=()
+        if [ "$VERIFY" != 0 ]; then
+            TRACE=(--trace "$OUT/trace$i.bin")
+        fi
+        ./causal_broadcast $i delay --config "$CONFIG" --log-level info --payload 64 "${TRACE[@]}" "$@" > "$OUT/log$i.txt" 2>&1 &
+        PIDS+=($!)
+    done
+    wait "${PIDS[@]}"
+    if [ "$VERIFY" != 0 ] && ! tools/verify "$OUT"/trace*.bin > "$OUT/verify.txt"; then
+        echo "delivery order check failed ($*):" >&2
+        cat "$OUT/verify.txt" >&2
+        exit 1
+    fi
+    cat "$OUT"/log*.txt | awk '
+        /^send->recv/               { net += $4; cn++ }
+        /^recv->deliver/            { p50 += $4; if ($5 > p99) p99 = $5; cl++ }
+        END { printf "%10.1f %10.1f %10.1f\n", net / cn, p50 / cl, p99 }'
+}
+
+printf "%-8s   %10s %10s %10s\n" "channels" "net p50" "wait p50" "wait p99"
+printf "%-8s   %32s\n" "" "(us, $ORDERING order at $RATE msg/s per node)"
+for CHANNELS in 1 2 4 16; do
+    RESULT=$(run --ordering "$ORDERING" --channels $CHANNELS --rate "$RATE" --messages $((RATE * 2)) "$@") || exit 1
+    printf "%-8s   %s\n" "$CHANNELS" "$RESULT"
+done
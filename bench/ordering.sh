@@ -0,0 +1,66 @@
+#!/bin/bash
+
+# ordering.sh - Throughput and latency of each ordering mode (--ordering)
+# over the same transport and buffering. Four nodes on localhost.
+#
+# Usage: bench/ordering.sh [messages] [rate]
+#   messages  per node for the throughput runs (default 200000)
+#   rate      per-node msg/s for the latency runs (default 20000)
+#
+# Latency is split as the nodes report it: send->recv is the network,
+# recv->deliver the time a message waits for its ordering. Every run is
+# traced and checked with tools/verify; VERIFY=0 skips that. Extra
+# arguments go to every node, e.g. --io-threads 2 or --batch-size 4096.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MESSAGES=${1:-200000}
+RATE=${2:-20000}
+shift 2 2> /dev/null
+N=4
+BASE_PORT=${BASE_PORT:-9200}
+VERIFY=${VERIFY:-1}
+
+make -s || exit 1
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+CONFIG="$OUT/cluster.conf"
+for ((i = 0; i < N; i++)); do
+    echo "$i localhost $((BASE_PORT + i))" >> "$CONFIG"
+done
+
+# Run all nodes with the given options and print
+# "throughput bytes/msg net-p50 wait-p50 wait-p99"
+run() {
+    PIDS=()
+    for ((i = 0; i < N; i++)); do
+        TRACE=()
+        if [ "$VERIFY" != 0 ]; then
+            TRACE=(--trace "$OUT/trace$i.bin")
+        fi
+        ./causal_broadcast $i --config "$CONFIG" --log-level info --payload 64 "${TRACE[@]}" "$@" > "$OUT/log$i.txt" 2>&1 &
+        PIDS+=($!)
+    done
+    wait "${PIDS[@]}"
+    if [ "$VERIFY" != 0 ] && ! tools/verify "$OUT"/trace*.bin > "$OUT/verify.txt"; then
+        echo "delivery order check failed ($*):" >&2
+        cat "$OUT/verify.txt" >&2
+        exit 1
+    fi
+    cat "$OUT"/log*.txt | awk '
+        /^Delivery throughput:/     { t += $3; ct++ }
+        /^Wire bytes per message:/  { b += $5; cb++ }
+        /^send->recv/               { net += $4; cn++ }
+        /^recv->deliver/            { p50 += $4; if ($5 > p99) p99 = $5; cl++ }
+        END { printf "%12.0f %10.1f %10.1f %10.1f %10.1f\n", t / ct, b / cb, net / cn, p50 / cl, p99 }'
+}
+
+printf "%-8s %12s %10s   %10s %10s %10s\n" "ordering" "max msg/s" "B/msg" "net p50" "wait p50" "wait p99"
+printf "%-8s %12s %10s   %32s\n" "" "" "" "(us, at $RATE msg/s per node)"
+for MODE in fifo causal total; do
+    MAX=$(run --ordering $MODE --max-throughput --messages "$MESSAGES" "$@") || exit 1
+    PACED=$(run --ordering $MODE --rate "$RATE" --messages $((RATE * 2)) "$@") || exit 1
+    printf "%-8s %s   %s\n" "$MODE" "$(echo $MAX | awk '{ printf "%12.0f %10.1f", $1, $2 }')" \
+        "$(echo $PACED | awk '{ printf "%10.1f %10.1f %10.1f", $3, $4, $5 }')"
+done
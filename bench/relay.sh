@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# relay.sh - Full mesh against a relay tree (--relay-tree) as the cluster
+# grows, on the simulated network. Every node broadcasts the same messages
+# either way; the table shows what one broadcast costs its sender, the most
+# any one node sends, and how long messages take to be delivered.
+#
+# Usage: bench/relay.sh [nodes...]   (default 16 32 64 128 256)
+#
+# FANOUT sets the tree's fanout (default 4), PAYLOAD the message size in
+# bytes (default 64) and BANDWIDTH every node's egress in Mbit/s (default
+# 1000, 0 for unlimited). Extra options for tools/sim go in SIM_OPTS, e.g.
+# SIM_OPTS="--ordering total".
+
+cd "$(dirname "$0")/.." || exit 1
+
+FANOUT=${FANOUT:-4}
+PAYLOAD=${PAYLOAD:-64}
+BANDWIDTH=${BANDWIDTH:-1000}
+SIZES=("$@")
+if [ ${#SIZES[@]} -eq 0 ]; then
+    SIZES=(16 32 64 128 256)
+fi
+
+make -s tools/sim || exit 1
+
+# Run the sim with the given options and print
+# "sender-B/msg peak-MB e2e-p50 e2e-p99 wall-s"
+run() {
+    OUTPUT=$(tools/sim --messages 20 --payload "$PAYLOAD" --bandwidth "$BANDWIDTH" $SIM_OPTS "$@" 2>&1)
+    if [ $? -ne 0 ]; then
+        echo "tools/sim $* failed:" >&2
+        echo "$OUTPUT" >&2
+        exit 1
+    fi
+    echo "$OUTPUT" | awk '
+        /^Sender egress:/      { sender = $3 }
+        /^Peak node egress:/   { peak = $4 }
+        /^End-to-end latency:/ { p50 = $4; p99 = $7 }
+        /^Wall time:/          { wall = $3 }
+        END { printf "%12s %10s %10s %10s %8s\n", sender, peak, p50, p99, wall }'
+}
+
+printf "%-6s %-8s %12s %10s %10s %10s %8s\n" "nodes" "mode" "sender B/msg" "peak MB" "e2e p50" "e2e p99" "wall s"
+printf "%-15s %s\n" "" "(us; $PAYLOAD-byte payloads, $BANDWIDTH Mbit/s egress per node)"
+for N in "${SIZES[@]}"; do
+    RESULT=$(run --nodes "$N") || exit 1
+    printf "%-6s %-8s %s\n" "$N" "mesh" "$RESULT"
+    RESULT=$(run --nodes "$N" --relay-tree "$FANOUT") || exit 1
+    printf "%-6s %-8s %s\n" "$N" "tree $FANOUT" "$RESULT"
+done
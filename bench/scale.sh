@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# scale.sh - Measure connection setup time, delivery throughput and wire
+# bytes per message as the cluster grows. Every node runs on localhost.
+#
+# Usage: bench/scale.sh [sizes...]       (default: 4 8 16 32 64)
+#
+# Workload options for every node can be passed in $WORKLOAD, e.g.
+#   WORKLOAD="--max-throughput --messages 10000" bench/scale.sh 4 8
+#
+# Every run is traced and checked with tools/verify; VERIFY=0 skips that.
+
+cd "$(dirname "$0")/.." || exit 1
+
+SIZES="$@"
+if [ -z "$SIZES" ]; then
+    SIZES="4 8 16 32 64"
+fi
+BASE_PORT=${BASE_PORT:-9000}
+VERIFY=${VERIFY:-1}
+
+make -s || exit 1
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+printf "%6s %16s %16s %22s %12s\n" "N" "setup avg (ms)" "setup max (ms)" "throughput/node (msg/s)" "bytes/msg"
+for N in $SIZES; do
+    # Generate a localhost config for N nodes
+    CONFIG="$OUT/cluster$N.conf"
+    for ((i = 0; i < N; i++)); do
+        echo "$i localhost $((BASE_PORT + i))" >> "$CONFIG"
+    done
+
+    PIDS=()
+    for ((i = 0; i < N; i++)); do
+        TRACE=()
+        if [ "$VERIFY" != 0 ]; then
+            TRACE=(--trace "$OUT/trace$N.$i.bin")
+        fi
+        ./causal_broadcast $i --config "$CONFIG" "${TRACE[@]}" $WORKLOAD > "$OUT/log$N.$i.txt" 2>&1 &
+        PIDS+=($!)
+    done
+    wait "${PIDS[@]}"
+    if [ "$VERIFY" != 0 ] && ! tools/verify "$OUT"/trace$N.*.bin > "$OUT/verify$N.txt"; then
+        echo "N=$N: delivery order check failed:"
+        cat "$OUT/verify$N.txt"
+        exit 1
+    fi
+
+    cat "$OUT"/log$N.*.txt | awk -v n=$N '
+        /^Setup time:/          { s += $3; if ($3 > smax) smax = $3; cs++ }
+        /^Delivery throughput:/ { t += $3; ct++ }
+        /^Wire bytes per message:/ { b += $5; cb++ }
+        END {
+            if (cs < n) { printf "%6d  only %d of %d nodes finished\n", n, cs, n; exit }
+            printf "%6d %16.1f %16.1f %22.0f %12.1f\n", n, s / cs, smax, t / ct, cb ? b / cb : 0
+        }'
+done
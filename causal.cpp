@@ -0,0 +1,29 @@
+#include "causal.h"
+#include "workload.h"
+
+CausalNode::CausalNode(int id, const ClusterConfig& cluster)
+    : process(id, cluster, WorkloadConfig(), false), started(false) {
+    process.use_application_source();
+}
+
+CausalNode::~CausalNode() {
+    if (started) {
+        stop();
+    }
+}
+
+void CausalNode::start() {
+    if (!started) {
+        started = true;
+        runner = std::thread(&Process::run, &process);
+    }
+}
+
+bool CausalNode::stop() {
+    process.request_stop();
+    if (runner.joinable()) {
+        runner.join();
+    }
+    started = false;
+    return !process.run_failed();
+}
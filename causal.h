@@ -0,0 +1,96 @@
+#pragma once
+#include <thread>
+#include "config.h"
+#include "message.h"
+#include "process.h"
+
+// One node of a causal broadcast cluster, embedded in an application. This
+// is the public face of libcausal.a.
+//
+//   CausalNode node(my_id, ClusterConfig::load("cluster.txt"));
+//   node.on_deliver([](const Delivery& d) { ... });
+//   node.start();
+//   node.broadcast(data, len);
+//   ...
+//   node.stop();
+//
+// The node connects to its peers and runs its event loop on a background
+// thread. broadcast() only queues the payload. Every node delivers each
+// message from its peers once, in causal order unless set_ordering() says
+// otherwise, through the delivery callback; a node's own messages are not
+// delivered back to it.
+//
+// With set_channels(), the node carries several independent broadcast
+// groups over the same connections: each channel has its own clocks, order
+// and sequence numbers, and a message is only ever held back for messages
+// in its own channel. broadcast() and on_deliver() then take a channel;
+// without one they mean channel 0, and on_deliver() every channel.
+//
+// With set_relay_tree(), the node links only to its neighbours in a
+// spanning tree of the cluster and passes their messages on, so each
+// broadcast leaves it a few times instead of once per peer. Credit flow
+// control and reconnection are then off: the delivery buffer is unbounded,
+// and a lost link is an error.
+//
+// stop() is a cluster-wide operation: it announces that this node has
+// finished sending, then returns once every peer has done the same and
+// everything they sent has been delivered.
+//
+// Logging goes through Logger::instance(), whose default level writes a line
+// per message to stdout; configure it first, e.g. to LOG_ERROR.
+class CausalNode {
+private:
+    Process process;
+    std::thread runner;
+    bool started;
+
+public:
+    CausalNode(int id, const ClusterConfig& cluster);
+    ~CausalNode();                    // Calls stop() if still running
+
+    // Configure before start(); see the command line options of the same names
+    void set_batching(size_t bytes, long long delay_us) { process.set_batching(bytes, delay_us); }
+    void set_delta_clocks(bool enabled) { process.set_delta_clocks(enabled); }
+    void set_ordering(OrderingMode mode) { process.set_ordering(mode); }
+    void set_channels(int count) { process.set_channels(count); }
+    void set_shared_memory(bool enabled) { process.set_shared_memory(enabled); }
+    void set_io_threads(int threads) { process.set_io_threads(threads); }
+    void set_stats_interval(double seconds) { process.set_stats_interval(seconds); }
+    void set_connect_timeout(double seconds) { process.set_connect_timeout(seconds); }
+    void set_journal(const std::string& path) { process.set_journal(path); }
+    void set_retransmit_window(long long bytes) { process.set_retransmit_window(bytes); }
+    void set_buffer_limit(size_t bytes) { process.set_buffer_limit(bytes); }
+    void set_metrics_file(const std::string& path, double interval_s = 1) { process.set_metrics_file(path, interval_s); }
+    void set_relay_tree(int fanout) { process.set_relay_tree(fanout); }
+
+    // Called for every delivery, on the node's delivery thread. The Delivery
+    // points into the node's buffers: copy anything needed after returning.
+    // The callback may call broadcast(); the message then depends on this
+    // one if it goes on the same channel.
+    void on_deliver(const DeliveryHandler& handler) { process.set_delivery_handler(handler); }
+
+    // Called instead for deliveries in one channel, after set_channels()
+    void on_deliver(int channel, const DeliveryHandler& handler) { process.set_delivery_handler(channel, handler); }
+
+    // Called on the node's sending thread with true when its outbound queues
+    // fill up, or a peer has a full credit window of its messages buffered
+    // (broadcast() then returns BROADCAST_BUSY), and false once sending can
+    // resume. Must not block.
+    void on_backpressure(const BackpressureHandler& handler) { process.set_backpressure_handler(handler); }
+
+    // Connect and start the event loop in the background; returns at once.
+    // Messages broadcast before the cluster is connected are sent afterwards.
+    void start();
+
+    // Queue a copy of the payload for broadcast, from any thread, without
+    // waiting on the network. Throws std::invalid_argument if it cannot fit
+    // in one frame or the channel does not exist. Each channel's queue is
+    // sent in turn with the others, so a busy one does not hold up the rest.
+    BroadcastResult broadcast(const char* data, size_t len) { return process.submit(0, data, len); }
+    BroadcastResult broadcast(int channel, const char* data, size_t len) { return process.submit(channel, data, len); }
+    bool congested() const { return process.congested(); }
+
+    // Finish sending and wait for the rest of the cluster, as above. Returns
+    // false if the node failed (for example, a peer never connected).
+    bool stop();
+};
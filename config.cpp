@@ -0,0 +1,82 @@
+#include "config.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+ClusterConfig ClusterConfig::load(const std::string& path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        throw std::runtime_error("Cannot open config file: " + path);
+    }
+
+    ClusterConfig config;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) {
+            line.erase(hash);
+        }
+
+        std::istringstream fields(line);
+        NodeConfig node;
+        if (!(fields >> node.id)) {
+            continue; // Blank or comment-only line
+        }
+        std::string extra;
+        if (!(fields >> node.host >> node.port) || (fields >> extra)) {
+            throw std::runtime_error(path + ":" + std::to_string(line_no)
+                                     + ": expected '<id> <host> <port>'");
+        }
+        if (node.port <= 0 || node.port > 65535) {
+            throw std::runtime_error(path + ":" + std::to_string(line_no)
+                                     + ": invalid port " + std::to_string(node.port));
+        }
+        if (node.id < 0) {
+            throw std::runtime_error(path + ":" + std::to_string(line_no)
+                                     + ": invalid node id " + std::to_string(node.id));
+        }
+
+        if (node.id >= (int)config.nodes.size()) {
+            config.nodes.resize(node.id + 1, NodeConfig{-1, "", 0});
+        }
+        if (config.nodes[node.id].id != -1) {
+            throw std::runtime_error(path + ":" + std::to_string(line_no)
+                                     + ": duplicate node id " + std::to_string(node.id));
+        }
+        config.nodes[node.id] = node;
+    }
+
+    if (config.nodes.size() < 2) {
+        throw std::runtime_error(path + ": at least two nodes are required");
+    }
+    for (size_t i = 0; i < config.nodes.size(); i++) {
+        if (config.nodes[i].id == -1) {
+            throw std::runtime_error(path + ": node id " + std::to_string(i) + " is missing");
+        }
+    }
+    return config;
+}
+
+static bool is_loopback(const std::string& host) {
+    return host == "localhost" || host.compare(0, 4, "127.") == 0 || host == "::1";
+}
+
+bool ClusterConfig::same_host(int a, int b) const {
+    const std::string& host_a = nodes[a].host;
+    const std::string& host_b = nodes[b].host;
+    return host_a == host_b || (is_loopback(host_a) && is_loopback(host_b));
+}
+
+ClusterConfig ClusterConfig::local(int num_nodes, int base_port) {
+    ClusterConfig config;
+    for (int i = 0; i < num_nodes; i++) {
+        NodeConfig node;
+        node.id = i;
+        node.host = "localhost";
+        node.port = base_port + i;
+        config.nodes.push_back(node);
+    }
+    return config;
+}
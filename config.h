@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <string>
+
+// One node of the cluster as listed in the config file
+struct NodeConfig {
+    int id;
+    std::string host;
+    int port;
+};
+
+// Cluster membership. The config file has one node per line:
+//
+//   # id  host       port
+//   0     dc01       8000
+//   1     dc02       8001
+//
+// Blank lines and '#' comments are ignored. IDs must be 0..N-1, each once.
+class ClusterConfig {
+private:
+    std::vector<NodeConfig> nodes;
+
+public:
+    // Load and validate a config file; throws std::runtime_error on errors
+    static ClusterConfig load(const std::string& path);
+
+    // N nodes on localhost with consecutive ports, the historical default
+    static ClusterConfig local(int num_nodes, int base_port = 8000);
+
+    int size() const { return nodes.size(); }
+    const NodeConfig& node(int id) const { return nodes[id]; }
+
+    // True if nodes a and b are configured on the same machine: the same
+    // host name, or both a loopback name or address
+    bool same_host(int a, int b) const;
+};
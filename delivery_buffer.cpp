@@ -0,0 +1,86 @@
+#include "delivery_buffer.h"
+#include <algorithm>
+#include <utility>
+
+const size_t MIN_WINDOW = 16;
+
+DeliveryBuffer::DeliveryBuffer(int num_processes) : pending(num_processes), count(0) {}
+
+void DeliveryBuffer::grow(Window& w, size_t span) {
+    size_t size = std::max(MIN_WINDOW, w.slots.size());
+    while (size < span) {
+        size *= 2;
+    }
+
+    // Re-place the buffered messages; free slots hold no storage
+    std::vector<Message> slots(size);
+    std::vector<char> present(size, 0);
+    size_t old_mask = w.slots.size() - 1;
+    for (int seq = w.low; w.count > 0 && seq <= w.high; seq++) {
+        if (w.present[seq & old_mask]) {
+            std::swap(slots[seq & (size - 1)], w.slots[seq & old_mask]);
+            present[seq & (size - 1)] = 1;
+        }
+    }
+    w.slots.swap(slots);
+    w.present.swap(present);
+}
+
+bool DeliveryBuffer::push(Message& msg) {
+    Window& w = pending[msg.sender_id];
+    int seq = msg.channel_seq;
+    int low = w.count > 0 ? std::min(w.low, seq) : seq;
+    int high = w.count > 0 ? std::max(w.high, seq) : seq;
+    if ((size_t)(high - low) + 1 > w.slots.size()) {
+        grow(w, (size_t)(high - low) + 1);
+    }
+
+    size_t slot = seq & (w.slots.size() - 1);
+    if (w.present[slot]) {
+        return false;
+    }
+    std::swap(w.slots[slot], msg);
+    if (!spare.empty()) {
+        msg = std::move(spare.back());
+        spare.pop_back();
+    }
+    w.present[slot] = 1;
+    w.low = low;
+    w.high = high;
+    w.count++;
+    count++;
+    return true;
+}
+
+Message* DeliveryBuffer::head(int sender) {
+    Window& w = pending[sender];
+    return w.count == 0 ? NULL : &w.slots[w.low & (w.slots.size() - 1)];
+}
+
+void DeliveryBuffer::pop(int sender, Message& out) {
+    Window& w = pending[sender];
+    size_t mask = w.slots.size() - 1;
+    std::swap(out, w.slots[w.low & mask]);
+    spare.push_back(std::move(w.slots[w.low & mask]));
+    w.present[w.low & mask] = 0;
+    w.count--;
+    count--;
+
+    // TCP keeps each sender in order, so the next head is usually adjacent
+    if (w.count > 0) {
+        do {
+            w.low++;
+        } while (!w.present[w.low & mask]);
+    }
+}
+
+std::vector<const Message*> DeliveryBuffer::from(int sender) const {
+    const Window& w = pending[sender];
+    std::vector<const Message*> out;
+    for (int seq = w.low; w.count > 0 && seq <= w.high; seq++) {
+        if (w.present[seq & (w.slots.size() - 1)]) {
+            out.push_back(&w.slots[seq & (w.slots.size() - 1)]);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "message.h"
+
+// One channel's messages waiting for delivery, indexed by sender and
+// ordered by their sequence number in the channel (channel_seq). Only the
+// lowest-sequence message of a sender can ever be the next one delivered
+// from it, so after a delivery only the N heads have to be checked instead
+// of rescanning every buffered message.
+//
+// Each sender's messages sit in a ring indexed by sequence number. Messages
+// are swapped in and out rather than copied, and the clock and payload
+// storage a delivered message leaves behind goes to a pool shared by all
+// senders, which hands it to the next message buffered. A warmed-up buffer
+// does not allocate once it has held as many messages at once as it ever
+// will, whichever senders they come from.
+class DeliveryBuffer {
+private:
+    struct Window {
+        std::vector<Message> slots;   // Power-of-two ring, slot = seq & (size - 1)
+        std::vector<char> present;
+        int low;                      // Lowest buffered seq, while count > 0
+        int high;                     // Highest buffered seq, while count > 0
+        size_t count;
+        Window() : low(0), high(0), count(0) {}
+    };
+
+    std::vector<Window> pending;      // Per sender
+    std::vector<Message> spare;       // Storage of delivered messages, for reuse
+    size_t count;
+
+    static void grow(Window& w, size_t span);
+
+public:
+    explicit DeliveryBuffer(int num_processes);
+
+    // Take msg's contents; msg gets back the storage of an earlier message
+    // for reuse, if there is one. False, leaving msg as it was, if a message
+    // with the same sequence number is already buffered.
+    bool push(Message& msg);
+
+    // Lowest-sequence message from sender, or NULL if none is buffered
+    Message* head(int sender);
+
+    // Swap the head message from sender into out; out's old storage is kept
+    // for reuse
+    void pop(int sender, Message& out);
+
+    // Buffered messages from sender, lowest sequence first (for diagnostics)
+    std::vector<const Message*> from(int sender) const;
+    int num_senders() const { return pending.size(); }
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+};
@@ -0,0 +1,372 @@
+#include "journal.h"
+#include "wire.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The file grows this much at a time, reserved up front so that a full disk
+// fails an append rather than faulting on a mapped page
+const size_t EXTENT_BYTES = 64 * 1024 * 1024;
+// Recovery replays at most about this much past the latest checkpoint
+const uint64_t CHECKPOINT_BYTES = 4 * 1024 * 1024;
+const size_t HEADER_BYTES = 64;
+const uint32_t JOURNAL_VERSION = 1;
+
+// Records: size (including this header), type, epoch, checksum of the
+// type, epoch and body. The epoch goes up on every open, so replay can tell
+// a record written since from one left over beyond the end of an earlier run.
+const size_t RECORD_HEADER = 16;
+const uint32_t RECORD_SENT = 1;       // int seq, then the message's frame
+const uint32_t RECORD_DELIVERED = 2;  // int sender, int seq
+const uint32_t RECORD_CHECKPOINT = 3; // uint64 previous checkpoint, int n, n clock entries
+
+struct Journal::Header {
+    char magic[8];
+    uint32_t version;
+    int32_t process_id;
+    int32_t num_processes;
+    uint32_t epoch;                   // Opens so far
+    uint64_t checkpoint;              // Latest durable checkpoint, 0 before the first
+};
+
+static uint32_t checksum(uint32_t type, uint32_t epoch, const char* body, size_t len) {
+    // FNV-1a: enough to tell a torn or stale record from a complete one
+    uint32_t h = (2166136261u ^ type) * 16777619u;
+    h = (h ^ epoch) * 16777619u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)body[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t load_u32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void fail(const std::string& path, const std::string& what) {
+    throw std::runtime_error("Journal " + path + ": " + what);
+}
+
+Journal::Journal(const std::string& path, int process_id, int num_processes) :
+    path(path),
+    fd(-1),
+    notify(-1),
+    base(NULL),
+    mapped(0),
+    id(process_id),
+    epoch(1),
+    state(num_processes, 0),
+    checkpoint_at(0),
+    since_checkpoint(0),
+    written(HEADER_BYTES),
+    synced(HEADER_BYTES),
+    sync_calls(0),
+    stopping(false) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fail(path, strerror(errno));
+    }
+
+    bool fresh = st.st_size == 0;
+    mapped = fresh ? EXTENT_BYTES : st.st_size;
+    int err = fresh ? posix_fallocate(fd, 0, mapped) : 0;
+    void* memory = err == 0 ? mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (memory == MAP_FAILED) {
+        close(fd);
+        fail(path, strerror(err ? err : errno));
+    }
+    base = (char*)memory;
+
+    // A header of zeros was never written: the process died just after
+    // creating the file
+    Header* header = (Header*)base;
+    if (fresh || (mapped >= HEADER_BYTES && header->version == 0)) {
+        memcpy(header->magic, "CJOURNAL", 8);
+        header->version = JOURNAL_VERSION;
+        header->process_id = process_id;
+        header->num_processes = num_processes;
+        header->epoch = epoch;
+        header->checkpoint = 0;
+        fdatasync(fd);
+    } else if (mapped < HEADER_BYTES || memcmp(header->magic, "CJOURNAL", 8) != 0
+               || header->version != JOURNAL_VERSION) {
+        munmap(base, mapped);
+        close(fd);
+        fail(path, "not a journal");
+    } else if (header->process_id != process_id || header->num_processes != num_processes) {
+        std::string owner = "written by process " + std::to_string(header->process_id) + " of "
+                            + std::to_string(header->num_processes);
+        munmap(base, mapped);
+        close(fd);
+        fail(path, owner);
+    } else {
+        recover();
+        epoch = header->epoch + 1;
+        header->epoch = epoch;
+        fdatasync(fd);
+    }
+
+    notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify < 0) {
+        munmap(base, mapped);
+        close(fd);
+        fail(path, strerror(errno));
+    }
+    syncer = std::thread(&Journal::sync_loop, this);
+}
+
+Journal::~Journal() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    appended.notify_one();
+    syncer.join();
+    munmap(base, mapped);
+    close(fd);
+    close(notify);
+}
+
+void Journal::recover() {
+    // Start from the checkpoint the header names, or from the beginning if
+    // there is none or it is not intact
+    uint64_t end = HEADER_BYTES;
+    uint64_t at = ((Header*)base)->checkpoint;
+    const char* record = at >= HEADER_BYTES ? valid_record(at, mapped) : NULL;
+    if (record && load_u32(record + 4) == RECORD_CHECKPOINT) {
+        end = at;
+    }
+    replay(end, end);
+    written.store(end);
+    synced.store(end);
+}
+
+void Journal::replay(uint64_t from, uint64_t& end) {
+    // Apply records from from on, leaving end after the last intact one.
+    // A record from an earlier epoch than the one before it is a leftover:
+    // the end of the journal was cut short before it, then written over.
+    int n = state.size();
+    uint32_t last_epoch = 0;
+    end = from;
+    const char* record;
+    while ((record = valid_record(end, mapped)) != NULL) {
+        uint32_t size = load_u32(record);
+        uint32_t type = load_u32(record + 4);
+        uint32_t record_epoch = load_u32(record + 8);
+        if (record_epoch < last_epoch) {
+            break;
+        }
+        last_epoch = record_epoch;
+        const char* body = record + RECORD_HEADER;
+        if (type == RECORD_SENT) {
+            state[id] = (int)load_u32(body) + 1;
+            since_checkpoint += size;
+        } else if (type == RECORD_DELIVERED) {
+            int sender = (int)load_u32(body);
+            if (sender < 0 || sender >= n) {
+                break;
+            }
+            state[sender] = (int)load_u32(body + 4) + 1;
+            since_checkpoint += size;
+        } else {
+            if ((int)load_u32(body + 8) != n) {
+                break;
+            }
+            memcpy(state.data(), body + 12, n * sizeof(int));
+            checkpoint_at = end;
+            since_checkpoint = 0;
+        }
+        end += size;
+    }
+}
+
+const char* Journal::valid_record(uint64_t at, uint64_t limit) const {
+    if (at + RECORD_HEADER > limit) {
+        return NULL;
+    }
+    const char* p = base + at;
+    uint32_t size = load_u32(p);
+    uint32_t type = load_u32(p + 4);
+    if (size < RECORD_HEADER || size > limit - at || type < RECORD_SENT || type > RECORD_CHECKPOINT) {
+        return NULL;
+    }
+    if (checksum(type, load_u32(p + 8), p + RECORD_HEADER, size - RECORD_HEADER) != load_u32(p + 12)) {
+        return NULL;
+    }
+    return p;
+}
+
+uint64_t Journal::append_sent(const Message& msg) {
+    uint64_t position;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        record.resize(sizeof(int));
+        memcpy(record.data(), &msg.seq_number, sizeof(int));
+        encode_frame(msg, record);
+        state[id] = msg.seq_number + 1;
+        position = append(RECORD_SENT, record.data(), record.size());
+    }
+    appended.notify_one();
+    return position;
+}
+
+uint64_t Journal::append_delivered(int sender, int seq) {
+    int body[2] = {sender, seq};
+    uint64_t position;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        state[sender] = seq + 1;
+        position = append(RECORD_DELIVERED, (const char*)body, sizeof(body));
+    }
+    appended.notify_one();
+    return position;
+}
+
+uint64_t Journal::append(uint32_t type, const char* body, size_t len) {
+    // Called with lock held
+    uint32_t size = RECORD_HEADER + len;
+    reserve(size);
+    uint64_t at = written.load(std::memory_order_relaxed);
+    char* p = base + at;
+    uint32_t check = checksum(type, epoch, body, len);
+    memcpy(p + RECORD_HEADER, body, len);
+    memcpy(p + 4, &type, 4);
+    memcpy(p + 8, &epoch, 4);
+    memcpy(p + 12, &check, 4);
+    memcpy(p, &size, 4);
+    written.store(at + size, std::memory_order_release);
+
+    since_checkpoint += size;
+    if (since_checkpoint >= CHECKPOINT_BYTES) {
+        write_checkpoint();
+    }
+    return at + size;
+}
+
+void Journal::write_checkpoint() {
+    // Called with lock held; record is free to reuse
+    int n = state.size();
+    uint64_t at = written.load(std::memory_order_relaxed);
+    record.resize(12 + n * sizeof(int));
+    memcpy(record.data(), &checkpoint_at, 8);
+    memcpy(record.data() + 8, &n, 4);
+    memcpy(record.data() + 12, state.data(), n * sizeof(int));
+    since_checkpoint = 0;
+    checkpoint_at = at;
+    append(RECORD_CHECKPOINT, record.data(), record.size());
+    since_checkpoint = 0;
+}
+
+void Journal::reserve(size_t len) {
+    // Called with lock held: grow the file and the mapping by an extent
+    uint64_t end = written.load(std::memory_order_relaxed);
+    if (end + len <= mapped) {
+        return;
+    }
+    size_t grown = mapped + std::max(EXTENT_BYTES, len);
+    int err = posix_fallocate(fd, mapped, grown - mapped);
+    if (err != 0) {
+        fail(path, strerror(err));
+    }
+    void* memory = mremap(base, mapped, grown, MREMAP_MAYMOVE);
+    if (memory == MAP_FAILED) {
+        fail(path, strerror(errno));
+    }
+    base = (char*)memory;
+    mapped = grown;
+}
+
+void Journal::sync_loop() {
+    // Group commit: each fdatasync covers everything appended before it
+    // started, however many records that is
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        appended.wait(guard, [this] { return stopping || written.load() > synced.load(); });
+        uint64_t target = written.load(std::memory_order_relaxed);
+        uint64_t checkpoint = checkpoint_at;
+        bool last = stopping;
+        if (last) {
+            // The header's checkpoint only has to be durable by the next sync
+            ((Header*)base)->checkpoint = checkpoint;
+        }
+        guard.unlock();
+
+        int err = fdatasync(fd) < 0 ? errno : 0;
+        sync_calls.fetch_add(1, std::memory_order_relaxed);
+
+        guard.lock();
+        if (err != 0) {
+            sync_error = strerror(err);
+            durable_now.notify_all();
+            uint64_t one = 1;
+            ssize_t ignored = write(notify, &one, sizeof(one));
+            (void)ignored;
+            return;
+        }
+        synced.store(target, std::memory_order_release);
+        if (checkpoint != 0 && checkpoint < target) {
+            ((Header*)base)->checkpoint = checkpoint;
+        }
+        durable_now.notify_all();
+        uint64_t one = 1;
+        ssize_t ignored = write(notify, &one, sizeof(one)); // Full only if nobody is reading
+        (void)ignored;
+        if (last) {
+            return;
+        }
+    }
+}
+
+void Journal::sync() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t target = written.load(std::memory_order_relaxed);
+    appended.notify_one();
+    durable_now.wait(guard, [&] { return synced.load() >= target || !sync_error.empty(); });
+    if (!sync_error.empty()) {
+        fail(path, "sync failed: " + sync_error);
+    }
+}
+
+void Journal::check() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!sync_error.empty()) {
+        fail(path, "sync failed: " + sync_error);
+    }
+}
+
+void Journal::read_sent(int from_seq, std::vector<char>& out) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Walk back along the checkpoints to one taken before from_seq was sent
+    uint64_t at = checkpoint_at;
+    while (at != 0) {
+        const char* body = base + at + RECORD_HEADER;
+        if ((int)load_u32(body + 12 + id * sizeof(int)) <= from_seq) {
+            break;
+        }
+        uint64_t previous;
+        memcpy(&previous, body, 8);
+        at = previous;
+    }
+
+    uint64_t end = written.load(std::memory_order_relaxed);
+    at = std::max<uint64_t>(at, HEADER_BYTES);
+    const char* record;
+    while (at < end && (record = valid_record(at, end)) != NULL) {
+        uint32_t size = load_u32(record);
+        if (load_u32(record + 4) == RECORD_SENT && (int)load_u32(record + RECORD_HEADER) >= from_seq) {
+            const char* frame = record + RECORD_HEADER + sizeof(int);
+            out.insert(out.end(), frame, record + size);
+        }
+        at += size;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "message.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A durable record of what one process has sent and delivered: an
+// append-only file, memory-mapped and grown in large extents, holding
+//
+//   SENT        one of our own messages, as a full-clock frame, so it can be
+//               sent again to a peer that lost it
+//   DELIVERED   (sender, seq) of each message delivered, in delivery order
+//   CHECKPOINT  the clock at that point, and where the previous one is
+//
+// Every record carries its size, a checksum and the number of the open that
+// wrote it, so recovery stops at the first torn, missing or left-over one.
+// A checkpoint is written every few megabytes and the file header points at
+// the latest one known durable, so recovery reads the header, the checkpoint
+// and what follows it, however long the journal.
+//
+// Appends only copy into the mapping. A sync thread makes them durable with
+// fdatasync, one call for everything appended since the last one (group
+// commit), and signals notify_fd() whenever durable() moves. Whoever sends
+// our messages holds each frame until durable() has passed its SENT record,
+// so no peer ever sees a message a recovered journal would not have.
+// Appends may come from several threads.
+//
+//   Journal journal("node0.journal", 0, 4);  // Creates, or recovers, the file
+//   clock = journal.clock();
+//   uint64_t lsn = journal.append_sent(msg);
+//   ... once journal.durable() >= lsn, send the frame
+class Journal {
+private:
+    struct Header;
+
+    std::string path;
+    int fd;
+    int notify;                       // eventfd, written after every sync
+    char* base;
+    size_t mapped;                    // Bytes mapped, always the file size
+    int id;
+    uint32_t epoch;                   // Stamped on every record appended by this open
+    std::vector<int> state;           // Clock as of the last record appended
+    uint64_t checkpoint_at;           // Offset of the last checkpoint appended
+    uint64_t since_checkpoint;        // Bytes appended since then
+    std::vector<char> record;         // Staging for one record
+
+    std::mutex lock;                  // Appends, growth and reads
+    std::condition_variable appended;
+    std::condition_variable durable_now;
+    std::atomic<uint64_t> written;    // End of the last record appended
+    std::atomic<uint64_t> synced;     // Everything before this is durable
+    std::atomic<uint64_t> sync_calls;
+    bool stopping;
+    std::string sync_error;           // Set if fdatasync failed; nothing is durable after
+    std::thread syncer;
+
+    void recover();
+    void replay(uint64_t from, uint64_t& end);
+    const char* valid_record(uint64_t at, uint64_t limit) const;
+    uint64_t append(uint32_t type, const char* body, size_t len);
+    void write_checkpoint();
+    void reserve(size_t len);
+    void sync_loop();
+
+public:
+    // Open path, creating it if missing; otherwise recover the state it
+    // holds. Throws std::runtime_error if it cannot be used, or was written
+    // by another process ID or cluster size.
+    Journal(const std::string& path, int process_id, int num_processes);
+    ~Journal();                       // Syncs whatever is left
+
+    // Our own entry counts messages sent, the others messages delivered
+    // from each peer, as of the last record appended (after recovery: the
+    // last one that survived)
+    const std::vector<int>& clock() const { return state; }
+
+    // Append a record; the returned position is durable once durable()
+    // reaches it. msg's clock must be complete.
+    uint64_t append_sent(const Message& msg);
+    uint64_t append_delivered(int sender, int seq);
+
+    uint64_t end() const { return written.load(std::memory_order_acquire); }
+    uint64_t durable() const { return synced.load(std::memory_order_acquire); }
+    int notify_fd() const { return notify; }
+    uint64_t syncs() const { return sync_calls.load(std::memory_order_relaxed); }
+    void sync();                      // Wait until everything appended is durable
+
+    // Throw std::runtime_error if syncing has failed; call after each
+    // notification, since durable() never moves again after a failure
+    void check();
+
+    // Append to out the frames of our own messages from seq from_seq on, as
+    // they were first sent
+    void read_sent(int from_seq, std::vector<char>& out);
+};
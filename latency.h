@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <time.h>
+
+// Wall clock in nanoseconds. CLOCK_REALTIME is used so timestamps taken on
+// different hosts are comparable (up to their NTP offset).
+inline int64_t wall_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// HDR-style latency histogram with about 1% relative precision. Values are
+// bucketed by power of two, each power split into 128 linear sub-buckets, so
+// recording is a bit scan and an increment with no allocation. Values up to
+// 2^40 ns (about 18 minutes) are tracked; larger ones are clamped. The
+// buckets are allocated on the first recording, so the many per-sender
+// histograms of a large (or simulated) cluster cost nothing until used.
+class LatencyHistogram {
+private:
+    static const int SUB_BUCKET_BITS = 7;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS = 40;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t max_value;
+
+    static int index_of(uint64_t value) {
+        int msb = 63 - __builtin_clzll(value | 1);
+        int shift = msb > SUB_BUCKET_BITS ? msb - SUB_BUCKET_BITS : 0;
+        return shift * SUB_BUCKETS + (int)(value >> shift);
+    }
+
+    // Largest value that lands in the bucket at index
+    static uint64_t highest_in(int index) {
+        int shift = index < 2 * SUB_BUCKETS ? 0 : index / SUB_BUCKETS - 1;
+        uint64_t base = (uint64_t)(index - shift * SUB_BUCKETS) << shift;
+        return base + ((1ULL << shift) - 1);
+    }
+
+public:
+    LatencyHistogram() :
+        total(0),
+        max_value(0) {}
+
+    void record(int64_t value) {
+        uint64_t v = value < 0 ? 0 : (uint64_t)value;
+        if (v >= (1ULL << MAX_VALUE_BITS)) {
+            v = (1ULL << MAX_VALUE_BITS) - 1;
+        }
+        if (counts.empty()) {
+            counts.assign(index_of((1ULL << MAX_VALUE_BITS) - 1) + 1, 0);
+        }
+        counts[index_of(v)]++;
+        total++;
+        if (v > max_value) {
+            max_value = v;
+        }
+    }
+
+    // Value at or below which p percent of recordings fall
+    uint64_t percentile(double p) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(p / 100.0 * total + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= target) {
+                uint64_t value = highest_in(i);
+                return value < max_value ? value : max_value;
+            }
+        }
+        return max_value;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        if (counts.empty()) {
+            counts.assign(other.counts.size(), 0);
+        }
+        for (size_t i = 0; i < other.counts.size(); i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        if (other.max_value > max_value) {
+            max_value = other.max_value;
+        }
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return max_value; }
+};
@@ -5,15 +5,23 @@
 # Parse arguments
 DELAY=""
 DEBUG=""
+CONFIG="cluster.conf"
 
-for arg in "$@"; do
-    if [ "$arg" = "delay" ]; then
+while [ $# -gt 0 ]; do
+    if [ "$1" = "delay" ]; then
         DELAY="delay"
-    elif [ "$arg" = "debug" ]; then
+    elif [ "$1" = "debug" ]; then
         DEBUG="debug"
+    elif [ "$1" = "--config" ]; then
+        CONFIG="$2"
+        shift
     fi
+    shift
 done
 
+# Number of nodes = non-comment, non-blank lines in the config
+N=$(grep -cEv '^[[:space:]]*(#|$)' "$CONFIG")
+
 # Compile the program
 echo "Compiling..."
 make
@@ -25,11 +33,11 @@ mkdir -p logs
 echo "Killing any existing processes..."
 pkill -f causal_broadcast
 
-# Start all four processes locally
-echo "Starting processes..."
+# Start all processes locally
+echo "Starting $N processes..."
 PIDS=()
-for i in {0..3}; do
-    ./causal_broadcast $i $DELAY $DEBUG > logs/log$i.txt 2>&1 &
+for ((i = 0; i < N; i++)); do
+    ./causal_broadcast $i $DELAY $DEBUG --config "$CONFIG" > logs/log$i.txt 2>&1 &
     PIDS+=($!)
     echo "Started process $i (PID: $!)"
 done
@@ -64,4 +72,7 @@ while true; do
     sleep 1
 done
 
-echo "Execution complete. Check logs/log*.txt for details."
\ No newline at end of file
+echo "Execution complete. Check logs/log*.txt for details."
+
+# Check delivery order across all nodes
+./tools/verify logs/log*.txt
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include "logger.h"
+#include "trace.h"
+#include <chrono>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+const size_t RING_CAPACITY = 1 << 20;
+const size_t RECORD_HEADER = 5;       // u32 length + u8 sink
+
+LogRing::LogRing(size_t capacity) : buf(capacity), mask(capacity - 1), head(0), tail(0), done(false) {}
+
+void LogRing::push(uint8_t sink, const char* data, size_t len) {
+    size_t need = RECORD_HEADER + len;
+    if (need > buf.size() / 2) {
+        // Oversized lines are truncated rather than deadlocking the ring
+        len = buf.size() / 2 - RECORD_HEADER;
+        need = RECORD_HEADER + len;
+    }
+
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t offset = h & mask;
+    size_t padding = buf.size() - offset < need ? buf.size() - offset : 0;
+
+    // Wait for the writer thread to make room
+    while (h + padding + need - tail.load(std::memory_order_acquire) > buf.size()) {
+        std::this_thread::yield();
+    }
+
+    if (padding > 0) {
+        // A zero length record tells the consumer to skip to the start
+        if (padding >= 4) {
+            uint32_t zero = 0;
+            memcpy(&buf[offset], &zero, 4);
+        }
+        h += padding;
+        offset = 0;
+    }
+
+    uint32_t len32 = len;
+    memcpy(&buf[offset], &len32, 4);
+    buf[offset + 4] = sink;
+    memcpy(&buf[offset + RECORD_HEADER], data, len);
+    head.store(h + need, std::memory_order_release);
+}
+
+size_t LogRing::drain(std::string out[2]) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t start = t;
+
+    while (t < h) {
+        size_t offset = t & mask;
+        size_t left = buf.size() - offset;
+        uint32_t len = 0;
+        if (left >= 4) {
+            memcpy(&len, &buf[offset], 4);
+        }
+        if (left < RECORD_HEADER || len == 0) {
+            t += left;                // Padding up to the end of the ring
+            continue;
+        }
+        uint8_t sink = buf[offset + 4];
+        out[sink].append(&buf[offset + RECORD_HEADER], len);
+        t += RECORD_HEADER + len;
+    }
+
+    tail.store(t, std::memory_order_release);
+    return t - start;
+}
+
+Logger::Logger() : level(LOG_EVENT), sample_every(1), trace_fd(-1), running(false) {}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+void Logger::configure(LogLevel log_level, int sample, const std::string& trace_path,
+                       int node_id, int num_processes) {
+    level.store(log_level);
+    sample_every = sample > 0 ? sample : 1;
+
+    if (!trace_path.empty()) {
+        trace_fd = open(trace_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (trace_fd < 0) {
+            throw std::runtime_error("Cannot open trace file " + trace_path + ": " + strerror(errno));
+        }
+        TraceFileHeader header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.node_id = node_id;
+        header.num_processes = num_processes;
+        write_all(trace_fd, std::string((const char*)&header, sizeof(header)));
+    }
+}
+
+void Logger::start() {
+    if (!running.exchange(true)) {
+        writer = std::thread(&Logger::writer_loop, this);
+    }
+}
+
+void Logger::stop() {
+    if (running.exchange(false)) {
+        writer.join();
+    }
+    // Anything logged after the writer exited (or without one) goes out now
+    std::string out[2];
+    while (drain_all(out)) {
+        write_all(STDOUT_FILENO, out[SINK_TEXT]);
+        write_all(trace_fd, out[SINK_TRACE]);
+        out[SINK_TEXT].clear();
+        out[SINK_TRACE].clear();
+    }
+    if (trace_fd >= 0) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+}
+
+// Retires the thread's ring when the thread exits. The thread may go before
+// the writer has drained what it logged, so the writer frees the ring after
+// its last drain.
+struct RingHolder {
+    LogRing* ring;
+
+    RingHolder() : ring(NULL) {}
+    ~RingHolder() {
+        if (ring) {
+            ring->retire();
+            ring = NULL;
+        }
+    }
+};
+
+LogRing* Logger::ring() {
+    static thread_local RingHolder mine;
+    if (!mine.ring) {
+        mine.ring = new LogRing(RING_CAPACITY);
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(mine.ring);
+    }
+    return mine.ring;
+}
+
+bool Logger::sample() {
+    static thread_local int counter = 0;
+    if (++counter >= sample_every) {
+        counter = 0;
+        return true;
+    }
+    return false;
+}
+
+void Logger::text(const char* data, size_t len) {
+    ring()->push(SINK_TEXT, data, len);
+    if (!running.load(std::memory_order_relaxed)) {
+        // No writer thread (yet): write through so nothing is lost
+        std::string out[2];
+        drain_all(out);
+        write_all(STDOUT_FILENO, out[SINK_TEXT]);
+        write_all(trace_fd, out[SINK_TRACE]);
+    }
+}
+
+void Logger::trace(const char* data, size_t len) {
+    if (trace_fd >= 0) {
+        ring()->push(SINK_TRACE, data, len);
+    }
+}
+
+bool Logger::drain_all(std::string out[2]) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    size_t taken = 0;
+    for (size_t i = 0; i < rings.size();) {
+        LogRing* r = rings[i];
+        // Seen retired before the drain, the ring is empty after it
+        bool retired = r->retired();
+        taken += r->drain(out);
+        if (retired) {
+            delete r;
+            rings[i] = rings.back();
+            rings.pop_back();
+        } else {
+            i++;
+        }
+    }
+    return taken > 0;
+}
+
+void Logger::write_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (fd >= 0 && done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        done += n;
+    }
+}
+
+void Logger::writer_loop() {
+    std::string out[2];
+    while (running.load()) {
+        if (drain_all(out)) {
+            // One write() per sink per batch
+            write_all(STDOUT_FILENO, out[SINK_TEXT]);
+            write_all(trace_fd, out[SINK_TRACE]);
+            out[SINK_TEXT].clear();
+            out[SINK_TRACE].clear();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+static std::string& line_buffer() {
+    static thread_local std::string line;
+    return line;
+}
+
+LogLine::LogLine() : line(line_buffer()) {
+    line.clear();
+}
+
+LogLine::~LogLine() {
+    line.push_back('\n');
+    Logger::instance().text(line.data(), line.size());
+}
+
+LogLine& LogLine::operator<<(long long v) {
+    if (v < 0) {
+        line.push_back('-');
+        return *this << (unsigned long long)(-(v + 1)) + 1;
+    }
+    return *this << (unsigned long long)v;
+}
+
+LogLine& LogLine::operator<<(unsigned long long v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) {
+        line.push_back(digits[--n]);
+    }
+    return *this;
+}
+
+LogLine& LogLine::operator<<(double v) {
+    char text[32];
+    int n = snprintf(text, sizeof(text), "%g", v);
+    line.append(text, n);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const ClockText& c) {
+    line.push_back('[');
+    for (size_t i = 0; i < c.n; i++) {
+        if (i > 0) {
+            line.push_back(',');
+        }
+        *this << c.vc[i];
+    }
+    line.push_back(']');
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const ChannelText& c) {
+    if (c.channel != 0) {
+        line.append(" on channel ");
+        *this << c.channel;
+    }
+    return *this;
+}
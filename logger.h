@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Log levels, most to least important. Per-message send/delivery lines are
+// LOG_EVENT so they can be switched off while keeping status output.
+enum LogLevel {
+    LOG_ERROR = 0,
+    LOG_INFO = 1,
+    LOG_EVENT = 2,
+    LOG_DEBUG = 3
+};
+
+// Levels above this are compiled out entirely (make LOG_LEVEL=<n>)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 3
+#endif
+
+// Lock-free single-producer/single-consumer byte ring. Each producing thread
+// owns one until it exits; the logger's writer thread is the only consumer.
+// Records are [u32 length][u8 sink][bytes] and never wrap: a record that
+// does not fit before the end is preceded by a zero-length padding record.
+class LogRing {
+private:
+    std::vector<char> buf;
+    size_t mask;
+    std::atomic<size_t> head;         // Next byte the producer writes
+    std::atomic<size_t> tail;         // Next byte the consumer reads
+    std::atomic<bool> done;           // Producer has exited
+    char pad1[64];
+
+public:
+    explicit LogRing(size_t capacity);
+
+    // Producer: copy one record in, spinning while the ring is full
+    void push(uint8_t sink, const char* data, size_t len);
+
+    // Consumer: append every complete record to out[sink]; returns bytes taken
+    size_t drain(std::string out[2]);
+
+    // Producer: nothing more will be pushed, so the ring can go once drained
+    void retire() { done.store(true, std::memory_order_release); }
+    bool retired() const { return done.load(std::memory_order_acquire); }
+};
+
+// Asynchronous logger. Producers format into a thread-local line buffer and
+// copy it into their ring; a background thread batches everything into a
+// handful of write() calls. Text goes to stdout, binary trace records to the
+// file given with --trace.
+class Logger {
+private:
+    enum { SINK_TEXT = 0, SINK_TRACE = 1 };
+
+    std::atomic<int> level;
+    int sample_every;                 // Log one in N LOG_EVENT lines
+    int trace_fd;
+    std::vector<LogRing*> rings;      // One per producing thread still running or undrained
+    std::mutex rings_mutex;           // Guards registration and removal only
+    std::atomic<bool> running;
+    std::thread writer;
+
+    Logger();
+    LogRing* ring();
+    void writer_loop();
+    bool drain_all(std::string out[2]);
+    static void write_all(int fd, const std::string& data);
+
+public:
+    static Logger& instance();
+
+    // Configure before start(); trace_path may be empty
+    void configure(LogLevel log_level, int sample, const std::string& trace_path,
+                   int node_id, int num_processes);
+    void start();
+    void stop();                      // Drain everything and join the writer
+
+    bool enabled(LogLevel l) const { return l <= level.load(std::memory_order_relaxed); }
+    bool tracing() const { return trace_fd >= 0; }
+
+    // True for one in every sample_every calls on this thread
+    bool sample();
+
+    void text(const char* data, size_t len);
+    void trace(const char* data, size_t len);
+};
+
+// One text line, committed to the logger when it goes out of scope. The
+// formatting buffer is thread-local, so steady-state logging does not allocate.
+class LogLine {
+private:
+    std::string& line;
+
+public:
+    LogLine();
+    ~LogLine();
+
+    LogLine& operator<<(const char* s) { line.append(s); return *this; }
+    LogLine& operator<<(const std::string& s) { line.append(s); return *this; }
+    LogLine& operator<<(char c) { line.push_back(c); return *this; }
+    LogLine& operator<<(int v) { return *this << (long long)v; }
+    LogLine& operator<<(unsigned v) { return *this << (unsigned long long)v; }
+    LogLine& operator<<(long v) { return *this << (long long)v; }
+    LogLine& operator<<(unsigned long v) { return *this << (unsigned long long)v; }
+    LogLine& operator<<(long long v);
+    LogLine& operator<<(unsigned long long v);
+    LogLine& operator<<(double v);
+
+    // Vector clock as "[a,b,c]"
+    LogLine& operator<<(const struct ClockText& c);
+
+    // " on channel c", or nothing for channel 0
+    LogLine& operator<<(const struct ChannelText& c);
+};
+
+struct ClockText {
+    const int* vc;
+    size_t n;
+};
+
+inline ClockText clock_text(const std::vector<int>& vc) {
+    ClockText c = {vc.data(), vc.size()};
+    return c;
+}
+
+// Follows a message's number, so logs of a single channel read as before
+struct ChannelText {
+    int channel;
+};
+
+inline ChannelText channel_text(int channel) {
+    ChannelText c = {channel};
+    return c;
+}
+
+#define LOG(lvl) \
+    if ((lvl) > LOG_COMPILE_LEVEL || !Logger::instance().enabled(lvl)) ; else LogLine()
+
+// LOG_EVENT line subject to --log-sample
+#define LOG_SAMPLED(lvl) \
+    if ((lvl) > LOG_COMPILE_LEVEL || !Logger::instance().enabled(lvl) || !Logger::instance().sample()) ; else LogLine()
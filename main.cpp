@@ -1,43 +1,239 @@
 #include "process.h"
+#include "config.h"
+#include "workload.h"
+#include "logger.h"
 #include <iostream>
 #include <string>
 #include <stdexcept>
 
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <process_id> [delay] [debug] [--config <file>]"
+              << " [--stats-interval <seconds>] [--connect-timeout <seconds>] [logging options]"
+              << " [workload options]" << std::endl;
+    std::cerr << "  --connect-timeout <s> give up unless every process is connected and ready\n"
+              << "                        within s seconds (default 30)\n";
+    std::cerr << "Logging options:\n"
+              << "  --log-level <level>   error | info | event (default) | debug\n"
+              << "  --log-sample <n>      log one in n send/delivery lines\n"
+              << "  --trace <file>        write a binary send/delivery trace for the verifier\n";
+    std::cerr << "Batching options:\n"
+              << "  --batch-size <bytes>  batch outgoing messages, flushing at this size (default off)\n"
+              << "  --batch-delay <us>    flush a partial batch this long after its first message (default 200)\n";
+    std::cerr << "Ordering options:\n"
+              << "  --ordering <mode>     causal (default) | fifo: per sender only | total: the same\n"
+              << "                        order at every process\n"
+              << "  --channels <n>        n independent broadcast groups over the same connections,\n"
+              << "                        each ordered on its own; messages take them in turn (default 1)\n";
+    std::cerr << "Wire options:\n"
+              << "  --clock-encoding <e>  delta (default: changed entries only) | full\n"
+              << "  --shared-memory <s>   on (default: same-host peers use shared memory rings) | off\n"
+              << "  --relay-tree <k>      link only along a spanning tree of fanout k and relay every\n"
+              << "                        message through it (default 0: every peer directly); turns\n"
+              << "                        off flow control and reconnection\n";
+    std::cerr << "Threading options:\n"
+              << "  --io-threads <n>      decode on n receive threads, with separate send and delivery\n"
+              << "                        threads (default 0: everything on one thread)\n";
+    std::cerr << "Metrics options:\n"
+              << "  --metrics-file <path> keep a Prometheus text file of live metrics here\n"
+              << "  --metrics-interval <s> rewrite it every s seconds (default 1)\n";
+    std::cerr << "Durability options:\n"
+              << "  --journal <path>      record sends and deliveries here, and on restart carry on\n"
+              << "                        from what it holds\n"
+              << "  --retransmit-window <bytes> without a journal, keep this much of our latest\n"
+              << "                        messages to resend after a lost connection is made again\n"
+              << "                        (default twice the credit window, 0 = fail on a lost\n"
+              << "                        connection instead)\n";
+    std::cerr << "Flow control options:\n"
+              << "  --buffer-limit <bytes> causal buffer ceiling, split into per-sender credit\n"
+              << "                        windows (default 64 MB, 0 = unlimited)\n";
+    std::cerr << WorkloadConfig::usage();
+}
+
 int main(int argc, char* argv[]) {
     try {
         // Validate command line arguments
-        if (argc < 2 || argc > 4) {
-            std::cerr << "Usage: " << argv[0] << " <process_id> [delay] [debug]" << std::endl;
+        if (argc < 2) {
+            usage(argv[0]);
             return 1;
         }
         
+        bool use_delay = false;
+        bool debug_mode = false;
+        std::string config_path;
+        double stats_interval = 10;
+        double connect_timeout = 30;
+        int log_level = -1;
+        int log_sample = 1;
+        std::string trace_path;
+        long long batch_size = 0;
+        long long batch_delay = 200;
+        bool delta_clocks = true;
+        OrderingMode ordering = ORDER_CAUSAL;
+        int channels = 1;
+        bool shared_memory = true;
+        int relay_fanout = 0;
+        int io_threads = 0;
+        long long buffer_limit = -1;
+        std::string metrics_path;
+        std::string journal_path;
+        long long retransmit_window = -1;
+        double metrics_interval = 1;
+        WorkloadConfig workload;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            int consumed = workload.parse_option(argc, argv, i);
+            if (consumed > 0) {
+                i += consumed - 1;
+            } else if (arg == "delay") {
+                use_delay = true;
+            } else if (arg == "debug") {
+                debug_mode = true;
+            } else if (arg == "--config" && i + 1 < argc) {
+                config_path = argv[++i];
+            } else if (arg == "--stats-interval" && i + 1 < argc) {
+                stats_interval = std::stod(argv[++i]);
+            } else if (arg == "--connect-timeout" && i + 1 < argc) {
+                connect_timeout = std::stod(argv[++i]);
+                if (connect_timeout <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--log-level" && i + 1 < argc) {
+                std::string name = argv[++i];
+                const char* names[] = {"error", "info", "event", "debug"};
+                for (int l = LOG_ERROR; l <= LOG_DEBUG; l++) {
+                    if (name == names[l]) {
+                        log_level = l;
+                    }
+                }
+                if (log_level < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--log-sample" && i + 1 < argc) {
+                log_sample = std::stoi(argv[++i]);
+            } else if (arg == "--trace" && i + 1 < argc) {
+                trace_path = argv[++i];
+            } else if (arg == "--batch-size" && i + 1 < argc) {
+                batch_size = std::stoll(argv[++i]);
+            } else if (arg == "--batch-delay" && i + 1 < argc) {
+                batch_delay = std::stoll(argv[++i]);
+            } else if (arg == "--clock-encoding" && i + 1 < argc) {
+                std::string encoding = argv[++i];
+                if (encoding != "delta" && encoding != "full") {
+                    usage(argv[0]);
+                    return 1;
+                }
+                delta_clocks = encoding == "delta";
+            } else if (arg == "--ordering" && i + 1 < argc) {
+                if (!parse_ordering(argv[++i], ordering)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--channels" && i + 1 < argc) {
+                channels = std::stoi(argv[++i]);
+                if (channels < 1 || channels > MAX_CHANNELS) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--shared-memory" && i + 1 < argc) {
+                std::string mode = argv[++i];
+                if (mode != "on" && mode != "off") {
+                    usage(argv[0]);
+                    return 1;
+                }
+                shared_memory = mode == "on";
+            } else if (arg == "--relay-tree" && i + 1 < argc) {
+                relay_fanout = std::stoi(argv[++i]);
+                if (relay_fanout < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--io-threads" && i + 1 < argc) {
+                io_threads = std::stoi(argv[++i]);
+                if (io_threads < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--metrics-file" && i + 1 < argc) {
+                metrics_path = argv[++i];
+            } else if (arg == "--metrics-interval" && i + 1 < argc) {
+                metrics_interval = std::stod(argv[++i]);
+                if (metrics_interval <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--journal" && i + 1 < argc) {
+                journal_path = argv[++i];
+            } else if (arg == "--retransmit-window" && i + 1 < argc) {
+                retransmit_window = std::stoll(argv[++i]);
+                if (retransmit_window < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--buffer-limit" && i + 1 < argc) {
+                buffer_limit = std::stoll(argv[++i]);
+                if (buffer_limit < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        
+        workload.validate();
+        // Credit cannot find its way back through a relay, nor can a relayed
+        // message be resent over a lost link
+        if (relay_fanout > 0 && (buffer_limit > 0 || retransmit_window > 0)) {
+            throw std::invalid_argument("--relay-tree cannot be combined with --buffer-limit or --retransmit-window");
+        }
+        
+        // Without a config file, fall back to four processes on localhost
+        ClusterConfig cluster = config_path.empty() ? ClusterConfig::local(4)
+                                                    : ClusterConfig::load(config_path);
+        
         // Parse process ID
         int process_id = std::stoi(argv[1]);
-        if (process_id < 0 || process_id > 3) {
-            std::cerr << "Error: Process ID must be between 0 and 3" << std::endl;
+        if (process_id < 0 || process_id >= cluster.size()) {
+            std::cerr << "Error: Process ID must be between 0 and " << cluster.size() - 1 << std::endl;
             return 1;
         }
         
-        // Check for delay flag
-        bool use_delay = false;
-        if (argc >= 3 && std::string(argv[2]) == "delay") {
-            use_delay = true;
-        }
-        
-        // Check for debug flag
-        bool debug_mode = false;
-        if ((argc >= 3 && std::string(argv[2]) == "debug") || 
-            (argc >= 4 && std::string(argv[3]) == "debug")) {
-            debug_mode = true;
+        // Debug mode implies debug logging unless a level was given
+        if (log_level < 0) {
+            log_level = debug_mode ? LOG_DEBUG : LOG_EVENT;
         }
+        Logger::instance().configure((LogLevel)log_level, log_sample, trace_path, process_id, cluster.size());
+        Logger::instance().start();
         
         // Create and run the process
-        Process process(process_id, use_delay, debug_mode);
+        Process process(process_id, cluster, workload, use_delay, debug_mode);
+        process.set_stats_interval(stats_interval);
+        process.set_connect_timeout(connect_timeout);
+        process.set_delta_clocks(delta_clocks);
+        process.set_channels(channels);
+        process.set_ordering(ordering);
+        process.set_shared_memory(shared_memory);
+        process.set_relay_tree(relay_fanout);
+        process.set_io_threads(io_threads);
+        if (buffer_limit >= 0) {
+            process.set_buffer_limit(buffer_limit);
+        }
+        process.set_metrics_file(metrics_path, metrics_interval);
+        process.set_journal(journal_path);
+        process.set_retransmit_window(retransmit_window);
+        if (batch_size > 0) {
+            process.set_batching(batch_size, batch_delay);
+        }
         process.run();
         
-        return 0;
+        Logger::instance().stop();
+        return process.run_failed() ? 1 : 0;
     } catch (const std::exception& e) {
+        Logger::instance().stop();
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Message structure with vector clock for causal ordering
+struct Message {
+    int sender_id;
+    int seq_number;                   // Counts all of the sender's messages: what links,
+                                      // flow control and resending go by
+    int channel;                      // Broadcast group (see Process::set_channels)
+    int channel_seq;                  // Counts the sender's messages in the channel: what
+                                      // delivery goes by; seq_number with one channel
+    std::vector<int> vector_clock;
+    std::string data;
+    int64_t send_time_ns;             // Sender's wall clock at broadcast (on the wire)
+    int64_t recv_time_ns;             // Local wall clock on arrival (local only)
+};
+
+// A delivered message as handed to an application. The pointers refer to the
+// library's own storage and are only valid during the delivery callback.
+struct Delivery {
+    int sender_id;
+    int seq_number;                   // Sender's sequence number within the channel
+    int channel;
+    const int* vector_clock;          // Sender's clock, clock_size entries: its vector clock in
+                                      // causal order, its Lamport timestamp in total order,
+                                      // nothing in FIFO order
+    size_t clock_size;
+    const char* data;
+    size_t size;
+};
+
+// Outcome of handing a payload to broadcast
+enum BroadcastResult {
+    BROADCAST_QUEUED = 0,             // Will be sent
+    BROADCAST_BUSY = 1,               // Outbound queues are full; retry once backpressure clears
+    BROADCAST_STOPPED = 2             // Stopping or stopped; nothing more is sent
+};
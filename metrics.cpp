@@ -0,0 +1,53 @@
+#include "metrics.h"
+#include <cstdio>
+
+void MetricsText::value(double v) {
+    // Counters print as exact integers below 10^15
+    char digits[32];
+    snprintf(digits, sizeof(digits), " %.15g\n", v);
+    text += digits;
+}
+
+void MetricsText::family(const char* name, const char* type, const char* help) {
+    text += "# HELP ";
+    text += name;
+    text += ' ';
+    text += help;
+    text += "\n# TYPE ";
+    text += name;
+    text += ' ';
+    text += type;
+    text += '\n';
+}
+
+void MetricsText::sample(const char* name, double v) {
+    text += name;
+    value(v);
+}
+
+void MetricsText::sample(const char* name, const char* label, int label_value, double v) {
+    char number[16];
+    snprintf(number, sizeof(number), "%d", label_value);
+    sample(name, label, number, v);
+}
+
+void MetricsText::sample(const char* name, const char* label, const char* label_value, double v) {
+    text += name;
+    text += '{';
+    text += label;
+    text += "=\"";
+    text += label_value;
+    text += "\"}";
+    value(v);
+}
+
+bool MetricsText::write_file(const std::string& path) const {
+    std::string temp = path + ".tmp";
+    FILE* f = fopen(temp.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    ok = fclose(f) == 0 && ok;
+    return ok && rename(temp.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Counters bumped on the I/O paths, from whichever thread makes the call.
+// They are only ever incremented with relaxed atomics, once per system call
+// rather than per message, and read by the metrics writer, which needs no
+// ordering against anything else.
+struct IoCounters {
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<uint64_t> send_calls{0};
+    std::atomic<uint64_t> recv_calls{0};
+    std::atomic<uint64_t> epoll_waits{0};
+};
+
+inline void count(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+// A Prometheus text exposition, built up one metric family at a time and
+// written out whole. The text is kept between writes so a periodic writer
+// does not reallocate it.
+//
+//   metrics.family("causal_messages_sent_total", "counter", "Messages broadcast");
+//   metrics.sample("causal_messages_sent_total", sent);
+//   metrics.write_file("/var/lib/node_exporter/causal.prom");
+class MetricsText {
+private:
+    std::string text;
+
+    void value(double v);
+
+public:
+    void clear() { text.clear(); }
+    void family(const char* name, const char* type, const char* help);
+    void sample(const char* name, double v);
+    void sample(const char* name, const char* label, int label_value, double v);
+    void sample(const char* name, const char* label, const char* label_value, double v);
+    const std::string& str() const { return text; }
+
+    // Replace path with the text: write a temporary file beside it and
+    // rename it over, so a reader never sees a partial exposition. Returns
+    // false (with errno set) on failure.
+    bool write_file(const std::string& path) const;
+};
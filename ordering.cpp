@@ -0,0 +1,197 @@
+#include "ordering.h"
+#include "vector_clock.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <utility>
+
+bool parse_ordering(const std::string& name, OrderingMode& mode) {
+    if (name == "fifo") {
+        mode = ORDER_FIFO;
+    } else if (name == "causal") {
+        mode = ORDER_CAUSAL;
+    } else if (name == "total") {
+        mode = ORDER_TOTAL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ordering_name(OrderingMode mode) {
+    return mode == ORDER_FIFO ? "fifo" : mode == ORDER_CAUSAL ? "causal" : "total";
+}
+
+// Next from each sender; messages carry no clock at all
+class FifoOrder : public Ordering {
+private:
+    std::vector<int>& counts;
+
+public:
+    explicit FifoOrder(std::vector<int>& delivered) : counts(delivered) {}
+
+    OrderingMode mode() const override { return ORDER_FIFO; }
+    size_t clock_size() const override { return 0; }
+    void stamp(Message& msg) override { msg.vector_clock.clear(); }
+    bool ready(const Message& msg) override { return msg.channel_seq == counts[msg.sender_id]; }
+    void delivered(const Message& msg) override { counts[msg.sender_id] = msg.channel_seq + 1; }
+};
+
+// Vector clocks: a message carries the delivered counts of its sender,
+// which are already what the caller stamps it with
+class CausalOrder : public Ordering {
+private:
+    int self;
+    std::vector<int>& counts;
+
+public:
+    CausalOrder(int self_id, std::vector<int>& delivered) : self(self_id), counts(delivered) {}
+
+    OrderingMode mode() const override { return ORDER_CAUSAL; }
+    size_t clock_size() const override { return counts.size(); }
+    void stamp(Message&) override {}
+    bool ready(const Message& msg) override { return clock_ready(msg.vector_clock, counts, msg.sender_id, self); }
+    void delivered(const Message& msg) override { clock_merge(counts, msg.vector_clock); }
+};
+
+// Lamport timestamps. Every message is stamped above anything its sender
+// had stamped or received, and every process delivers in (timestamp,
+// sender) order: a message goes once each other peer's next message is
+// here and sorts after it, or that peer can only send later ones (its
+// delivered messages and announcements bound what it sends next), or it
+// has finished. Our own messages are never delivered, so we never wait on
+// ourselves.
+class TotalOrder : public Ordering {
+private:
+    int self;
+    int n;
+    std::vector<int>& counts;
+    DeliveryBuffer& buffer;
+    std::atomic<int> lamport;         // Highest timestamp stamped or received
+    int last_sent;                    // Sending thread: highest stamped or announced
+    std::atomic<bool> again;          // Announce even if the clock has not moved
+    std::vector<int> floor;           // Per sender: its undelivered messages all sort above this
+    std::vector<std::deque<std::pair<int, int> > > pending; // Per sender: (sent, timestamp)
+                                                            // announcements not yet reached
+    std::vector<char> finished;       // Per sender: everything it sends has arrived
+
+    static bool before(int ts_a, int a, int ts_b, int b) {
+        return ts_a < ts_b || (ts_a == ts_b && a < b);
+    }
+
+    void raise(int timestamp) {
+        int now = lamport.load(std::memory_order_relaxed);
+        while (now < timestamp && !lamport.compare_exchange_weak(now, timestamp)) {}
+    }
+
+    // Announcements count from the sender's messages we have delivered
+    void catch_up(int sender) {
+        std::deque<std::pair<int, int> >& queue = pending[sender];
+        while (!queue.empty() && queue.front().first <= counts[sender]) {
+            floor[sender] = std::max(floor[sender], queue.front().second);
+            queue.pop_front();
+        }
+    }
+
+public:
+    TotalOrder(int self_id, std::vector<int>& delivered, DeliveryBuffer& delivery_buffer) :
+        self(self_id),
+        n(delivered.size()),
+        counts(delivered),
+        buffer(delivery_buffer),
+        lamport(0),
+        last_sent(0),
+        again(false),
+        floor(delivered.size(), 0),
+        pending(delivered.size()),
+        finished(delivered.size(), 0) {}
+
+    OrderingMode mode() const override { return ORDER_TOTAL; }
+    size_t clock_size() const override { return 1; }
+
+    void stamp(Message& msg) override {
+        last_sent = lamport.fetch_add(1) + 1;
+        msg.vector_clock.assign(1, last_sent);
+    }
+
+    void recovered(const Message& last) override {
+        if (!last.vector_clock.empty()) {
+            raise(last.vector_clock[0]);
+            last_sent = last.vector_clock[0];
+        }
+    }
+
+    bool arrived(const Message& msg) override {
+        raise(msg.vector_clock[0]);
+        return true;
+    }
+
+    bool ready(const Message& msg) override {
+        int sender = msg.sender_id;
+        if (msg.channel_seq != counts[sender]) {
+            return false;
+        }
+        int ts = msg.vector_clock[0];
+        for (int k = 0; k < n; k++) {
+            if (k == self || k == sender) {
+                continue;
+            }
+            // k's next message, if it is here, is the earliest k can still
+            // send; otherwise there is none if k has finished, and what it
+            // sends next sorts above floor[k] if not
+            const Message* next = buffer.head(k);
+            if (next && next->channel_seq == counts[k]) {
+                if (before(next->vector_clock[0], k, ts, sender)) {
+                    return false;
+                }
+            } else if (!finished[k] && !before(ts, sender, floor[k] + 1, k)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void delivered(const Message& msg) override {
+        int sender = msg.sender_id;
+        counts[sender] = msg.channel_seq + 1;
+        floor[sender] = std::max(floor[sender], msg.vector_clock[0]);
+        catch_up(sender);
+    }
+
+    bool sender_done(int sender) override {
+        finished[sender] = 1;
+        return true;
+    }
+
+    bool announces() const override { return true; }
+
+    bool announcement(int& timestamp) override {
+        bool forced = again.exchange(false);
+        int now = lamport.load();
+        if (now <= last_sent && !forced) {
+            return false;
+        }
+        timestamp = last_sent = now;
+        return true;
+    }
+
+    void reannounce() override { again.store(true); }
+
+    bool announced(int sender, int sent, int timestamp) override {
+        pending[sender].push_back(std::make_pair(sent, timestamp));
+        catch_up(sender);
+        return true;
+    }
+};
+
+std::unique_ptr<Ordering> make_ordering(OrderingMode mode, int self, std::vector<int>& delivered,
+                                        DeliveryBuffer& buffer) {
+    switch (mode) {
+    case ORDER_FIFO:
+        return std::unique_ptr<Ordering>(new FifoOrder(delivered));
+    case ORDER_TOTAL:
+        return std::unique_ptr<Ordering>(new TotalOrder(self, delivered, buffer));
+    default:
+        return std::unique_ptr<Ordering>(new CausalOrder(self, delivered));
+    }
+}
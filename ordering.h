@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "message.h"
+#include "delivery_buffer.h"
+
+// The order a process delivers its peers' messages in. Every mode runs over
+// the same links, frames and delivery buffer: a mode only decides what a
+// message carries in its clock, and when the head of a sender's queue in
+// the buffer may be delivered.
+enum OrderingMode {
+    ORDER_FIFO,                       // Each sender's messages in the order sent; no clock
+    ORDER_CAUSAL,                     // Also after everything their sender had delivered; a vector clock
+    ORDER_TOTAL                       // One order at every process, also causal; a Lamport timestamp
+};
+
+// "fifo", "causal" or "total"; false if the name is unknown
+bool parse_ordering(const std::string& name, OrderingMode& mode);
+const char* ordering_name(OrderingMode mode);
+
+// One channel's delivery rule at one process. In every mode Process keeps,
+// per channel, the count of messages delivered from each sender, its own
+// entry counting messages sent; the rule reads those counts and the
+// buffer's heads, and moves the counts on in delivered(). Messages are
+// numbered by channel_seq here. stamp() and announcement() run on the
+// sending thread, everything else on the delivery thread.
+//
+// Total order needs to hear from every peer before it can deliver anything:
+// a message is delivered once no peer can still send one that sorts before
+// it. A peer with nothing to send announces how far its clock has moved
+// instead (FRAME_TIMESTAMP), so an idle or stalled sender does not hold
+// everyone else's delivery.
+class Ordering {
+public:
+    virtual ~Ordering() {}
+    virtual OrderingMode mode() const = 0;
+
+    // Entries in the clock of every message
+    virtual size_t clock_size() const = 0;
+
+    // Turn the clock of our next message, filled in with the delivered
+    // counts (our own entry counting this message), into the one sent
+    virtual void stamp(Message& msg) = 0;
+
+    // Carry on from our last message sent before a restart
+    virtual void recovered(const Message& last_sent) {}
+
+    // A peer's message has arrived, before it is delivered or buffered.
+    // True if it may let buffered messages from other senders go.
+    virtual bool arrived(const Message& msg) { return false; }
+
+    // True if msg, the lowest buffered (or just arrived) message from its
+    // sender, can be delivered now
+    virtual bool ready(const Message& msg) = 0;
+
+    // Count msg as delivered
+    virtual void delivered(const Message& msg) = 0;
+
+    // Every message sender will ever send has arrived: it is delivered or
+    // buffered. True if that may let buffered messages go.
+    virtual bool sender_done(int sender) { return false; }
+
+    // Whether peers need announcements of our clock (see announcement())
+    virtual bool announces() const { return false; }
+
+    // Sending thread: true if our clock has moved past everything we have
+    // sent or announced, with the timestamp to announce now
+    virtual bool announcement(int& timestamp) { return false; }
+
+    // Announce again at the next chance, for a peer that may have lost the
+    // last announcement with its connection
+    virtual void reannounce() {}
+
+    // A peer's announcement: its messages after the first sent all carry
+    // timestamps above timestamp. True if that may let buffered messages go.
+    virtual bool announced(int sender, int sent, int timestamp) { return false; }
+};
+
+// The rule for mode at process self, over a channel's delivered counts and buffer
+std::unique_ptr<Ordering> make_ordering(OrderingMode mode, int self, std::vector<int>& delivered,
+                                        DeliveryBuffer& buffer);
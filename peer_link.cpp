@@ -0,0 +1,633 @@
+#include "peer_link.h"
+#include "logger.h"
+#include "wire.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+const int MAX_EVENTS = 64;
+// Connect retries back off from the first delay to the last, doubling
+const long long CONNECT_RETRY_FIRST_MS = 10;
+const long long CONNECT_RETRY_MAX_MS = 1000;
+// Sent once on every connection when the sender's own connections are all
+// up, followed by how many of the receiver's messages it has delivered
+const char READY_BYTE = 'R';
+const size_t NOTICE_SIZE = 1 + 4;        // Ready byte, u32 messages received
+const size_t ID_SIZE = 4;                // u32 process ID a connecting process sends first
+
+void watch_socket(int epfd, int sock, uint32_t events, uint64_t tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = tag;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        throw std::runtime_error("epoll_ctl failed: " + std::string(strerror(errno)));
+    }
+}
+
+PeerLinks::PeerLinks(int self_id, const ClusterConfig& cluster_config, const std::vector<char>& linked_peers,
+                     std::vector<int>& peer_sockets, std::vector<std::unique_ptr<ShmLink> >& peer_shm_links,
+                     IoCounters& counters) :
+    self(self_id),
+    num_processes(cluster_config.size()),
+    cluster(cluster_config),
+    linked(linked_peers),
+    connections(peer_sockets),
+    shm_links(peer_shm_links),
+    io(counters),
+    timeout_s(30),
+    shared_memory(true),
+    epoll_fd(-1),
+    server_socket(-1),
+    reconnect_timer(-1),
+    connecting(num_processes, -1),
+    resuming(num_processes, -1),
+    down(num_processes, 0),
+    lost_at(num_processes),
+    retry_at(num_processes),
+    attempts(num_processes, 0) {}
+
+void PeerLinks::connect(int epfd, Clock::time_point deadline, bool keep_listening) {
+    // Set up server socket to accept connections, with shared memory ready
+    // for same-host peers before any of them can connect
+    epoll_fd = epfd;
+    create_shm_links();
+    listen_for_peers();
+    watch_socket(epoll_fd, server_socket, EPOLLIN, LISTEN_TAG);
+
+    // Start non-blocking connects to every process with a lower ID at once;
+    // processes with higher IDs connect to us
+    int remaining = std::count(linked.begin(), linked.end(), 1);
+    auto connect_to = [&](int peer) {
+        attempts[peer]++;
+        int state = start_connect(peer);
+        if (state > 0 && finish_connect(peer)) {
+            remaining--;
+        } else if (state < 0) {
+            retry_later(peer, errno);
+        }
+    };
+    for (int i = 0; i < self; i++) {
+        if (linked[i]) {
+            connect_to(i);
+        }
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (remaining > 0) {
+        // Sleep until the next event, the earliest scheduled retry or the
+        // deadline
+        Clock::time_point now = Clock::now();
+        Clock::time_point wake = deadline;
+        for (int i = 0; i < self; i++) {
+            if (linked[i] && connections[i] == -1 && connecting[i] == -1) {
+                wake = std::min(wake, retry_at[i]);
+            }
+        }
+        int timeout_ms = startup_wait_ms(now, wake, deadline, connections);
+
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+        count(io.epoll_waits);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+        }
+
+        for (int e = 0; e < n; e++) {
+            uint64_t tag = events[e].data.u64;
+            if (tag == LISTEN_TAG) {
+                accept_pending();
+            } else if (tag >= ACCEPT_TAG_BASE) {
+                if (accept_connection((int)(tag - ACCEPT_TAG_BASE)) > 0) {
+                    remaining--;
+                }
+            } else if (tag >= CONNECT_TAG_BASE) {
+                int peer = (int)(tag - CONNECT_TAG_BASE);
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(connecting[peer], SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err == 0 && finish_connect(peer)) {
+                    remaining--;
+                    continue;
+                }
+
+                // Refused or reset: the peer is probably not listening yet
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connecting[peer], NULL);
+                close(connecting[peer]);
+                connecting[peer] = -1;
+                retry_later(peer, err ? err : ECONNABORTED);
+            }
+        }
+
+        // Restart connects whose retry time has come
+        now = Clock::now();
+        for (int i = 0; i < self; i++) {
+            if (linked[i] && connections[i] == -1 && connecting[i] == -1 && retry_at[i] <= now) {
+                connect_to(i);
+            }
+        }
+    }
+
+    // Anyone still connecting is a stray; after startup, connections only
+    // come from peers reconnecting
+    for (int sock : accepting) {
+        close(sock);
+    }
+    accepting.clear();
+    if (!keep_listening) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+    }
+}
+
+void PeerLinks::await_ready(Clock::time_point deadline) {
+    // Tell every peer our connections are all up, then wait until each has
+    // said the same. By then every connection in the cluster is up, so all
+    // processes start the workload within about one network delay of each
+    // other; in a relay tree, only our neighbours are known to be up. The
+    // notice precedes anything else a peer sends on the connection.
+    for (int i = 0; i < num_processes; i++) {
+        if (linked[i] && !send_notice(i, connections[i])) {
+            throw std::runtime_error("Failed to signal readiness to process " + std::to_string(i)
+                                     + ": " + strerror(errno));
+        }
+    }
+
+    std::vector<int> ready(num_processes, -1);
+    ready[self] = 0;
+    int remaining = std::count(linked.begin(), linked.end(), 1);
+    for (int i = 0; i < num_processes; i++) {
+        if (linked[i]) {
+            watch_socket(epoll_fd, connections[i], EPOLLIN | EPOLLRDHUP, i);
+        }
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (remaining > 0) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, startup_wait_ms(Clock::now(), deadline, deadline, ready));
+        count(io.epoll_waits);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+        }
+
+        for (int e = 0; e < n; e++) {
+            uint64_t tag = events[e].data.u64;
+            if (tag >= (uint64_t)num_processes || ready[tag] != -1) {
+                continue;
+            }
+            int peer = (int)tag;
+            std::string why;
+            int state = read_notice(peer, connections[peer], why);
+            if (state == 0) {
+                continue;
+            }
+            if (state < 0) {
+                throw std::runtime_error("Process " + std::to_string(peer) + " " + why + " during startup");
+            }
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connections[peer], NULL);
+            ready[peer] = 0;
+            remaining--;
+        }
+    }
+}
+
+void PeerLinks::create_shm_links() {
+    // The lower ID of each same-host pair creates the segment
+    if (!shared_memory) {
+        return;
+    }
+    for (int i = self + 1; i < num_processes; i++) {
+        if (linked[i] && cluster.same_host(self, i)) {
+            shm_links[i] = ShmLink::create(shm_name(self, i));
+            if (!shm_links[i]) {
+                LOG(LOG_INFO) << "Process " << self << ": no shared memory for process " << i
+                              << " (" << strerror(errno) << "), using TCP";
+            }
+        }
+    }
+}
+
+std::string PeerLinks::shm_name(int low_id, int high_id) const {
+    // The lower ID's port is unique on the host
+    return "/causal-" + std::to_string(cluster.node(low_id).port) + "-" + std::to_string(high_id);
+}
+
+void PeerLinks::listen_for_peers() {
+    int server_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_sock < 0) {
+        throw std::runtime_error("Failed to create server socket: " + std::string(strerror(errno)));
+    }
+
+    // Allow socket reuse
+    int opt = 1;
+    if (setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        close(server_sock);
+        throw std::runtime_error("setsockopt failed: " + std::string(strerror(errno)));
+    }
+
+    // Bind to port
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(cluster.node(self).port);
+
+    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        close(server_sock);
+        throw std::runtime_error("Bind failed: " + std::string(strerror(errno)));
+    }
+
+    // Listen for connections; every higher ID may connect at the same moment
+    if (listen(server_sock, SOMAXCONN) < 0) {
+        close(server_sock);
+        throw std::runtime_error("Listen failed: " + std::string(strerror(errno)));
+    }
+
+    server_socket = server_sock;
+}
+
+int PeerLinks::start_connect(int peer) {
+    const NodeConfig& target = cluster.node(peer);
+
+    // Resolve hostname
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addr = NULL;
+    if (getaddrinfo(target.host.c_str(), std::to_string(target.port).c_str(), &hints, &addr) != 0 || !addr) {
+        throw std::runtime_error("Failed to resolve hostname: " + target.host);
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        freeaddrinfo(addr);
+        throw std::runtime_error("Failed to create client socket: " + std::string(strerror(errno)));
+    }
+
+    int result = ::connect(sock, addr->ai_addr, addr->ai_addrlen);
+    int err = errno;
+    freeaddrinfo(addr);
+
+    if (result < 0 && err != EINPROGRESS) {
+        close(sock);
+        errno = err;
+        return -1;
+    }
+
+    // 1 if connected already, for the caller to finish; otherwise
+    // completion (or failure) is reported as writability
+    connecting[peer] = sock;
+    if (result == 0) {
+        return 1;
+    }
+    watch_socket(epoll_fd, sock, EPOLLOUT, CONNECT_TAG_BASE + peer);
+    return 0;
+}
+
+bool PeerLinks::finish_connect(int peer) {
+    int sock = connecting[peer];
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL); // Not registered yet on an immediate connect
+
+    // Attach to the peer's shared memory, if it made some, before sending
+    // our ID: that is when it checks
+    if (shared_memory && cluster.same_host(self, peer)) {
+        shm_links[peer] = ShmLink::open(shm_name(peer, self));
+    }
+
+    // Send our ID to the server; a fresh socket always has room for it
+    char hello[ID_SIZE];
+    put_u32(hello, self);
+    if (send(sock, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+        close(sock);
+        connecting[peer] = -1;
+        throw std::runtime_error("Failed to send ID: " + std::string(strerror(errno)));
+    }
+
+    // Connection successful
+    connecting[peer] = -1;
+    connections[peer] = sock;
+    LOG(LOG_INFO) << "Connected to process " << peer << (shm_links[peer] ? " (shared memory)" : "");
+    return true;
+}
+
+void PeerLinks::retry_later(int peer, int err) {
+    // A peer that is not listening yet is retried, less often each time
+    long long delay_ms = std::min(CONNECT_RETRY_MAX_MS,
+                                  CONNECT_RETRY_FIRST_MS << std::min(attempts[peer] - 1, 20));
+    LOG(LOG_INFO) << "Connection attempt " << attempts[peer] << " to process " << peer
+                  << " failed: " << strerror(err) << ". Retrying in " << delay_ms << " ms";
+    retry_at[peer] = Clock::now() + std::chrono::milliseconds(delay_ms);
+}
+
+void PeerLinks::accept_pending() {
+    // Accept everything queued; IDs are read once they arrive
+    int client_sock;
+    while ((client_sock = accept4(server_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        watch_socket(epoll_fd, client_sock, EPOLLIN, ACCEPT_TAG_BASE + client_sock);
+        accepting.push_back(client_sock);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        throw std::runtime_error("Accept failed: " + std::string(strerror(errno)));
+    }
+}
+
+int PeerLinks::read_id(int sock, int& peer) {
+    // Wait until the whole ID has arrived before consuming it. 1 once it
+    // has, with peer set; 0 if incomplete; -1 once the socket is closed
+    // because the ID is missing or is not a higher process's.
+    char hello[ID_SIZE];
+    ssize_t result = recv(sock, hello, sizeof(hello), MSG_PEEK);
+    if ((result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        || (result > 0 && result < (ssize_t)sizeof(hello))) {
+        return 0;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL);
+    accepting.erase(std::remove(accepting.begin(), accepting.end(), sock), accepting.end());
+    if (result > 0) {
+        recv(sock, hello, sizeof(hello), 0);
+        peer = (int)get_u32(hello);
+    }
+    if (result <= 0 || peer <= self || peer >= num_processes) {
+        LOG(LOG_ERROR) << "Rejected a connection: "
+                       << (result <= 0 ? "no process ID" : "invalid process ID " + std::to_string(peer));
+        close(sock);
+        return -1;
+    }
+    return 1;
+}
+
+int PeerLinks::accept_connection(int sock) {
+    int peer = -1;
+    int state = read_id(sock, peer);
+    if (state <= 0) {
+        return state;
+    }
+    if (!linked[peer] || connections[peer] != -1) {
+        LOG(LOG_ERROR) << "Rejected a connection: invalid process ID " << peer;
+        close(sock);
+        return -1;
+    }
+
+    // Its shared memory link is in use only if it attached; either way the
+    // name is no longer needed
+    if (shm_links[peer] && !shm_links[peer]->attached()) {
+        shm_links[peer].reset();
+    } else if (shm_links[peer]) {
+        shm_links[peer]->unlink();
+    }
+
+    connections[peer] = sock;
+    LOG(LOG_INFO) << "Accepted connection from process " << peer << (shm_links[peer] ? " (shared memory)" : "");
+    return 1;
+}
+
+bool PeerLinks::send_notice(int peer, int sock) {
+    char notice[NOTICE_SIZE];
+    notice[0] = READY_BYTE;
+    put_u32(notice + 1, handlers.notice(peer));
+    return send(sock, notice, sizeof(notice), MSG_NOSIGNAL) == (ssize_t)sizeof(notice);
+}
+
+int PeerLinks::read_notice(int peer, int sock, std::string& why) {
+    // Wait for the whole notice, then take exactly that, leaving whatever
+    // follows it. 1 once read and handled, 0 if incomplete, -1 with why set
+    // if the connection failed.
+    char notice[NOTICE_SIZE];
+    ssize_t result = recv(sock, notice, sizeof(notice), MSG_PEEK);
+    count(io.recv_calls);
+    if ((result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        || (result > 0 && result < (ssize_t)sizeof(notice))) {
+        return 0;
+    }
+    if (result <= 0 || notice[0] != READY_BYTE) {
+        why = result == 0 ? "closed its connection" : result < 0 ? strerror(errno) : "sent garbage";
+        return -1;
+    }
+    recv(sock, notice, sizeof(notice), 0);
+    handlers.noticed(peer, (int)get_u32(notice + 1));
+    return 1;
+}
+
+int PeerLinks::startup_wait_ms(Clock::time_point now, Clock::time_point wake, Clock::time_point deadline,
+                               const std::vector<int>& peers) const {
+    // Time to wait for, rounded up so the wait never ends just short of it;
+    // past the deadline, fail naming every peer still marked -1
+    if (now >= deadline) {
+        std::string missing;
+        for (int i = 0; i < num_processes; i++) {
+            if (linked[i] && peers[i] == -1) {
+                missing += (missing.empty() ? "" : ", ") + std::to_string(i);
+            }
+        }
+        throw std::runtime_error("Startup timed out after " + std::to_string((int)timeout_s)
+                                 + " s waiting for process(es) " + missing);
+    }
+    long long wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wake - now).count();
+    return (int)std::max(0LL, (wait_ns + 999999) / 1000000);
+}
+
+void PeerLinks::lost(int peer) {
+    // Until it is restored the peer is sent nothing
+    shm_links[peer].reset();
+    down[peer] = 1;
+    lost_at[peer] = Clock::now();
+    retry_at[peer] = lost_at[peer];
+    attempts[peer] = 0;
+    reconnect_due();
+}
+
+void PeerLinks::handle_event(uint64_t tag) {
+    // Connections being made again after startup, and their deadlines
+    if (tag == LISTEN_TAG) {
+        accept_pending();
+    } else if (tag == RECONNECT_TIMER_TAG) {
+        uint64_t expirations;
+        read(reconnect_timer, &expirations, sizeof(expirations));
+    } else if (tag >= ACCEPT_TAG_BASE) {
+        int client_sock = (int)(tag - ACCEPT_TAG_BASE);
+        if (std::find(accepting.begin(), accepting.end(), client_sock) != accepting.end()) {
+            accept_reconnect(client_sock);
+        }
+    } else if (tag >= RESUME_TAG_BASE) {
+        notice_arrived((int)(tag - RESUME_TAG_BASE));
+    } else if (tag >= CONNECT_TAG_BASE) {
+        int peer = (int)(tag - CONNECT_TAG_BASE);
+        if (connecting[peer] != -1) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(connecting[peer], SOL_SOCKET, SO_ERROR, &err, &len);
+            reconnected(peer, err);
+        }
+    }
+    reconnect_due();
+}
+
+void PeerLinks::reconnect_due() {
+    // Start the connects to lower IDs whose time has come, give up on any
+    // peer lost for longer than the connect timeout, and sleep until the
+    // next of either. Higher IDs connect to us.
+    Clock::time_point now = Clock::now();
+    Clock::time_point wake = Clock::time_point::max();
+    std::chrono::milliseconds timeout((long long)(timeout_s * 1000));
+    for (int i = 0; i < num_processes; i++) {
+        if (!down[i]) {
+            continue;
+        }
+        if (now >= lost_at[i] + timeout) {
+            throw std::runtime_error("Could not reconnect to process " + std::to_string(i) + " within "
+                                     + std::to_string((int)timeout_s) + " s");
+        }
+        wake = std::min(wake, lost_at[i] + timeout);
+        if (i < self && connecting[i] == -1 && resuming[i] == -1) {
+            if (retry_at[i] <= now) {
+                attempts[i]++;
+                int state = start_connect(i);
+                if (state > 0) {
+                    reconnected(i, 0);
+                } else if (state < 0) {
+                    retry_later(i, errno);
+                }
+            }
+            if (down[i] && connecting[i] == -1 && resuming[i] == -1) {
+                wake = std::min(wake, retry_at[i]);
+            }
+        }
+    }
+    if (wake == Clock::time_point::max()) {
+        return;
+    }
+
+    if (reconnect_timer == -1) {
+        reconnect_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (reconnect_timer < 0) {
+            throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+        }
+        watch_socket(epoll_fd, reconnect_timer, EPOLLIN, RECONNECT_TIMER_TAG);
+    }
+
+    // A zero it_value would disarm the timer, so a time already passed
+    // fires in 1ns
+    long long wait_ns = std::max(1LL, (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        wake - now).count());
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = wait_ns / 1000000000LL;
+    spec.it_value.tv_nsec = wait_ns % 1000000000LL;
+    if (timerfd_settime(reconnect_timer, 0, &spec, NULL) < 0) {
+        throw std::runtime_error("timerfd_settime failed: " + std::string(strerror(errno)));
+    }
+}
+
+void PeerLinks::reconnected(int peer, int err) {
+    // Our connect to a lost peer has finished: send our ID and our notice,
+    // then wait for the peer's
+    int sock = connecting[peer];
+    connecting[peer] = -1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL); // Not registered on an immediate connect
+    char hello[ID_SIZE];
+    put_u32(hello, self);
+    if (err == 0 && send(sock, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+        err = errno;
+    }
+    if (err == 0 && !send_notice(peer, sock)) {
+        err = errno;
+    }
+    if (err != 0) {
+        close(sock);
+        retry_later(peer, err);
+        return;
+    }
+    await_notice(peer, sock);
+}
+
+void PeerLinks::accept_reconnect(int sock) {
+    // A higher ID connecting again, once its ID has arrived. If we still
+    // had a link to it, the peer found it broken first.
+    int peer = -1;
+    if (read_id(sock, peer) <= 0) {
+        return;
+    }
+    if (!down[peer]) {
+        handlers.broken(peer);
+    }
+    if (resuming[peer] != -1) {
+        close(resuming[peer]);
+        resuming[peer] = -1;
+    }
+    if (!send_notice(peer, sock)) {
+        LOG(LOG_INFO) << "Reconnection from process " << peer << " failed: " << strerror(errno);
+        close(sock);
+        return;
+    }
+    await_notice(peer, sock);
+}
+
+void PeerLinks::await_notice(int peer, int sock) {
+    resuming[peer] = sock;
+    watch_socket(epoll_fd, sock, EPOLLIN | EPOLLRDHUP, RESUME_TAG_BASE + peer);
+}
+
+void PeerLinks::notice_arrived(int peer) {
+    int sock = resuming[peer];
+    if (sock == -1) {
+        return;
+    }
+    std::string why;
+    int state = read_notice(peer, sock, why);
+    if (state == 0) {
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL);
+    resuming[peer] = -1;
+    if (state < 0) {
+        // The connecting side tries again
+        LOG(LOG_INFO) << "Reconnection to process " << peer << " failed: " << why;
+        close(sock);
+        if (peer < self) {
+            retry_later(peer, ECONNABORTED);
+        }
+        return;
+    }
+    down[peer] = 0;
+    LOG(LOG_INFO) << "Reconnected to process " << peer << " after "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - lost_at[peer]).count()
+                  << " ms";
+    handlers.restored(peer, sock);
+}
+
+void PeerLinks::close_pending() {
+    for (int i = 0; i < num_processes; i++) {
+        if (connecting[i] != -1) {
+            close(connecting[i]);
+            connecting[i] = -1;
+        }
+        if (resuming[i] != -1) {
+            close(resuming[i]);
+            resuming[i] = -1;
+        }
+    }
+    for (int sock : accepting) {
+        close(sock);
+    }
+    accepting.clear();
+    if (server_socket != -1) {
+        close(server_socket);
+        server_socket = -1;
+    }
+    if (reconnect_timer != -1) {
+        close(reconnect_timer);
+        reconnect_timer = -1;
+    }
+}
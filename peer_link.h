@@ -0,0 +1,118 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "metrics.h"
+#include "shm_link.h"
+
+// epoll user data of what PeerLinks registers. A peer's connection is tagged
+// with its ID by whoever watches it; everything else a process registers
+// must stay below LINK_TAG_BASE.
+const uint64_t LINK_TAG_BASE = 1090000;
+const uint64_t LISTEN_TAG = LINK_TAG_BASE;
+const uint64_t RECONNECT_TIMER_TAG = LINK_TAG_BASE + 1;
+const uint64_t CONNECT_TAG_BASE = 1100000; // + ID of a peer we are connecting to
+const uint64_t RESUME_TAG_BASE = 1200000;  // + ID of a reconnected peer whose notice we await
+const uint64_t ACCEPT_TAG_BASE = 2000000;  // + fd of an accepted socket awaiting its ID
+
+// Add sock to the epoll instance epfd for events, tagged tag
+void watch_socket(int epfd, int sock, uint32_t events, uint64_t tag);
+
+// What the process does at each step of a link's life, called on the thread
+// driving PeerLinks
+struct LinkHandlers {
+    std::function<int(int)> notice;          // Our notice to a peer is going: its messages we have received
+    std::function<void(int, int)> noticed;   // A peer's notice: how many of our messages it has received
+    std::function<void(int)> broken;         // A peer connected again while we had a link to it: drop ours
+    std::function<void(int, int)> restored;  // Notices are through on a new socket to a lost peer
+};
+
+// The connections between a process and its linked peers, made at startup
+// and made again when one is lost. The higher ID of each pair connects and
+// sends its ID (u32); once a process's own connections are all up, it sends
+// each peer a notice, a ready byte and the count (u32) of that peer's
+// messages it has received, and a link carries frames once the notices of
+// both ends are through. Same-host pairs also get a ShmLink at startup;
+// links made again always use TCP.
+//
+// Established sockets and shared memory links are the process's: this keeps
+// what is still connecting, being accepted or resuming, and the reconnect
+// schedule. A lost link is retried, backing off, until the connect timeout
+// runs out.
+class PeerLinks {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    int self;
+    int num_processes;
+    const ClusterConfig& cluster;
+    const std::vector<char>& linked;  // Per peer: we have a link to it
+    std::vector<int>& connections;    // Per peer: established socket, or -1
+    std::vector<std::unique_ptr<ShmLink> >& shm_links;
+    IoCounters& io;
+    LinkHandlers handlers;
+    double timeout_s;                 // Limit on startup, and on reconnecting a lost link
+    bool shared_memory;
+    int epoll_fd;
+    int server_socket;
+    int reconnect_timer;              // timerfd for connect retries and reconnect deadlines
+    std::vector<int> connecting;      // Sockets with a connect still in progress
+    std::vector<int> accepting;       // Accepted sockets still owing their ID
+    std::vector<int> resuming;        // Per peer: new connection awaiting its notice, or -1
+    std::vector<char> down;           // Per peer: lost and not yet restored
+    std::vector<Clock::time_point> lost_at;
+    std::vector<Clock::time_point> retry_at; // Next connect attempt, for lower IDs
+    std::vector<int> attempts;
+
+    void create_shm_links();
+    std::string shm_name(int low_id, int high_id) const;
+    void listen_for_peers();
+    int start_connect(int peer);
+    bool finish_connect(int peer);
+    void retry_later(int peer, int err);
+    void accept_pending();
+    int read_id(int sock, int& peer);
+    int accept_connection(int sock);
+    bool send_notice(int peer, int sock);
+    int read_notice(int peer, int sock, std::string& why);
+    int startup_wait_ms(Clock::time_point now, Clock::time_point wake, Clock::time_point deadline,
+                        const std::vector<int>& peers) const;
+    void reconnect_due();
+    void reconnected(int peer, int err);
+    void accept_reconnect(int sock);
+    void await_notice(int peer, int sock);
+    void notice_arrived(int peer);
+
+public:
+    PeerLinks(int self_id, const ClusterConfig& cluster_config, const std::vector<char>& linked_peers,
+              std::vector<int>& peer_sockets, std::vector<std::unique_ptr<ShmLink> >& peer_shm_links,
+              IoCounters& counters);
+    void set_handlers(const LinkHandlers& link_handlers) { handlers = link_handlers; }
+    void set_timeout(double seconds) { timeout_s = seconds; }
+    double timeout() const { return timeout_s; }
+    void set_shared_memory(bool enabled) { shared_memory = enabled; }
+
+    // Startup, through epoll instance epfd: connect to every linked peer by
+    // the deadline, then keep listening only if keep_listening, for peers
+    // reconnecting
+    void connect(int epfd, Clock::time_point deadline, bool keep_listening);
+
+    // Send every peer our notice and wait for each of theirs, by the
+    // deadline. Once it returns every link is up, and no peer has sent
+    // anything else yet.
+    void await_ready(Clock::time_point deadline);
+
+    // The process has closed its connection to peer: make it again
+    void lost(int peer);
+
+    // An event tagged LINK_TAG_BASE or above
+    void handle_event(uint64_t tag);
+
+    // Close everything still connecting, accepting or resuming
+    void close_pending();
+};
@@ -1,550 +1,2387 @@
 #include "process.h"
+#include "logger.h"
+#include "trace.h"
 #include <iostream>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <unistd.h>
-#include <netdb.h>
 #include <string.h>
 #include <algorithm>
 #include <random>
 #include <chrono>
-#include <thread>
-#include <sstream>
 #include <fcntl.h>
 #include <stdexcept>
 #include <errno.h>  // For errno access
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
-// Define server ports for each process
-const int BASE_PORT = 8000;
-// Define hostnames for the four processes
-// const std::string HOSTS[] = {"dc01", "dc02", "dc03", "dc04"};
-const std::string HOSTS[] = {"localhost", "localhost", "localhost", "localhost"};
+// epoll user data for the two timers; peer sockets use their process ID,
+// and what peer_links registers is tagged from LINK_TAG_BASE up
+const uint64_t BROADCAST_TIMER_TAG = 1000000;
+const uint64_t DELAY_TIMER_TAG = 1000001;
+const uint64_t STATS_TIMER_TAG = 1000003;
+const uint64_t BATCH_TIMER_TAG = 1000004;
+const uint64_t WAKE_TAG = 1000005;
+const uint64_t STOP_TAG = 1000006;
+const uint64_t SUBMIT_TAG = 1000007;
+const uint64_t FLOW_TAG = 1000008;
+const uint64_t METRICS_TIMER_TAG = 1000009;
+const uint64_t JOURNAL_TAG = 1000010;
+const uint64_t ANNOUNCE_TIMER_TAG = 1000012;
+const int MAX_EVENTS = 64;
+// Unthrottled mode sends in bursts and pauses while any peer has this much queued
+const int SEND_BURST = 64;
+const size_t MAX_OUTBOUND_BYTES = 4 * 1024 * 1024;
+// Under a Transport, how long an unthrottled sender waits out congestion
+const long long UNTHROTTLED_BACKOFF_US = 10;
+// Total order: how long after a message moves our clock we announce it,
+// unless a message of ours carries it first
+const long long ANNOUNCE_DELAY_US = 500;
+// Pipelined mode: decoded messages each receive thread can have in flight,
+// and how many the delivery thread takes from one ring before checking timers
+const size_t INBOUND_RING_SIZE = 16384;
+const int DRAIN_BURST = 4096;
+// Embedded use: payloads submit() will hold before refusing more
+const size_t MAX_SUBMITTED_BYTES = 4 * 1024 * 1024;
+// Causal buffer ceiling unless --buffer-limit says otherwise
+const size_t DEFAULT_BUFFER_LIMIT = 64 * 1024 * 1024;
+// Bytes moved from a shared memory ring into a decoder at a time
+const size_t SHM_READ_BYTES = 64 * 1024;
+// Room a decoder gets for each recv() from a socket
+const size_t RECV_BYTES = 64 * 1024;
+// Recent messages kept for resending after a reconnect, without a journal:
+// twice the credit window, which bounds what a peer can be missing, or this
+// much with flow control off
+const size_t DEFAULT_RETRANSMIT_BYTES = 16 * 1024 * 1024;
 
-Process::Process(int process_id, bool delay, bool debug) : 
+Process::Process(int process_id, const ClusterConfig& cluster_config, const WorkloadConfig& workload_config,
+                 bool delay, bool debug) : 
     id(process_id), 
+    num_processes(cluster_config.size()),
+    cluster(cluster_config),
+    workload(workload_config, std::random_device()() ^ process_id),
+    peer_acked(cluster_config.size()),
+    credit_stall_ns(cluster_config.size()),
+    credit_due(cluster_config.size()),
+    peer_closed(cluster_config.size()),
+    closed_seen(cluster_config.size()),
+    peer_links(process_id, cluster, linked, connections, shm_links, io),
     use_delay(delay),
     msg_counter(0),
-    vector_clock(4, 0),
-    msg_delivered(4, 0),
+    msg_delivered(cluster_config.size(), 0),
+    network_latency(cluster_config.size()),
+    buffer_latency(cluster_config.size()),
+    peak_buffer_depth(0),
+    expected_from(cluster_config.size(), -1),
     messages_sent(0), 
+    done_sent(false),
     debug_mode(debug){
     
-    // Initialize socket storage
-    for (int i = 0; i < 4; i++) {
-        if (i != id) {
-            connections.push_back(-1);
-        } else {
-            connections.push_back(-1); // Placeholder for self
-        }
-    }
+    // Initialize socket storage; our own slot stays -1
+    connections.assign(num_processes, -1);
+    decoders.resize(num_processes);
+    outbound.resize(num_processes);
+    shm_links.resize(num_processes);
+    delivered_cost.assign(num_processes, 0);
+    undelivered_cost.assign(num_processes, 0);
+    credit_marked.assign(num_processes, 0);
+    credit_sent.assign(num_processes, 0);
+    held_up_ns.assign(num_processes, 0);
+    received_from.resize(num_processes);
+    arrived_from.assign(num_processes, 0);
+    peer_view.assign(num_processes, 0);
+    resume_from.assign(num_processes, 0);
+    credit_base.assign(num_processes, 0);
+    linked.assign(num_processes, 1);
+    linked[id] = 0;
+    links = num_processes - 1;
+    LinkHandlers handlers;
+    handlers.notice = [this](int peer) { return notice_count(peer); };
+    handlers.noticed = [this](int peer, int count) { notice_received(peer, count); };
+    handlers.broken = [this](int peer) { link_broken(peer); };
+    handlers.restored = [this](int peer, int sock) { restore_link(peer, sock); };
+    peer_links.set_handlers(handlers);
+    set_buffer_limit(DEFAULT_BUFFER_LIMIT);
+    set_channels(1);
     
-    std::cout << "Process " << id << " initialized. Delay mode: " << (use_delay ? "ON" : "OFF") << std::endl;
+    LOG(LOG_INFO) << "Process " << id << " initialized. Cluster size: " << num_processes
+                  << ", Delay mode: " << (use_delay ? "ON" : "OFF") << ", Clock kernels: " << clock_kernels.name;
 }
 
 void Process::run() {
     try {
-        // Step 1: Establish connections
+        start_time = Clock::now();
+        
+        // Step 1: Recover what the journal holds, then establish connections
+        setup_relay();
+        open_journal();
+        if (!journal && retransmit_limit != 0) {
+            // Without a journal, recent messages are kept in memory for
+            // resending to a peer that reconnects
+            retransmit.set_limit(retransmit_limit > 0 ? retransmit_limit
+                                 : credit_window > 0 ? 2 * credit_window : DEFAULT_RETRANSMIT_BYTES);
+            retransmitting = true;
+        }
+        setup_reactor();
         connect_to_others();
+        if (io_threads == 0) {
+            register_peers();
+        }
+        connected_time = Clock::now();
+        last_stats_time = connected_time;
+        last_metrics_time = connected_time;
+        start_periodic_timers();
+        
+        LOG(LOG_INFO) << "Process " << id << ": All connections established";
+        
+        // Step 2: Broadcast and deliver, on this thread alone or pipelined
+        next_send = connected_time;
+        if (io_threads > 0) {
+            run_pipeline();
+        } else {
+            run_reactor();
+        }
+        finish_time = Clock::now();
+        
+        // Print summary, and leave the final counts in the metrics file
+        print_summary();
+        if (!metrics_path.empty()) {
+            write_metrics();
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error in process " << id << ": " << e.what() << std::endl;
+        failed = true;
+        stop_requested.store(true);
+    }
+    
+    // Step 3: Clean up connections
+    for (int sock : connections) {
+        if (sock != -1) {
+            close(sock);
+        }
+    }
+    
+    peer_links.close_pending();
+    
+    if (broadcast_timer != -1) {
+        close(broadcast_timer);
+    }
+    
+    if (delay_timer != -1) {
+        close(delay_timer);
+    }
+    
+    if (stats_timer != -1) {
+        close(stats_timer);
+    }
+    
+    if (metrics_timer != -1) {
+        close(metrics_timer);
+    }
+    
+    if (batch_timer != -1) {
+        close(batch_timer);
+    }
+    
+    if (announce_timer != -1) {
+        close(announce_timer);
+    }
+    
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    
+    for (int sock : retired_sockets) {
+        close(sock);
+    }
+    
+    if (send_epoll_fd != -1) {
+        close(send_epoll_fd);
+    }
+    
+    if (wake_fd != -1) {
+        close(wake_fd);
+    }
+    
+    if (stop_fd != -1) {
+        close(stop_fd);
+    }
+    
+    if (submit_fd != -1) {
+        close(submit_fd);
+    }
+    
+    if (flow_fd != -1) {
+        close(flow_fd);
+    }
+}
+
+void Process::run_reactor() {
+    // Event loop - broadcasts are driven by a timer, receives by socket
+    // readiness, so neither waits on the other
+    schedule_broadcast();
+    
+    struct epoll_event events[MAX_EVENTS];
+    while (!is_finished()) {
+        // Unthrottled senders only poll so they can keep sending
+        int timeout = !app_source && workload.unthrottled() && !done_sent && !outbound_full()
+                      && stalled_on < 0 ? 0 : -1;
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        count(io.epoll_waits);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+        }
         
-        std::cout << "Process " << id << ": All connections established" << std::endl;
+        for (int e = 0; e < n; e++) {
+            uint64_t tag = events[e].data.u64;
+            if (tag == BROADCAST_TIMER_TAG) {
+                uint64_t expirations;
+                if (read(broadcast_timer, &expirations, sizeof(expirations)) > 0) {
+                    send_due_messages();
+                }
+            } else if (tag == DELAY_TIMER_TAG) {
+                uint64_t expirations;
+                if (read(delay_timer, &expirations, sizeof(expirations)) > 0) {
+                    release_delayed();
+                }
+            } else if (tag == BATCH_TIMER_TAG) {
+                uint64_t expirations;
+                if (read(batch_timer, &expirations, sizeof(expirations)) > 0) {
+                    flush_batch();
+                }
+            } else if (tag == ANNOUNCE_TIMER_TAG) {
+                uint64_t expirations;
+                if (read(announce_timer, &expirations, sizeof(expirations)) > 0) {
+                    announce_clock();
+                }
+            } else if (tag == SUBMIT_TAG) {
+                uint64_t value;
+                if (read(submit_fd, &value, sizeof(value)) > 0) {
+                    take_submissions();
+                }
+            } else if (tag == STATS_TIMER_TAG) {
+                uint64_t expirations;
+                if (read(stats_timer, &expirations, sizeof(expirations)) > 0) {
+                    print_stats();
+                }
+            } else if (tag == METRICS_TIMER_TAG) {
+                uint64_t expirations;
+                if (read(metrics_timer, &expirations, sizeof(expirations)) > 0) {
+                    write_metrics();
+                }
+            } else if (tag == JOURNAL_TAG) {
+                uint64_t syncs;
+                if (read(journal->notify_fd(), &syncs, sizeof(syncs)) > 0) {
+                    release_durable();
+                }
+            } else if (tag < (uint64_t)num_processes) {
+                int peer = (int)tag;
+                if (events[e].events & EPOLLOUT) {
+                    flush_outbound(peer);
+                }
+                if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+                    handle_incoming(peer);
+                }
+            } else if (tag >= LINK_TAG_BASE) {
+                peer_links.handle_event(tag);
+            }
+        }
         
-        // Step 2: Main loop - broadcast and receive messages
+        if (app_source) {
+            update_backpressure();
+        } else if (workload.unthrottled() && !done_sent) {
+            send_due_messages();
+        }
+    }
+}
+
+void Process::start() {
+    setup_relay();
+    start_time = now();
+    mesh_time = start_time;
+    connected_time = start_time;
+    last_stats_time = start_time;
+    next_send = start_time;
+    schedule_broadcast();
+}
+
+void Process::on_timer(uint64_t tag) {
+    if (tag == BROADCAST_TIMER_TAG) {
+        send_due_messages();
+    } else if (tag == DELAY_TIMER_TAG) {
+        release_delayed();
+    } else if (tag == BATCH_TIMER_TAG) {
+        flush_batch();
+    } else if (tag == ANNOUNCE_TIMER_TAG) {
+        announce_clock();
+    }
+}
+
+void Process::on_receive(int from_id, const char* data, size_t len) {
+    FrameDecoder& decoder = decoders[from_id];
+    memcpy(decoder.write_ptr(len), data, len);
+    decoder.commit(len);
+    decode_frames(from_id, NULL);
+}
+
+void Process::finish() {
+    finish_time = now();
+    print_summary();
+}
+
+long long Process::messages_delivered() const {
+    long long total = 0;
+    for (int count : msg_delivered) {
+        total += count;
+    }
+    return total;
+}
+
+void Process::run_pipeline() {
+    // Receive threads split the peers between them; more threads than peers
+    // would sit idle
+    int threads = std::min(io_threads, std::max(1, num_processes - 1));
+    setup_pipeline(threads);
+    pipeline_threads = threads;
+    start_workers();
+    LOG(LOG_INFO) << "Process " << id << ": pipelined with " << threads << " receive thread(s)";
+    
+    // This thread is the delivery stage: it alone touches the channels'
+    // clocks and delivery buffers, and the statistics
+    try {
+        struct epoll_event events[MAX_EVENTS];
+        bool backlog = false;
         while (!is_finished()) {
-            // Process incoming messages
-            handle_incoming();
+            if (worker_failed.load(std::memory_order_relaxed)) {
+                throw std::runtime_error("pipeline thread failed");
+            }
+            
+            // A ring left non-empty only polls, so timers still get a turn
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, backlog ? 0 : -1);
+            count(io.epoll_waits);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+            }
             
-            // Broadcast a message if we haven't sent all 100 yet
-            if (messages_sent < 100) {
-                // Wait random time before sending
-                int wait_time = random_int(1, 10);
-                std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+            for (int e = 0; e < n; e++) {
+                uint64_t tag = events[e].data.u64;
+                uint64_t value;
+                if (tag == WAKE_TAG) {
+                    // Reset before draining: any later push writes it again
+                    read(wake_fd, &value, sizeof(value));
+                } else if (tag == DELAY_TIMER_TAG) {
+                    if (read(delay_timer, &value, sizeof(value)) > 0) {
+                        release_delayed();
+                    }
+                } else if (tag == STATS_TIMER_TAG) {
+                    if (read(stats_timer, &value, sizeof(value)) > 0) {
+                        print_stats();
+                    }
+                } else if (tag == METRICS_TIMER_TAG) {
+                    if (read(metrics_timer, &value, sizeof(value)) > 0) {
+                        write_metrics();
+                    }
+                } else if (tag >= LINK_TAG_BASE) {
+                    peer_links.handle_event(tag);
+                }
+            }
+            backlog = drain_inbound();
+            check_closed_links();
+        }
+    } catch (...) {
+        stop_workers();
+        throw;
+    }
+    stop_workers();
+}
+
+void Process::setup_pipeline(int threads) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    send_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (wake_fd < 0 || stop_fd < 0 || send_epoll_fd < 0) {
+        throw std::runtime_error("Pipeline setup failed: " + std::string(strerror(errno)));
+    }
+    watch_socket(epoll_fd, wake_fd, EPOLLIN, WAKE_TAG);
+    
+    // The broadcast, batch and announce timers move to the sender thread,
+    // along with write readiness of every peer socket
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, broadcast_timer, NULL);
+    watch_socket(send_epoll_fd, broadcast_timer, EPOLLIN, BROADCAST_TIMER_TAG);
+    if (batch_timer != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, batch_timer, NULL);
+        watch_socket(send_epoll_fd, batch_timer, EPOLLIN, BATCH_TIMER_TAG);
+    }
+    if (announce_timer != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, announce_timer, NULL);
+        watch_socket(send_epoll_fd, announce_timer, EPOLLIN, ANNOUNCE_TIMER_TAG);
+    }
+    watch_socket(send_epoll_fd, stop_fd, EPOLLIN, STOP_TAG);
+    if (submit_fd != -1) {
+        watch_socket(send_epoll_fd, submit_fd, EPOLLIN, SUBMIT_TAG);
+    }
+    
+    // Credit reports go out from, and credit arrivals are acted on by, the
+    // sender thread; the delivery thread signals both through flow_fd. The
+    // receive threads also use it when a shared memory ring we filled has
+    // room again.
+    flow_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (flow_fd < 0) {
+        throw std::runtime_error("Pipeline setup failed: " + std::string(strerror(errno)));
+    }
+    watch_socket(send_epoll_fd, flow_fd, EPOLLIN, FLOW_TAG);
+    if (journal) {
+        watch_socket(send_epoll_fd, journal->notify_fd(), EPOLLIN, JOURNAL_TAG);
+    }
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id && connections[i] != -1) {
+            watch_socket(send_epoll_fd, connections[i], EPOLLOUT | EPOLLET, i);
+        }
+    }
+    
+    receive_sockets = connections;
+    for (int t = 0; t < threads; t++) {
+        inbound.push_back(std::unique_ptr<SpscRing<Inbound> >(new SpscRing<Inbound>(INBOUND_RING_SIZE)));
+    }
+}
+
+void Process::receive_loop(int worker, int threads) {
+    int ep = -1;
+    try {
+        ep = epoll_create1(EPOLL_CLOEXEC);
+        if (ep < 0) {
+            throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+        }
+        watch_socket(ep, stop_fd, EPOLLIN, STOP_TAG);
+        
+        // Peers are dealt out round-robin, so each one's frames stay in order
+        // on a single thread and a single ring
+        for (int i = 0; i < num_processes; i++) {
+            int peer_index = i < id ? i : i - 1;
+            if (i != id && receive_sockets[i] != -1 && peer_index % threads == worker) {
+                watch_socket(ep, receive_sockets[i], EPOLLIN | EPOLLRDHUP | EPOLLET, i);
+            }
+        }
+        
+        SpscRing<Inbound>* ring = inbound[worker].get();
+        auto serve = [&](int peer) {
+            bool open = true;
+            try {
+                open = receive_messages(peer, receive_sockets[peer], ring);
+            } catch (const std::exception& e) {
+                if (!peer_closed[peer]) {
+                    LOG(LOG_ERROR) << "Error receiving message from process " << peer << ": " << e.what();
+                }
+                open = false;
+            }
+            
+            // The delivery thread decides whether a close was the end or a
+            // loss, once it has taken every frame before it
+            if (!open) {
+                epoll_ctl(ep, EPOLL_CTL_DEL, receive_sockets[peer], NULL);
+                closed_seen[peer].store(true);
+                any_closed.store(true);
+            }
+            
+            // One wakeup per readiness event, however many frames it held
+            wake_delivery();
+        };
+        
+        // After a pause, shared memory rings may hold frames whose writer
+        // saw no need to ring, so each one is read once up front
+        for (int i = 0; i < num_processes; i++) {
+            int peer_index = i < id ? i : i - 1;
+            if (i != id && receive_sockets[i] != -1 && shm_links[i] && peer_index % threads == worker) {
+                serve(i);
+            }
+        }
+        
+        struct epoll_event events[MAX_EVENTS];
+        bool running = true;
+        while (running) {
+            int n = epoll_wait(ep, events, MAX_EVENTS, -1);
+            count(io.epoll_waits);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+            }
+            
+            for (int e = 0; e < n; e++) {
+                uint64_t tag = events[e].data.u64;
+                if (tag == STOP_TAG) {
+                    running = false;
+                    break;
+                }
                 
-                broadcast_message();
+                serve((int)tag);
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG(LOG_ERROR) << "Receive thread " << worker << " failed: " << e.what();
+        worker_failed.store(true);
+        wake_delivery();
+    }
+    if (ep != -1) {
+        close(ep);
+    }
+    workers_running.fetch_sub(1);
+}
+
+void Process::send_loop() {
+    try {
+        schedule_broadcast();
+        
+        // After a pause, write what was queued meanwhile: readiness seen
+        // before it may never have been acted on
+        for (int i = 0; i < num_processes; i++) {
+            if (i != id && !outbound[i].empty()) {
+                flush_outbound(i);
+            }
+        }
+        
+        struct epoll_event events[MAX_EVENTS];
+        bool finished = false;
+        bool running = true;
+        while (running) {
+            // Once our own sending is over, stay up until stopped: peers may
+            // still be waiting on the credit reports this thread sends
+            if (!finished && all_sent()) {
+                finished = true;
+                sending_finished.store(true, std::memory_order_release);
+                wake_delivery();
             }
+            
+            // Unthrottled senders only poll so they can keep sending
+            int timeout = !app_source && workload.unthrottled() && !done_sent && !outbound_full()
+                      && stalled_on < 0 ? 0 : -1;
+            int n = epoll_wait(send_epoll_fd, events, MAX_EVENTS, timeout);
+            count(io.epoll_waits);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+            }
+            
+            for (int e = 0; e < n; e++) {
+                uint64_t tag = events[e].data.u64;
+                uint64_t expirations;
+                if (tag == STOP_TAG) {
+                    running = false;
+                    break;
+                } else if (tag == BROADCAST_TIMER_TAG) {
+                    if (read(broadcast_timer, &expirations, sizeof(expirations)) > 0) {
+                        send_due_messages();
+                    }
+                } else if (tag == BATCH_TIMER_TAG) {
+                    if (read(batch_timer, &expirations, sizeof(expirations)) > 0) {
+                        flush_batch();
+                    }
+                } else if (tag == ANNOUNCE_TIMER_TAG) {
+                    if (read(announce_timer, &expirations, sizeof(expirations)) > 0) {
+                        announce_clock();
+                    }
+                } else if (tag == SUBMIT_TAG) {
+                    if (read(submit_fd, &expirations, sizeof(expirations)) > 0) {
+                        take_submissions();
+                    }
+                } else if (tag == FLOW_TAG) {
+                    if (read(flow_fd, &expirations, sizeof(expirations)) > 0) {
+                        send_credits();
+                        credit_received();
+                        retry_shm_backlog();
+                    }
+                } else if (tag == JOURNAL_TAG) {
+                    if (read(journal->notify_fd(), &expirations, sizeof(expirations)) > 0) {
+                        release_durable();
+                    }
+                } else if (tag < (uint64_t)num_processes) {
+                    flush_outbound((int)tag);
+                }
+            }
+            if (!running) {
+                break;
+            }
+            
+            if (app_source) {
+                update_backpressure();
+            } else if (workload.unthrottled() && !done_sent) {
+                send_due_messages();
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG(LOG_ERROR) << "Sender thread failed: " << e.what();
+        worker_failed.store(true);
+    }
+    workers_running.fetch_sub(1);
+    wake_delivery();
+}
+
+bool Process::drain_inbound() {
+    // Take a bounded burst from every ring; true if any has more waiting
+    static thread_local Inbound item;
+    bool more = false;
+    for (size_t r = 0; r < inbound.size(); r++) {
+        int taken = 0;
+        while (taken < DRAIN_BURST && inbound[r]->try_pop(item)) {
+            accept_frame(item.from_id, item.type, item.msg);
+            taken++;
+        }
+        more = more || taken == DRAIN_BURST;
+    }
+    return more;
+}
+
+void Process::wake_delivery() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG(LOG_ERROR) << "Failed to wake delivery thread: " << strerror(errno);
+    }
+}
+
+void Process::start_workers() {
+    workers_running.store(pipeline_threads + 1);
+    for (int t = 0; t < pipeline_threads; t++) {
+        workers.push_back(std::thread(&Process::receive_loop, this, t, pipeline_threads));
+    }
+    workers.push_back(std::thread(&Process::send_loop, this));
+}
+
+bool Process::pause_workers() {
+    // Stop the pipeline threads so this thread alone can change the links.
+    // Receive threads stop between reads, so frames are only ever whole;
+    // the rings are drained meanwhile so none of them waits for space.
+    if (workers.empty()) {
+        return false;
+    }
+    uint64_t value = 1;
+    if (write(stop_fd, &value, sizeof(value)) < 0) {
+        throw std::runtime_error("Failed to pause pipeline threads: " + std::string(strerror(errno)));
+    }
+    while (workers_running.load() > 0) {
+        drain_inbound();
+        std::this_thread::yield();
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    workers.clear();
+    read(stop_fd, &value, sizeof(value));
+    while (drain_inbound()) {}
+    return true;
+}
+
+void Process::stop_workers() {
+    // Until it is read, stop_fd stays readable for every worker
+    stopping.store(true);
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0) {
+        LOG(LOG_ERROR) << "Failed to stop pipeline threads: " << strerror(errno);
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    workers.clear();
+}
+
+void Process::use_application_source() {
+    app_source = true;
+    submit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (submit_fd < 0) {
+        throw std::runtime_error("eventfd failed: " + std::string(strerror(errno)));
+    }
+}
+
+BroadcastResult Process::submit(int channel, const char* data, size_t len) {
+    if (len + FRAME_HEADER_SIZE + sizeof(int32_t) + num_processes * sizeof(int32_t) > MAX_FRAME_SIZE) {
+        throw std::invalid_argument("Payload too large: " + std::to_string(len) + " bytes");
+    }
+    if (channel < 0 || channel >= (int)channels.size()) {
+        throw std::invalid_argument("No channel " + std::to_string(channel));
+    }
+    Channel& queue = *channels[channel];
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(submit_lock);
+        if (stop_requested.load(std::memory_order_relaxed)) {
+            return BROADCAST_STOPPED;
+        }
+        // One payload is always taken, however large
+        if (backpressure.load(std::memory_order_relaxed)
+            || (submitted > 0 && submitted_bytes + len > MAX_SUBMITTED_BYTES)) {
+            return BROADCAST_BUSY;
+        }
+        if (queue.submitted == queue.submissions.size()) {
+            queue.submissions.push_back(std::string());
+        }
+        queue.submissions[queue.submitted++].assign(data, len);
+        queue.submitted_bytes += len;
+        submitted_bytes += len;
+        wake = ++submitted == 1;
+    }
+    
+    // The sending thread takes everything queued per wakeup, so only the
+    // first submission since it last looked needs to signal
+    uint64_t one = 1;
+    if (wake && write(submit_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        throw std::runtime_error("Failed to signal submission: " + std::string(strerror(errno)));
+    }
+    return BROADCAST_QUEUED;
+}
+
+void Process::request_stop() {
+    {
+        std::lock_guard<std::mutex> lock(submit_lock);
+        stop_requested.store(true);
+    }
+    uint64_t one = 1;
+    if (write(submit_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG(LOG_ERROR) << "Failed to signal stop: " << strerror(errno);
+    }
+}
+
+void Process::take_submissions() {
+    // Swap the channels' queues out so producers are held up only for the
+    // swap, and broadcast what was taken while credit lasts, one message
+    // from each channel in turn, so a quiet channel does not wait behind a
+    // busy one's backlog; what is left goes out when credit arrives. A stop
+    // seen under the lock means nothing more can be queued, so once what
+    // was taken is sent, sending is finished.
+    bool stopping_now = take_queued();
+    bool fresh = true;                // Nothing broadcast since the last swap
+    while (!done_sent) {
+        int channel = next_submission();
+        if (channel < 0) {
+            if (fresh) {
+                if (stopping_now) {
+                    finish_sending();
+                }
+                break;
+            }
+            stopping_now = take_queued();
+            fresh = true;
+            continue;
+        }
+        if (credit_exhausted()) {
+            break;
+        }
+        Channel& queue = *channels[channel];
+        broadcast_message(channel, &queue.taking[queue.taken_next++]);
+        fresh = false;
+    }
+    update_backpressure();
+}
+
+bool Process::take_queued() {
+    // Swap in the queue of every channel that has broadcast all it took
+    // before, even while others still have some left. True if a stop has
+    // been requested.
+    std::lock_guard<std::mutex> lock(submit_lock);
+    for (std::unique_ptr<Channel>& queue : channels) {
+        if (queue->taken_next == queue->taken_count && queue->submitted > 0) {
+            std::swap(queue->submissions, queue->taking);
+            queue->taken_count = queue->submitted;
+            queue->taken_next = 0;
+            submitted -= queue->submitted;
+            submitted_bytes -= queue->submitted_bytes;
+            queue->submitted = 0;
+            queue->submitted_bytes = 0;
+        }
+    }
+    return stop_requested.load(std::memory_order_relaxed);
+}
+
+int Process::next_submission() {
+    // The next channel in turn with a taken submission left, or -1
+    for (size_t k = 0; k < channels.size(); k++) {
+        size_t channel = (next_channel + k) % channels.size();
+        if (channels[channel]->taken_next < channels[channel]->taken_count) {
+            next_channel = channel + 1;
+            return (int)channel;
+        }
+    }
+    return -1;
+}
+
+void Process::update_backpressure() {
+    bool full = outbound_full() || stalled_on >= 0;
+    if (full != backpressure.load(std::memory_order_relaxed)) {
+        backpressure.store(full, std::memory_order_relaxed);
+        if (backpressure_handler) {
+            backpressure_handler(full);
+        }
+    }
+}
+
+void Process::set_ordering(OrderingMode mode) {
+    ordering_mode = mode;
+    for (std::unique_ptr<Channel>& channel : channels) {
+        channel->ordering = make_ordering(mode, id, channel->clock, channel->buffer);
+    }
+}
+
+void Process::set_channels(int count) {
+    if (count < 1 || count > MAX_CHANNELS) {
+        throw std::invalid_argument("Channels must number from 1 to " + std::to_string(MAX_CHANNELS));
+    }
+    channels.clear();
+    for (int c = 0; c < count; c++) {
+        channels.push_back(std::unique_ptr<Channel>(new Channel(num_processes)));
+    }
+    set_ordering(ordering_mode);
+}
+
+void Process::set_delivery_handler(int channel, const DeliveryHandler& handler) {
+    if (channel < 0 || channel >= (int)channels.size()) {
+        throw std::invalid_argument("No channel " + std::to_string(channel));
+    }
+    channels[channel]->handler = handler;
+}
+
+void Process::set_buffer_limit(size_t bytes) {
+    buffer_limit = bytes;
+    credit_window = bytes / std::max(1, num_processes - 1);
+    credit_step = std::max(1LL, credit_window / 4);
+}
+
+void Process::set_latency_by_sender(bool enabled) {
+    latency_by_sender = enabled;
+    network_latency.assign(enabled ? num_processes : 1, LatencyHistogram());
+    buffer_latency.assign(enabled ? num_processes : 1, LatencyHistogram());
+}
+
+void Process::setup_relay() {
+    // Our links are our parent and children in the tree, if relaying
+    if (relay.fanout() == 0) {
+        return;
+    }
+    if (io_threads > 0) {
+        throw std::runtime_error("Relaying needs the single-threaded event loop (no --io-threads)");
+    }
+    if (!journal_path.empty()) {
+        throw std::runtime_error("A journal cannot be kept while relaying");
+    }
+    relay.setup(id, num_processes, channels.size(), delta_clocks, linked);
+    links = std::count(linked.begin(), linked.end(), 1);
+    LOG(LOG_INFO) << "Process " << id << ": relaying, so flow control and reconnection are off";
+    retransmit_limit = 0;
+    credit_window = 0;
+}
+
+bool Process::credit_exhausted() {
+    // Blocked while any peer has a full window of ours undelivered; the
+    // stall is timed against the first such peer
+    if (credit_window == 0) {
+        return false;
+    }
+    if (stalled_on >= 0) {
+        return true;
+    }
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id && sent_cost - peer_acked[i].load(std::memory_order_acquire) >= credit_window) {
+            stalled_on = i;
+            stall_start = now();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Process::credit_received() {
+    // Runs on the sending thread whenever credit may have arrived
+    if (stalled_on < 0 || sent_cost - peer_acked[stalled_on].load(std::memory_order_acquire) >= credit_window) {
+        return;
+    }
+    credit_stall_ns[stalled_on].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now() - stall_start).count(), std::memory_order_relaxed);
+    stalled_on = -1;
+    
+    // Pick up where sending stopped; another peer may still block it
+    if (app_source) {
+        take_submissions();
+    } else if (!done_sent) {
+        send_due_messages();
+    }
+}
+
+void Process::report_credit(int sender, long long delivered) {
+    credit_buffer.clear();
+    encode_credit(id, delivered, credit_buffer);
+    send_to(sender, credit_buffer.data(), credit_buffer.size());
+}
+
+void Process::send_credits() {
+    // Pipelined mode: send the reports the delivery thread has posted
+    for (int i = 0; i < num_processes; i++) {
+        long long due = credit_due[i].load(std::memory_order_acquire);
+        if (due > credit_sent[i]) {
+            credit_sent[i] = due;
+            report_credit(i, due);
+        }
+    }
+}
+
+void Process::connect_to_others() {
+    // Everything, up to and including the start barrier, must be done by
+    // the deadline. Afterwards, connections only come from peers
+    // reconnecting, if that is enabled.
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds((long long)(peer_links.timeout() * 1000));
+    peer_links.connect(epoll_fd, deadline, can_reconnect());
+    mesh_time = Clock::now();
+    peer_links.await_ready(deadline);
+    resend_missing();
+}
+
+int Process::notice_count(int peer) {
+    // How many of the peer's messages we have received (more than 0 only
+    // after a reconnect or recovering a journal): those are delivered or
+    // waiting here, whatever channel they are in. The peer resends the
+    // rest, and our credit reports to it count afresh from here, less what
+    // is still to be delivered of what it will not resend.
+    delivered_cost[peer] = -undelivered_cost[peer];
+    credit_marked[peer] = 0;
+    credit_due[peer].store(0, std::memory_order_release);
+    return received_from[peer].contiguous();
+}
+
+void Process::notice_received(int peer, int count) {
+    if (count < 0 || count > messages_sent) {
+        throw std::runtime_error("Process " + std::to_string(peer) + " has received "
+                                 + std::to_string(count) + " of our messages, but we have sent "
+                                 + std::to_string(messages_sent) + " (lost journal?)");
+    }
+    resume_from[peer] = count;
+}
+
+void Process::open_journal() {
+    // Carry on from the state the journal recorded, if there is any
+    if (journal_path.empty()) {
+        return;
+    }
+    // It records deliveries by sender only, which is the whole clock of a
+    // single channel but not of several
+    if (channels.size() > 1) {
+        throw std::runtime_error("A journal cannot be kept with more than one channel");
+    }
+    Clock::time_point began = Clock::now();
+    journal.reset(new Journal(journal_path, id, num_processes));
+    const std::vector<int>& clock = journal->clock();
+    Channel& channel = *channels[0];
+    for (int j = 0; j < num_processes; j++) {
+        channel.clock[j] = clock[j];
+        if (j != id) {
+            msg_delivered[j] = clock[j];
+            received_from[j].reset(clock[j]);
+            arrived_from[j] = clock[j];
+            channel.published[j].store(clock[j], std::memory_order_relaxed);
+        }
+    }
+    msg_counter = clock[id];
+    channel.sent = clock[id];
+    messages_sent = clock[id];
+    
+    // Every peer is sent our last message again on connecting, which sets
+    // the base of our delta clocks on the link; ours must match it, and the
+    // ordering carries on from its clock
+    if (messages_sent > 0) {
+        resend_buffer.clear();
+        journal->read_sent(messages_sent - 1, resend_buffer);
+        FrameDecoder decoder;
+        memcpy(decoder.write_ptr(resend_buffer.size()), resend_buffer.data(), resend_buffer.size());
+        decoder.commit(resend_buffer.size());
+        Message last;
+        FrameType type;
+        if (decoder.next(last, type)) {
+            if (last.vector_clock.size() != channel.ordering->clock_size()) {
+                throw std::runtime_error("Journal " + journal_path + " was written with another ordering than "
+                                         + ordering_name(ordering_mode));
+            }
+            if (delta_clocks) {
+                channel.last_sent_clock = last.vector_clock;
+            }
+            channel.ordering->recovered(last);
+        }
+    }
+    recovery_ms = std::chrono::duration<double, std::milli>(Clock::now() - began).count();
+    
+    long long delivered = 0;
+    for (int count : msg_delivered) {
+        delivered += count;
+    }
+    LOG(LOG_INFO) << "Process " << id << ": journal " << journal_path << " opened in " << recovery_ms
+                  << " ms, recovering " << clock[id] << " sent and " << delivered << " delivered";
+}
+
+void Process::resend_missing() {
+    // Send each peer what it has not delivered of ours, which after a fresh
+    // start is nothing at all
+    for (int i = 0; i < num_processes; i++) {
+        if (linked[i]) {
+            resume_sending(i, resume_from[i]);
+            flush_outbound(i);
+        }
+    }
+}
+
+int Process::resume_sending(int peer, int from) {
+    // Queue our messages from `from` on, which the peer has not delivered,
+    // ahead of anything new, as full-clock frames. Our latest message always
+    // goes, even if the peer has it: the peer takes its clock as the delta
+    // base of the link and drops it as a repeat. Its credit reports now
+    // count from what it has delivered. Returns the messages resent.
+    int sent = (int)messages_sent;
+    long long unacked = 0;
+    resend_buffer.clear();
+    if (sent > 0) {
+        int first = std::min(from, sent - 1);
+        if (journal) {
+            journal->read_sent(first, resend_buffer);
+        } else if (!retransmit.read(first, resend_buffer)) {
+            throw std::runtime_error("Process " + std::to_string(peer) + " is missing our messages from "
+                                     + std::to_string(first) + " on, but only those from "
+                                     + std::to_string(retransmit.first()) + " on are kept (see --retransmit-window)");
+        }
+        unacked = first == from ? frames_cost(resend_buffer.data(), resend_buffer.size()) : 0;
+    }
+    if (done_sent) {
+        encode_done(id, messages_sent, resend_buffer);
+    }
+    outbound[peer].append(resend_buffer.data(), resend_buffer.size());
+    credit_base[peer] = sent_cost - unacked;
+    peer_acked[peer].store(credit_base[peer], std::memory_order_release);
+    if (from < sent) {
+        LOG(LOG_INFO) << "Resending messages " << from << " to " << sent - 1 << " to process " << peer;
+    }
+    return sent - from;
+}
+
+static int repeating_timer(double interval_s) {
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer < 0) {
+        throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+    }
+    long long interval_ns = std::max(1LL, (long long)(interval_s * 1e9));
+    struct itimerspec spec;
+    spec.it_value.tv_sec = spec.it_interval.tv_sec = interval_ns / 1000000000LL;
+    spec.it_value.tv_nsec = spec.it_interval.tv_nsec = interval_ns % 1000000000LL;
+    if (timerfd_settime(timer, 0, &spec, NULL) < 0) {
+        close(timer);
+        throw std::runtime_error("timerfd_settime failed: " + std::string(strerror(errno)));
+    }
+    return timer;
+}
+
+void Process::setup_reactor() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+    }
+    
+    // One-shot timers, re-armed each time they fire
+    broadcast_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    delay_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (broadcast_timer < 0 || delay_timer < 0) {
+        throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+    }
+    
+    watch_socket(epoll_fd, broadcast_timer, EPOLLIN, BROADCAST_TIMER_TAG);
+    watch_socket(epoll_fd, delay_timer, EPOLLIN, DELAY_TIMER_TAG);
+    
+    if (batch_bytes > 0) {
+        batch_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (batch_timer < 0) {
+            throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+        }
+        watch_socket(epoll_fd, batch_timer, EPOLLIN, BATCH_TIMER_TAG);
+    }
+    
+    if (announces()) {
+        announce_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (announce_timer < 0) {
+            throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+        }
+        watch_socket(epoll_fd, announce_timer, EPOLLIN, ANNOUNCE_TIMER_TAG);
+    }
+}
+
+void Process::start_periodic_timers() {
+    // Started once connected: the connect loop does not read timers, and
+    // intervals are measured from connected_time
+    if (stats_interval_s > 0) {
+        stats_timer = repeating_timer(stats_interval_s);
+        watch_socket(epoll_fd, stats_timer, EPOLLIN, STATS_TIMER_TAG);
+    }
+    if (!metrics_path.empty() && metrics_interval_s > 0) {
+        metrics_timer = repeating_timer(metrics_interval_s);
+        watch_socket(epoll_fd, metrics_timer, EPOLLIN, METRICS_TIMER_TAG);
+    }
+}
+
+void Process::register_peers() {
+    // Peer sockets are registered edge-triggered for both directions once, so
+    // no epoll_ctl is needed when queues fill up. Registering reports any data
+    // that arrived during bootstrap, so nothing is missed.
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id && connections[i] != -1) {
+            watch_socket(epoll_fd, connections[i], EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, i);
+        }
+    }
+    
+    if (journal) {
+        watch_socket(epoll_fd, journal->notify_fd(), EPOLLIN, JOURNAL_TAG);
+    }
+    
+    // Submissions made while connecting are still signalled, so they go out now
+    if (submit_fd != -1) {
+        watch_socket(epoll_fd, submit_fd, EPOLLIN, SUBMIT_TAG);
+    }
+}
+
+void Process::arm_timer(uint64_t tag, long long delay_us) {
+    if (transport) {
+        transport->arm_timer(tag, delay_us);
+        return;
+    }
+    int timer_fd = tag == BROADCAST_TIMER_TAG ? broadcast_timer
+                 : tag == BATCH_TIMER_TAG ? batch_timer
+                 : tag == ANNOUNCE_TIMER_TAG ? announce_timer : delay_timer;
+    
+    // A zero it_value would disarm the timer, so fire "immediately" at 1ns
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (delay_us <= 0) {
+        spec.it_value.tv_nsec = 1;
+    } else {
+        spec.it_value.tv_sec = delay_us / 1000000;
+        spec.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+    }
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        throw std::runtime_error("timerfd_settime failed: " + std::string(strerror(errno)));
+    }
+}
+
+Process::Clock::time_point Process::now() {
+    if (transport) {
+        return Clock::time_point(std::chrono::nanoseconds(transport->now_ns()));
+    }
+    return Clock::now();
+}
+
+int64_t Process::timestamp_ns() {
+    return transport ? transport->now_ns() : wall_clock_ns();
+}
+
+void Process::schedule_broadcast() {
+    // While waiting for credit, its arrival restarts sending
+    if (done_sent || app_source || stalled_on >= 0) {
+        return;
+    }
+    if (workload.unthrottled()) {
+        // The reactor polls unthrottled senders itself; a transport gets a
+        // timer, backing off while its links are congested
+        if (transport) {
+            arm_timer(BROADCAST_TIMER_TAG, outbound_full() ? UNTHROTTLED_BACKOFF_US : 0);
+        }
+        return;
+    }
+    if (workload.open_loop()) {
+        // Open loop: the timer targets the next scheduled send time, however
+        // late the previous sends ran. Round up: a timer that fires just
+        // short of it would find nothing due and re-arm for 0 forever.
+        long long wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            next_send - now()).count();
+        long long wait_us = (wait_ns + 999) / 1000;
+        arm_timer(BROADCAST_TIMER_TAG, wait_us);
+    } else {
+        // Closed loop: wait a random gap after each send
+        arm_timer(BROADCAST_TIMER_TAG, std::chrono::duration_cast<std::chrono::microseconds>(
+            workload.next_gap()).count());
+    }
+}
+
+void Process::send_due_messages() {
+    // The workload's messages take the channels in turn
+    Clock::time_point now = this->now();
+    
+    if (workload.unthrottled()) {
+        for (int k = 0; k < SEND_BURST && !outbound_full(); k++) {
+            if (workload.done(messages_sent, now - connected_time)) {
+                finish_sending();
+                return;
+            }
+            if (credit_exhausted()) {
+                return;
+            }
+            broadcast_message(msg_counter % channels.size());
+        }
+        schedule_broadcast();
+        return;
+    }
+    
+    if (workload.open_loop()) {
+        // Catch up on every send whose scheduled time has passed
+        while (next_send <= now) {
+            if (workload.done(messages_sent, next_send - connected_time)) {
+                finish_sending();
+                return;
+            }
+            if (credit_exhausted()) {
+                return;
+            }
+            broadcast_message(msg_counter % channels.size());
+            next_send += workload.next_gap();
+        }
+    } else {
+        if (workload.done(messages_sent, now - connected_time)) {
+            finish_sending();
+            return;
+        }
+        if (credit_exhausted()) {
+            return;
+        }
+        broadcast_message(msg_counter % channels.size());
+    }
+    
+    if (workload.done(messages_sent, now - connected_time)) {
+        finish_sending();
+    } else {
+        schedule_broadcast();
+    }
+}
+
+void Process::finish_sending() {
+    // Tell every peer how many messages to expect from us, after anything
+    // still batched
+    flush_batch();
+    send_buffer.clear();
+    encode_done(id, messages_sent, send_buffer);
+    send_to_all(send_buffer.data(), send_buffer.size());
+    done_sent = true;
+}
+
+void Process::flush_batch() {
+    if (batch_count == 0) {
+        return;
+    }
+    end_batch(batch_buffer, 0, id, batch_count);
+    send_to_all(batch_buffer.data(), batch_buffer.size());
+    batch_count = 0;
+}
+
+void Process::announce_clock() {
+    // Tell every peer how far our clock in each channel has moved, behind
+    // everything of ours already on its way, so none waits on us for lack
+    // of a message. Once our FRAME_DONE is out, peers no longer wait on us
+    // at all.
+    announce_armed.store(false);
+    if (done_sent) {
+        return;
+    }
+    announce_buffer.clear();
+    for (size_t c = 0; c < channels.size(); c++) {
+        TimestampFrame ts;
+        if (channels[c]->ordering->announcement(ts.timestamp)) {
+            ts.sender_id = id;
+            ts.channel = c;
+            ts.sent = channels[c]->sent;
+            encode_timestamp(ts, announce_buffer);
+        }
+    }
+    if (!announce_buffer.empty()) {
+        flush_batch();
+        send_to_all(announce_buffer.data(), announce_buffer.size());
+    }
+}
+
+void Process::send_to_all(const char* data, size_t len) {
+    if (transport) {
+        for (int i = 0; i < num_processes; i++) {
+            if (linked[i]) {
+                transport->send(i, data, len);
+            }
+        }
+        return;
+    }
+    
+    // With a journal, frames wait until what they carry is durable, so a
+    // peer never has a message our journal could lose
+    if (journal) {
+        held.insert(held.end(), data, data + len);
+        held_marks.push_back(std::make_pair(journal->end(), held.size()));
+        return;
+    }
+    queue_for_all(data, len);
+}
+
+void Process::release_durable() {
+    // Pass on every held frame the journal has now made durable
+    journal->check();
+    uint64_t durable = journal->durable();
+    size_t marks = 0;
+    while (marks < held_marks.size() && held_marks[marks].first <= durable) {
+        marks++;
+    }
+    if (marks == 0) {
+        return;
+    }
+    size_t bytes = held_marks[marks - 1].second;
+    queue_for_all(held.data(), bytes);
+    held.erase(held.begin(), held.begin() + bytes);
+    held_marks.erase(held_marks.begin(), held_marks.begin() + marks);
+    for (std::pair<uint64_t, size_t>& mark : held_marks) {
+        mark.second -= bytes;
+    }
+}
+
+void Process::queue_for_all(const char* data, size_t len) {
+    // Queue for all other processes and write what the sockets accept now;
+    // the rest goes out on EPOLLOUT
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id && connections[i] != -1) {
+            outbound[i].append(data, len);
+            flush_outbound(i);
+        }
+    }
+}
+
+void Process::send_to(int target_id, const char* data, size_t len) {
+    if (transport) {
+        transport->send(target_id, data, len);
+    } else if (connections[target_id] != -1) {
+        outbound[target_id].append(data, len);
+        flush_outbound(target_id);
+    }
+}
+
+bool Process::outbound_full() const {
+    if (transport) {
+        return transport->congested();
+    }
+    if (held.size() >= MAX_OUTBOUND_BYTES) {
+        return true;
+    }
+    for (int i = 0; i < num_processes; i++) {
+        if (outbound[i].pending() >= MAX_OUTBOUND_BYTES) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Process::schedule_delayed() {
+    if (delayed.empty()) {
+        return;
+    }
+    long long wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        delayed.top().due - now()).count();
+    arm_timer(DELAY_TIMER_TAG, wait_us);
+}
+
+void Process::release_delayed() {
+    Clock::time_point now = this->now();
+    while (!delayed.empty() && delayed.top().due <= now) {
+        Message msg = std::move(const_cast<DelayedMessage&>(delayed.top()).msg);
+        delayed.pop();
+        process_message(msg);
+        spare_messages.push_back(std::move(msg));
+    }
+    schedule_delayed();
+}
+
+void Process::lose_link(int peer) {
+    // The connection failed, or closed without a FRAME_CLOSE. Drop it and
+    // make it again; meanwhile the peer is sent nothing, and what it misses
+    // stays in the journal or the retransmit window. In pipelined mode the
+    // workers must be paused.
+    if (!can_reconnect()) {
+        throw std::runtime_error("Lost connection to process " + std::to_string(peer));
+    }
+    LOG(LOG_INFO) << "Lost connection to process " << peer << ", reconnecting";
+    int sock = connections[peer];
+    if (io_threads > 0) {
+        // The sender thread may have retired it already
+        sock = receive_sockets[peer];
+        receive_sockets[peer] = -1;
+        retired_sockets.erase(std::remove(retired_sockets.begin(), retired_sockets.end(), sock),
+                              retired_sockets.end());
+    }
+    if (sock != -1) {
+        close(sock);
+    }
+    connections[peer] = -1;
+    outbound[peer] = OutboundQueue();
+    peer_links.lost(peer);
+}
+
+void Process::link_broken(int peer) {
+    // The peer has connected again, so it found the link broken first
+    bool paused = pause_workers();
+    lose_link(peer);
+    if (paused) {
+        start_workers();
+    }
+}
+
+void Process::restore_link(int peer, int sock) {
+    // Both ends have said how far they got. Everything sent to the others
+    // meanwhile must be on their links before this one resumes, so the
+    // resend ends with our latest message: flush any batch and, with a
+    // journal, wait for and release what it holds.
+    bool paused = pause_workers();
+    flush_batch();
+    if (journal) {
+        journal->sync();
+        release_durable();
+    }
+    
+    // The resend puts only the channel of our latest message back in step
+    // on the new link, so every channel's next message carries its whole
+    // clock
+    for (std::unique_ptr<Channel>& channel : channels) {
+        channel->last_sent_clock.clear();
+    }
+    connections[peer] = sock;
+    peer_closed[peer].store(false);
+    decoders[peer].reset();
+    if (io_threads > 0) {
+        receive_sockets[peer] = sock;
+        watch_socket(send_epoll_fd, sock, EPOLLOUT | EPOLLET, peer);
+        sending_finished.store(false);
+    } else {
+        watch_socket(epoll_fd, sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, peer);
+    }
+    resent_messages += resume_sending(peer, resume_from[peer]);
+    reconnects++;
+    
+    // Our last credit report to it may have been lost with the old link
+    if (credit_window > 0) {
+        long long delivered = credit_marked[peer];
+        if (io_threads > 0) {
+            delivered = credit_sent[peer] = credit_due[peer].load(std::memory_order_acquire);
+        }
+        if (delivered > 0) {
+            credit_buffer.clear();
+            encode_credit(id, delivered, credit_buffer);
+            outbound[peer].append(credit_buffer.data(), credit_buffer.size());
+        }
+    }
+    if (close_sent) {
+        credit_buffer.clear();
+        encode_close(id, credit_buffer);
+        outbound[peer].append(credit_buffer.data(), credit_buffer.size());
+    }
+    flush_outbound(peer);
+    
+    // Sending may have been waiting for this peer's credit, and the peer
+    // for an announcement of our clock lost with the old link
+    credit_received();
+    if (announces()) {
+        for (std::unique_ptr<Channel>& channel : channels) {
+            channel->ordering->reannounce();
+        }
+        announce_armed.store(true);
+        arm_timer(ANNOUNCE_TIMER_TAG, 0);
+    }
+    if (paused) {
+        start_workers();
+    }
+}
+
+void Process::check_closed_links() {
+    // Pipelined mode: act on the connections receive threads saw close, once
+    // every frame read before the close has been taken
+    if (!any_closed.exchange(false)) {
+        return;
+    }
+    while (drain_inbound()) {}
+    bool paused = false;
+    for (int i = 0; i < num_processes; i++) {
+        if (!closed_seen[i].exchange(false)) {
+            continue;
+        }
+        if (peer_closed[i]) {
+            LOG(LOG_INFO) << "Connection closed by process " << i;
+            continue;
+        }
+        if (!paused) {
+            paused = pause_workers();
+        }
+        lose_link(i);
+    }
+    if (paused) {
+        start_workers();
+    }
+}
+
+void Process::send_close() {
+    // Tell every peer we have everything, so none takes our leaving for a
+    // failure; a link that is down gets it when restored
+    bool paused = pause_workers();
+    std::vector<char> frame;
+    encode_close(id, frame);
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id && connections[i] != -1) {
+            outbound[i].append(frame.data(), frame.size());
+            flush_outbound(i);
+        }
+    }
+    close_sent = true;
+    if (paused) {
+        start_workers();
+    }
+}
+
+void Process::broadcast_message(int channel_id, std::string* payload) {
+    // Create new message, reusing the clock and payload storage of the last one
+    Channel& channel = *channels[channel_id];
+    Message& msg = outgoing;
+    msg.sender_id = id;
+    msg.seq_number = msg_counter++;
+    msg.channel = channel_id;
+    msg.channel_seq = channel.sent++;
+    
+    msg.send_time_ns = timestamp_ns();
+    
+    if (io_threads > 0) {
+        // The delivery thread owns the channel's clock; stamp the counts it
+        // has published, plus our own entry counting this message
+        msg.vector_clock.resize(num_processes);
+        for (int j = 0; j < num_processes; j++) {
+            msg.vector_clock[j] = j == id ? channel.sent
+                                          : channel.published[j].load(std::memory_order_acquire);
         }
+    } else {
+        // Count this message in our own entry BEFORE creating the message
+        channel.clock[id] = channel.sent;
         
-        // Print summary
-        print_summary();
+        // Set message vector clock by copying the channel's current clock
+        msg.vector_clock = channel.clock;
     }
-    catch (const std::exception& e) {
-        std::cerr << "Error in process " << id << ": " << e.what() << std::endl;
+    channel.ordering->stamp(msg);
+    
+    // Prepare message data; a submitted payload is swapped in and its slot
+    // gets the previous message's storage
+    if (payload) {
+        std::swap(msg.data, *payload);
+    } else {
+        workload.make_payload(id, msg.seq_number, msg.data);
+    }
+    if (journal) {
+        journal->append_sent(msg);
+    } else if (retransmitting) {
+        retransmit.add(msg);
     }
     
-    // Step 3: Clean up connections
-    for (int sock : connections) {
-        if (sock != -1) {
-            close(sock);
+    // The first message in a channel, and the first since a link was made
+    // again, carries its whole clock; it is the base for the next
+    std::vector<int>* clock_base = delta_clocks && !channel.last_sent_clock.empty() ? &channel.last_sent_clock
+                                                                                    : NULL;
+    if (batch_bytes > 0) {
+        // Every peer gets the same messages, so one shared batch serves all
+        // of them; it goes out when full or when its deadline passes
+        if (batch_count == 0) {
+            batch_buffer.clear();
+            begin_batch(batch_buffer);
+            arm_timer(BATCH_TIMER_TAG, batch_delay_us);
+            message_bytes += FRAME_HEADER_SIZE;
         }
+        size_t before = batch_buffer.size();
+        encode_frame(msg, batch_buffer, clock_base);
+        message_bytes += batch_buffer.size() - before;
+        batch_count++;
+        if (batch_buffer.size() >= batch_bytes) {
+            flush_batch();
+        }
+    } else {
+        // Encode once and send the same frame to all other processes
+        send_buffer.clear();
+        encode_frame(msg, send_buffer, clock_base);
+        message_bytes += send_buffer.size();
+        send_to_all(send_buffer.data(), send_buffer.size());
     }
-    
-    if (server_socket != -1) {
-        close(server_socket);
+    if (delta_clocks && !clock_base) {
+        channel.last_sent_clock = msg.vector_clock;
     }
+    
+    sent_cost += message_cost(msg);
+    
+    // Log sent message
+    LOG_SAMPLED(LOG_EVENT) << "Sent message " << msg.channel_seq << channel_text(msg.channel)
+                           << ", VC=" << clock_text(msg.vector_clock);
+    trace_event(TRACE_SEND, msg);
+    
+    messages_sent++;
 }
 
-void Process::connect_to_others() {
-    // Set up server socket to accept connections
-    setup_server_socket();
+void Process::handle_incoming(int from_id) {
+    if (connections[from_id] == -1) {
+        return;
+    }
     
-    // Connect to processes with lower IDs
-    for (int i = 0; i < id; i++) {
-        connect_to_process(i);
+    bool open = true;
+    try {
+        open = receive_messages(from_id, connections[from_id]);
+    } catch (const std::exception& e) {
+        if (!peer_closed[from_id]) {
+            LOG(LOG_ERROR) << "Error receiving message from process " << from_id << ": " << e.what();
+        }
+        open = false;
     }
     
-    // Accept connections from processes with higher IDs
-    for (int i = id + 1; i < 4; i++) {
-        accept_connection();
+    if (open) {
+        return;
+    }
+    if (peer_closed[from_id]) {
+        LOG(LOG_INFO) << "Connection closed by process " << from_id;
+        close_connection(from_id);
+    } else {
+        lose_link(from_id);
     }
 }
 
-void Process::setup_server_socket() {
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        throw std::runtime_error("Failed to create server socket: " + std::string(strerror(errno)));
-    }
-    
-    // Allow socket reuse
-    int opt = 1;
-    if (setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        close(server_sock);
-        throw std::runtime_error("setsockopt failed: " + std::string(strerror(errno)));
+void Process::flush_outbound(int target_id) {
+    if (connections[target_id] == -1) {
+        return;
     }
-    
-    // Bind to port
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(BASE_PORT + id);
-    
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        close(server_sock);
-        throw std::runtime_error("Bind failed: " + std::string(strerror(errno)));
+    if (shm_links[target_id]) {
+        flush_shm(target_id);
+        return;
     }
     
-    // Listen for connections
-    if (listen(server_sock, 5) < 0) {
-        close(server_sock);
-        throw std::runtime_error("Listen failed: " + std::string(strerror(errno)));
+    try {
+        outbound[target_id].flush(connections[target_id], &io);
+    } catch (const std::exception& e) {
+        // The reading side decides in pipelined mode, once it sees the close
+        LOG(LOG_ERROR) << "Failed to send to process " << target_id << ": " << e.what();
+        if (io_threads > 0 || peer_closed[target_id]) {
+            close_connection(target_id);
+        } else {
+            lose_link(target_id);
+        }
     }
-    
-    server_socket = server_sock;
 }
 
-void Process::connect_to_process(int target_id) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        throw std::runtime_error("Failed to create client socket: " + std::string(strerror(errno)));
+void Process::close_connection(int target_id) {
+    if (io_threads > 0) {
+        // A receive thread may still be reading it: shut it down so that
+        // thread sees the close, and release it once the threads are joined
+        shutdown(connections[target_id], SHUT_RDWR);
+        retired_sockets.push_back(connections[target_id]);
+    } else {
+        // Closing the descriptor also removes it from the epoll set
+        close(connections[target_id]);
     }
-    
-    // Resolve hostname
-    struct hostent* host = gethostbyname(HOSTS[target_id].c_str());
-    if (!host) {
-        close(sock);
-        throw std::runtime_error("Failed to resolve hostname: " + HOSTS[target_id]);
+    connections[target_id] = -1;
+    outbound[target_id] = OutboundQueue();
+}
+
+bool Process::receive_messages(int from_id, int sock, SpscRing<Inbound>* ring) {
+    if (shm_links[from_id]) {
+        return receive_shm(from_id, sock, ring);
     }
+    FrameDecoder& decoder = decoders[from_id];
     
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(BASE_PORT + target_id);
-    memcpy(&server_addr.sin_addr, host->h_addr, host->h_length);
-    
-    // Try to connect with retries
-    int max_retries = 5;
-    for (int i = 0; i < max_retries; i++) {
-        if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) >= 0) {
-            // Send our ID to the server
-            int msg = id;
-            if (send(sock, &msg, sizeof(msg), 0) < 0) {
-                close(sock);
-                throw std::runtime_error("Failed to send ID: " + std::string(strerror(errno)));
+    // Edge-triggered: keep reading until the socket is drained, decoding
+    // every complete frame after each recv()
+    while (true) {
+        char* dst = decoder.write_ptr(RECV_BYTES);
+        ssize_t result = recv(sock, dst, decoder.write_space(), 0);
+        count(io.recv_calls);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            
-            // Connection successful
-            connections[target_id] = sock;
-            std::cout << "Connected to process " << target_id << std::endl;
-            return;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            throw std::runtime_error("Error receiving data: " + std::string(strerror(errno)));
+        } else if (result == 0) {
+            return false; // Connection closed
+        }
+        decoder.commit(result);
+        count(io.bytes_received, result);
+        if (!decode_frames(from_id, ring)) {
+            return false;
         }
-        
-        std::cerr << "Connection attempt " << (i+1) << " to process " << target_id 
-                 << " failed: " << strerror(errno) << ". Retrying..." << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(1));
     }
-    
-    close(sock);
-    throw std::runtime_error("Failed to connect to process " + std::to_string(target_id));
 }
 
-void Process::accept_connection() {
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    
-    int client_sock = accept(server_socket, (struct sockaddr*)&client_addr, &addr_len);
-    if (client_sock < 0) {
-        throw std::runtime_error("Accept failed: " + std::string(strerror(errno)));
+void Process::flush_shm(int target_id) {
+    // Copy as much as fits into the ring, waking the reader if it sleeps.
+    // The rest waits for the reader to make room and ring back; the backlog
+    // flag is set first so whichever thread takes that wakeup sees it.
+    OutboundQueue& queue = outbound[target_id];
+    ShmLink& link = *shm_links[target_id];
+    while (!queue.empty()) {
+        size_t n = link.write(queue.front(), queue.pending());
+        queue.consume(n);
+        count(io.bytes_sent, n);
+        if (n > 0 && link.reader_woken()) {
+            ring_doorbell(connections[target_id]);
+        }
+        if (!queue.empty()) {
+            link.set_backlog(true);
+            if (!link.wait_for_space()) {
+                return;
+            }
+        }
     }
-    
-    // Receive client ID
-    int client_id;
-    if (recv(client_sock, &client_id, sizeof(client_id), 0) <= 0) {
-        close(client_sock);
-        throw std::runtime_error("Failed to receive client ID");
+    link.set_backlog(false);
+}
+
+bool Process::receive_shm(int from_id, int sock, SpscRing<Inbound>* ring) {
+    // The socket only carries wakeups now, and still reports the close
+    bool open = true;
+    char bells[256];
+    while (true) {
+        ssize_t result = recv(sock, bells, sizeof(bells), 0);
+        count(io.recv_calls);
+        if (result > 0 || (result < 0 && errno == EINTR)) {
+            continue;
+        }
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        open = false;                 // Closed or reset, after what it left in the ring
+        break;
     }
     
-    if (client_id < 0 || client_id >= 4 || client_id == id) {
-        close(client_sock);
-        throw std::runtime_error("Invalid client ID: " + std::to_string(client_id));
+    // A wakeup may also mean the peer made room for our own writes
+    ShmLink& link = *shm_links[from_id];
+    if (link.has_backlog()) {
+        if (ring) {
+            uint64_t one = 1;
+            if (write(flow_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                throw std::runtime_error("Failed to signal the sender: " + std::string(strerror(errno)));
+            }
+        } else {
+            flush_outbound(from_id);
+        }
     }
     
-    connections[client_id] = client_sock;
-    std::cout << "Accepted connection from process " << client_id << std::endl;
+    // Read until the ring stays empty with the reader marked asleep
+    FrameDecoder& decoder = decoders[from_id];
+    do {
+        size_t n;
+        while ((n = link.read(decoder.write_ptr(SHM_READ_BYTES), decoder.write_space())) > 0) {
+            decoder.commit(n);
+            count(io.bytes_received, n);
+            if (link.writer_woken()) {
+                ring_doorbell(sock);
+            }
+            if (!decode_frames(from_id, ring)) {
+                return false;
+            }
+        }
+    } while (open && !link.sleep());
+    return open;
 }
 
-void Process::broadcast_message() {
-    // Create new message
-    Message msg;
-    msg.sender_id = id;
-    msg.seq_number = msg_counter++;
-    
-    // Increment own vector clock BEFORE creating the message
-    vector_clock[id]++;
-    
-    // Set message vector clock by copying our current vector clock
-    msg.vector_clock = vector_clock;
-    
-    // Prepare message data
-    std::stringstream ss;
-    ss << "Message from P" << id << " #" << msg.seq_number;
-    msg.data = ss.str();
-    
-    // Send to all other processes
-    for (int i = 0; i < 4; i++) {
-        if (i != id && connections[i] != -1) {
-            try {
-                send_message(connections[i], msg);
-            } catch (const std::exception& e) {
-                std::cerr << "Failed to send message to process " << i << ": " << e.what() << std::endl;
-            }
+void Process::ring_doorbell(int sock) {
+    // One byte on the peer's TCP connection wakes its reactor. If the socket
+    // is full it already holds wakeups, and if it has failed the receive
+    // side will see it.
+    char bell = 0;
+    send(sock, &bell, 1, MSG_NOSIGNAL);
+    count(io.send_calls);
+}
+
+void Process::retry_shm_backlog() {
+    // Pipelined mode: a receive thread saw room made in a ring we had filled
+    for (int i = 0; i < num_processes; i++) {
+        if (shm_links[i] && shm_links[i]->has_backlog()) {
+            flush_outbound(i);
         }
     }
+}
+
+bool Process::decode_frames(int from_id, SpscRing<Inbound>* ring) {
+    // Messages are decoded into one staging slot per thread, whose storage is
+    // recycled through the ring or the delivery buffer
+    static thread_local Inbound staging;
+    FrameDecoder& decoder = decoders[from_id];
     
-    // Log sent message
-    std::cout << "Sent message " << msg.seq_number << ", VC=[";
-    for (size_t i = 0; i < msg.vector_clock.size(); i++) {
-        std::cout << msg.vector_clock[i];
-        if (i < msg.vector_clock.size() - 1) {
-            std::cout << ",";
+    Message& msg = staging.msg;
+    FrameType type;
+    while (decoder.next(msg, type)) {
+        // Through a relay, messages and what their sender says of them
+        // come from anyone but ourselves
+        if ((msg.sender_id != from_id && !relay.carries(type, msg.sender_id)) || msg.channel >= (int)channels.size()
+            || (type == FRAME_MESSAGE && msg.vector_clock.size() != channels[0]->ordering->clock_size())) {
+            throw std::runtime_error("Malformed message: sender=" + std::to_string(msg.sender_id)
+                                     + ", channel=" + std::to_string(msg.channel)
+                                     + ", vc_size=" + std::to_string(msg.vector_clock.size()));
+        }
+        
+        // Credit concerns the sender thread, and a close the thread reading
+        // the link, so neither takes the ring
+        if (!ring || type == FRAME_CREDIT || type == FRAME_CLOSE) {
+            accept_frame(from_id, type, msg);
+            continue;
+        }
+        
+        // Hand the frame to the delivery thread, waiting while its ring
+        // is full; the slot's previous message comes back for reuse
+        staging.from_id = from_id;
+        staging.type = type;
+        while (!ring->try_push(staging)) {
+            if (stopping.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            wake_delivery();
+            std::this_thread::yield();
         }
     }
-    std::cout << "]" << std::endl;
-    
-    messages_sent++;
+    relay.forward(from_id, [this](int peer, const char* data, size_t len) { send_to(peer, data, len); });
+    return true;
 }
 
-void Process::handle_incoming() {
-    fd_set readfds;
-    struct timeval tv;
-    int max_fd = -1;
-    
-    // Set up file descriptor set
-    FD_ZERO(&readfds);
-    for (int sock : connections) {
-        if (sock != -1) {
-            FD_SET(sock, &readfds);
-            max_fd = std::max(max_fd, sock);
+void Process::accept_frame(int from_id, FrameType type, Message& msg) {
+    int sender = msg.sender_id;
+    if (type == FRAME_DONE) {
+        relay.add(type, msg);
+        expected_from[sender] = msg.seq_number;
+        if (arrived_from[sender] == expected_from[sender]) {
+            sender_arrived(sender);
+        }
+        return;
+    }
+    if (type == FRAME_TIMESTAMP) {
+        relay.add(type, msg);
+        TimestampFrame ts = decode_timestamp(msg);
+        Channel& channel = *channels[ts.channel];
+        if (channel.ordering->announced(sender, ts.sent, ts.timestamp)) {
+            check_buffer(channel, sender);
+        }
+        return;
+    }
+    if (type == FRAME_CLOSE) {
+        peer_closed[from_id].store(true);
+        return;
+    }
+    if (type == FRAME_CREDIT) {
+        // Reports are cumulative, so only the largest matters (a reordering
+        // link may deliver an older one last), and count from where the
+        // link last resumed. One thread reads each peer.
+        long long acked = credit_base[from_id] + decode_credit(msg).delivered_bytes;
+        if (acked > peer_acked[from_id].load(std::memory_order_relaxed)) {
+            peer_acked[from_id].store(acked, std::memory_order_release);
+        }
+        if (io_threads > 0) {
+            uint64_t one = 1;
+            if (write(flow_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                throw std::runtime_error("Failed to signal credit: " + std::string(strerror(errno)));
+            }
+        } else {
+            credit_received();
         }
+        return;
     }
     
-    if (max_fd == -1) {
-        // No valid connections
+    // A message seen before is a repeat, resent when a link resumed, and
+    // is dropped whatever path it came by. Only new ones are passed on.
+    if (!received_from[sender].insert(msg.seq_number)) {
         return;
     }
+    undelivered_cost[sender] += message_cost(msg);
+    relay.add(type, msg);
     
-    // Set timeout to non-blocking
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
+    if (use_delay) {
+        // Apply network delay by holding the message on a timer
+        // rather than sleeping, so the reactor keeps running. msg takes a
+        // recycled message's storage in exchange.
+        DelayedMessage held;
+        held.due = now() + std::chrono::milliseconds(random_int(1, 5));
+        held.msg = std::move(msg);
+        if (!spare_messages.empty()) {
+            msg = std::move(spare_messages.back());
+            spare_messages.pop_back();
+        }
+        bool earliest = delayed.empty() || held.due < delayed.top().due;
+        delayed.push(std::move(held));
+        if (earliest) {
+            schedule_delayed();
+        }
+    } else {
+        process_message(msg);
+    }
+}
+
+void Process::process_message(Message& msg) {
+    msg.recv_time_ns = timestamp_ns();
+    network_latency[latency_by_sender ? msg.sender_id : 0].record(msg.recv_time_ns - msg.send_time_ns);
+    Channel& channel = *channels[msg.channel];
+    int sender = msg.sender_id;
     
-    // Check for incoming data
-    int activity = select(max_fd + 1, &readfds, NULL, NULL, &tv);
+    // How many of ours its sender had delivered, for the metrics; with
+    // several channels a clock counts only its own
+    if (ordering_mode == ORDER_CAUSAL && channels.size() == 1) {
+        peer_view[sender] = std::max(peer_view[sender], msg.vector_clock[id]);
+    }
     
-    if (activity < 0) {
-        std::cerr << "Select error: " << strerror(errno) << std::endl;
-        return;
+    // A message can move our clock on, and peers may be waiting to hear it
+    // if we have nothing to send soon
+    bool releases = channel.ordering->arrived(msg);
+    if (announces() && !announce_armed.exchange(true)) {
+        arm_timer(ANNOUNCE_TIMER_TAG, ANNOUNCE_DELAY_US);
     }
     
-    // Process incoming messages
-    for (int i = 0; i < 4; i++) {
-        if (i != id && connections[i] != -1 && FD_ISSET(connections[i], &readfds)) {
-            Message msg;
-            bool success = false;
-            
-            try {
-                success = receive_message(connections[i], msg);
-            } catch (const std::exception& e) {
-                std::cerr << "Error receiving message from process " << i << ": " 
-                         << e.what() << std::endl;
-                continue;
-            }
-            
-            if (success) {
-                // Apply network delay if enabled
-                if (use_delay) {
-                    int delay = random_int(1, 5);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
-                }
-                
-                process_message(msg);
-            } else {
-                std::cerr << "Connection closed by process " << i << std::endl;
-                close(connections[i]);
-                connections[i] = -1;
-            }
+    // Check if message can be delivered
+    if (can_deliver(channel, msg)) {
+        deliver_message(channel, msg);
+        // Check buffer for messages that can now be delivered
+        check_buffer(channel, sender);
+    } else {
+        // Buffer the message; msg comes back holding recycled storage. A
+        // copy of one already buffered is dropped, and so is its cost, or
+        // the credit it holds would never be returned.
+        long long cost = message_cost(msg);
+        if (!channel.buffer.push(msg)) {
+            undelivered_cost[sender] -= cost;
+            return;
+        }
+        buffered_bytes += cost;
+        peak_buffer_depth = std::max(peak_buffer_depth, buffered_messages());
+        peak_buffered_bytes = std::max(peak_buffered_bytes, buffered_bytes);
+        if (releases) {
+            check_buffer(channel, sender);
+        }
+    }
+    if (++arrived_from[sender] == expected_from[sender]) {
+        sender_arrived(sender);
+    }
+}
+
+void Process::sender_arrived(int sender) {
+    // Everything the sender will send is delivered or buffered here, which
+    // can settle what an ordering was waiting to hear from it
+    for (std::unique_ptr<Channel>& channel : channels) {
+        if (channel->ordering->sender_done(sender)) {
+            check_buffer(*channel, sender);
         }
     }
 }
 
-void Process::send_message(int sock, const Message& msg) {
-    // Send sender ID
-    if (send(sock, &msg.sender_id, sizeof(msg.sender_id), 0) < 0) {
-        throw std::runtime_error("Error sending sender ID: " + std::string(strerror(errno)));
+bool Process::can_deliver(Channel& channel, const Message& msg) {
+    // Our own entry is never needed: our messages have all been sent, and
+    // in pipelined mode the sender thread, not the channel's clock, counts them
+    return channel.ordering->ready(msg);
+}
+
+
+void Process::deliver_message(Channel& channel, const Message& msg) {
+    // Move the delivered counts on (in causal order, the component-wise
+    // maximum of the clocks)
+    channel.ordering->delivered(msg);
+    if (io_threads > 0) {
+        // Only the sender's entry moves on a delivery; publish it for the
+        // sender thread's next stamp
+        channel.published[msg.sender_id].store(channel.clock[msg.sender_id], std::memory_order_release);
     }
+    undelivered_cost[msg.sender_id] -= message_cost(msg);
+    
+    // Log delivery
+    LOG_SAMPLED(LOG_EVENT) << "Delivered message " << msg.channel_seq << " from P" << msg.sender_id
+                           << channel_text(msg.channel) << ", VC=" << clock_text(msg.vector_clock);
+    trace_event(TRACE_DELIVER, msg);
     
-    // Send sequence number
-    if (send(sock, &msg.seq_number, sizeof(msg.seq_number), 0) < 0) {
-        throw std::runtime_error("Error sending sequence number: " + std::string(strerror(errno)));
+    if (journal) {
+        journal->append_delivered(msg.sender_id, msg.seq_number);
     }
     
-    // Send vector clock size
-    int vc_size = msg.vector_clock.size();
-    if (send(sock, &vc_size, sizeof(vc_size), 0) < 0) {
-        throw std::runtime_error("Error sending vector clock size: " + std::string(strerror(errno)));
+    // Update delivery statistics
+    msg_delivered[msg.sender_id]++;
+    int64_t delivered_ns = timestamp_ns();
+    buffer_latency[latency_by_sender ? msg.sender_id : 0].record(delivered_ns - msg.recv_time_ns);
+    delivery_latency.record(delivered_ns - msg.send_time_ns);
+    
+    if (msg_delivered[msg.sender_id] == expected_from[msg.sender_id]) {
+        LOG(LOG_DEBUG) << "DEBUG: Process " << id << " has received all " << msg_delivered[msg.sender_id]
+                       << " messages from P" << msg.sender_id;
     }
     
-    // Send vector clock
-    for (int vc : msg.vector_clock) {
-        if (send(sock, &vc, sizeof(vc), 0) < 0) {
-            throw std::runtime_error("Error sending vector clock element: " + std::string(strerror(errno)));
+    // Charge the delivery to its sender's window, reporting each time
+    // another step of it has been delivered. A sender whose FRAME_DONE has
+    // arrived sends nothing more and needs no credit.
+    if (credit_window > 0) {
+        int sender = msg.sender_id;
+        delivered_cost[sender] += message_cost(msg);
+        if (delivered_cost[sender] - credit_marked[sender] >= credit_step && expected_from[sender] < 0) {
+            credit_marked[sender] = delivered_cost[sender];
+            if (io_threads > 0) {
+                credit_due[sender].store(delivered_cost[sender], std::memory_order_release);
+                uint64_t one = 1;
+                if (write(flow_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                    throw std::runtime_error("Failed to signal credit: " + std::string(strerror(errno)));
+                }
+            } else {
+                report_credit(sender, delivered_cost[sender]);
+            }
         }
     }
     
-    // Send data size
-    int data_size = msg.data.size();
-    if (send(sock, &data_size, sizeof(data_size), 0) < 0) {
-        throw std::runtime_error("Error sending data size: " + std::string(strerror(errno)));
+    const DeliveryHandler& handler = channel.handler ? channel.handler : delivery_handler;
+    if (handler) {
+        Delivery view = {msg.sender_id, msg.channel_seq, msg.channel, msg.vector_clock.data(),
+                         msg.vector_clock.size(), msg.data.data(), msg.data.size()};
+        handler(view);
     }
-    
-    // Send data
-    if (send(sock, msg.data.c_str(), data_size, 0) < 0) {
-        throw std::runtime_error("Error sending data: " + std::string(strerror(errno)));
+}
+
+void Process::check_buffer(Channel& channel, int released_by) {
+    // A delivery can only unblock the head of some sender's queue in its
+    // channel, so keep sweeping the heads until a full sweep delivers
+    // nothing. The time what this releases spent waiting is put down to
+    // released_by, whose message it was waiting for.
+    DeliveryBuffer& buffer = channel.buffer;
+    bool delivered = true;
+    while (delivered && !buffer.empty()) {
+        delivered = false;
+        
+        for (int sender = 0; sender < num_processes; sender++) {
+            Message* head;
+            while ((head = buffer.head(sender)) != NULL && can_deliver(channel, *head)) {
+                buffer.pop(sender, unblocked);
+                buffered_bytes -= message_cost(unblocked);
+                held_up_ns[released_by] += timestamp_ns() - unblocked.recv_time_ns;
+                deliver_message(channel, unblocked);
+                delivered = true;
+            }
+        }
     }
 }
 
-bool Process::receive_message(int sock, Message& msg) {
-    // Receive sender ID
-    int result = recv(sock, &msg.sender_id, sizeof(msg.sender_id), 0);
-    if (result < 0) {
-        throw std::runtime_error("Error receiving sender ID: " + std::string(strerror(errno)));
-    } else if (result == 0) {
-        return false; // Connection closed
+size_t Process::buffered_messages() const {
+    size_t count = 0;
+    for (const std::unique_ptr<Channel>& channel : channels) {
+        count += channel->buffer.size();
     }
-    
-    // Receive sequence number
-    result = recv(sock, &msg.seq_number, sizeof(msg.seq_number), 0);
-    if (result <= 0) {
+    return count;
+}
+
+bool Process::all_sent() const {
+    // Check if we've sent all messages and they have left the queues
+    if (!done_sent || !held.empty()) {
         return false;
     }
-    
-    // Receive vector clock size
-    int vc_size;
-    result = recv(sock, &vc_size, sizeof(vc_size), 0);
-    if (result <= 0) {
-        return false;
+    if (transport) {
+        return transport->drained();
     }
-    
-    // Receive vector clock
-    msg.vector_clock.resize(vc_size);
-    for (int i = 0; i < vc_size; i++) {
-        result = recv(sock, &msg.vector_clock[i], sizeof(int), 0);
-        if (result <= 0) {
+    for (int i = 0; i < num_processes; i++) {
+        if (connections[i] != -1 && !outbound[i].empty()) {
             return false;
         }
     }
-    
-    // Receive data size
-    int data_size;
-    result = recv(sock, &data_size, sizeof(data_size), 0);
-    if (result <= 0) {
+    return true;
+}
+
+bool Process::is_finished() {
+    // In pipelined mode the sender thread reports this once it is done
+    if (io_threads > 0 ? !sending_finished.load(std::memory_order_acquire) : !all_sent()) {
         return false;
     }
     
-    // Receive data
-    char* buffer = new char[data_size + 1];
-    result = recv(sock, buffer, data_size, 0);
-    if (result <= 0) {
-        delete[] buffer;
-        return false;
+    // Check if we've received all messages from each process; the count is
+    // only known once its FRAME_DONE has arrived
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id && (expected_from[i] < 0 || msg_delivered[i] < expected_from[i])) {
+            return false;
+        }
     }
     
-    buffer[data_size] = '\0';
-    msg.data = std::string(buffer);
-    delete[] buffer;
-    
+    // Over our own links, what we sent may yet be lost with a connection
+    // and need resending, so stay until every peer says it has everything
+    if (!transport) {
+        if (!close_sent) {
+            send_close();
+        }
+        for (int i = 0; i < num_processes; i++) {
+            if (linked[i] && !peer_closed[i].load()) {
+                return false;
+            }
+        }
+    }
     return true;
 }
 
-void Process::process_message(const Message& msg) {
-    // Check if message can be delivered
-    if (can_deliver(msg)) {
-        deliver_message(msg);
-        // Check buffer for messages that can now be delivered
-        check_buffer();
-    } else {
-        // Buffer the message
-        buffer.push(msg);
+void Process::trace_event(int kind, const Message& msg) {
+    if (!Logger::instance().tracing()) {
+        return;
     }
+    
+    // Record header and clock in one contiguous buffer; sends and deliveries
+    // may be traced from different threads
+    static thread_local std::vector<char> trace_buffer;
+    trace_buffer.resize(sizeof(TraceRecord) + msg.vector_clock.size() * sizeof(int32_t));
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = kind;
+    record.channel = msg.channel;
+    record.sender_id = msg.sender_id;
+    record.seq_number = msg.channel_seq;
+    record.vc_size = msg.vector_clock.size();
+    memcpy(&trace_buffer[0], &record, sizeof(record));
+    memcpy(&trace_buffer[sizeof(record)], msg.vector_clock.data(), msg.vector_clock.size() * sizeof(int32_t));
+    Logger::instance().trace(trace_buffer.data(), trace_buffer.size());
 }
 
-bool Process::can_deliver(const Message& msg) {
-    // Check if all events that this message depends on have been delivered
-    // For each process j ≠ sender
-    for (int j = 0; j < 4; j++) {
-        if (j != msg.sender_id) {
-            // If message's vector clock shows events we haven't seen yet
-            if (msg.vector_clock[j] > vector_clock[j]) {
-                return false;
+void Process::print_debug_state() {
+    {
+        LogLine status;
+        status << "Process " << id << " checking termination: sent=" << messages_sent;
+        for (int i = 0; i < num_processes; i++) {
+            if (i != id) {
+                status << ", delivered from P" << i << "=" << msg_delivered[i];
             }
         }
     }
     
-    // For the sender, we check if this is the next message we expect
-    // The sender's entry in the message vector clock should be exactly 
-    // one more than our current clock for that sender
-    return msg.vector_clock[msg.sender_id] == vector_clock[msg.sender_id] + 1;
+    // Print buffer contents if there are items in it
+    size_t buffered = buffered_messages();
+    if (buffered > 0) {
+        LOG(LOG_DEBUG) << "DEBUG: Process " << id << " has " << buffered
+                       << " messages in buffer";
+        
+        // Display up to 5 messages from the buffers, lowest sequence first
+        int count = 0;
+        for (size_t c = 0; c < channels.size() && count < 5; c++) {
+            const DeliveryBuffer& buffer = channels[c]->buffer;
+            for (int sender = 0; sender < buffer.num_senders() && count < 5; sender++) {
+                std::vector<const Message*> queue = buffer.from(sender);
+                for (size_t k = 0; k < queue.size() && count < 5; k++) {
+                    const Message& msg = *queue[k];
+                    LogLine() << "  Buffer[" << count << "]: From P" << msg.sender_id
+                              << ", seq=" << msg.channel_seq << channel_text(msg.channel)
+                              << ", VC=" << clock_text(msg.vector_clock);
+                    count++;
+                }
+            }
+        }
+        
+        if (buffered > (size_t)count) {
+            LOG(LOG_DEBUG) << "  ... and " << buffered - count << " more messages";
+        }
+    }
 }
 
-
-void Process::deliver_message(const Message& msg) {
-    // Update vector clock - take component-wise maximum
-    for (int i = 0; i < 4; i++) {
-        vector_clock[i] = std::max(vector_clock[i], msg.vector_clock[i]);
-    }
-    
-    // Log delivery
-    std::cout << "Delivered message " << msg.seq_number << " from P" << msg.sender_id 
-              << ", VC=[";
-    for (size_t i = 0; i < msg.vector_clock.size(); i++) {
-        std::cout << msg.vector_clock[i];
-        if (i < msg.vector_clock.size() - 1) {
-            std::cout << ",";
+void Process::print_summary() {
+    LOG(LOG_INFO) << "======= SUMMARY =======";
+    LOG(LOG_INFO) << "Process " << id << " final state:";
+    LOG(LOG_INFO) << "Messages sent: " << messages_sent;
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id) {
+            LOG(LOG_INFO) << "Messages delivered from P" << i << ": " << msg_delivered[i];
         }
     }
-    std::cout << "]" << std::endl;
     
-    // Update delivery statistics
-    msg_delivered[msg.sender_id]++;
+    // Setup covers listen, connects and accepts; throughput is measured over
+    // the broadcast phase only
+    double setup_ms = std::chrono::duration<double, std::milli>(connected_time - start_time).count();
+    double barrier_ms = std::chrono::duration<double, std::milli>(connected_time - mesh_time).count();
+    double run_s = std::chrono::duration<double>(finish_time - connected_time).count();
+    long long total_delivered = 0;
+    for (int count : msg_delivered) {
+        total_delivered += count;
+    }
+    LOG(LOG_INFO) << "Setup time: " << setup_ms << " ms (start barrier " << barrier_ms << " ms)";
+    LOG(LOG_INFO) << "Delivery throughput: " << (run_s > 0 ? total_delivered / run_s : 0) << " msg/s";
+    LOG(LOG_INFO) << "Peak buffer depth: " << peak_buffer_depth << " (" << peak_buffered_bytes << " bytes)";
+    LOG(LOG_INFO) << "Ordering: " << ordering_name(ordering_mode);
+    if (channels.size() > 1) {
+        LOG(LOG_INFO) << "Channels: " << channels.size();
+    }
+    LOG(LOG_INFO) << "Wire bytes per message: " << (messages_sent > 0 ? (double)message_bytes / messages_sent : 0)
+                  << " (" << (delta_clocks ? "delta" : "full") << " clocks)";
+    if (journal) {
+        LOG(LOG_INFO) << "Journal: " << journal->end() / 1048576.0 << " MB in " << journal->syncs()
+                      << " syncs, opened in " << recovery_ms << " ms";
+    }
+    if (reconnects > 0) {
+        LOG(LOG_INFO) << "Reconnects: " << reconnects << ", " << resent_messages << " messages resent";
+    }
+    if (relay.fanout() > 0) {
+        LOG(LOG_INFO) << "Relay tree: fanout " << relay.fanout() << ", neighbours " << links << ", "
+                      << relay.messages_relayed() << " messages relayed (" << relay.bytes_relayed()
+                      << " wire bytes)";
+    }
+    print_latency();
+    print_held_up();
+    LOG(LOG_INFO) << "======================";
+}
+
+void Process::print_stats() {
+    // Interval throughput plus cumulative latency so far
+    Clock::time_point now = this->now();
+    long long total_delivered = 0;
+    for (int count : msg_delivered) {
+        total_delivered += count;
+    }
+    double interval_s = std::chrono::duration<double>(now - last_stats_time).count();
     
-    if (debug_mode && msg_delivered[msg.sender_id] == 99) {
-        std::cout << "DEBUG: Process " << id << " has received message 99 from P" 
-                  << msg.sender_id << std::endl;
+    LOG(LOG_INFO) << "STATS: Process " << id << " sent=" << messages_sent
+                  << ", delivered=" << total_delivered
+                  << ", throughput=" << (interval_s > 0 ? (total_delivered - last_stats_delivered) / interval_s : 0)
+                  << " msg/s, buffer=" << buffered_messages()
+                  << ", peak buffer=" << peak_buffer_depth;
+    print_latency();
+    print_held_up();
+    if (debug_mode) {
+        print_debug_state();
     }
+    
+    last_stats_time = now;
+    last_stats_delivered = total_delivered;
 }
 
-void Process::check_buffer() {
-    bool delivered = true;
-    while (delivered && !buffer.empty()) {
-        delivered = false;
-        
-        // Create a temporary buffer
-        std::queue<Message> temp_buffer;
-        
-        // Process all messages in buffer
-        while (!buffer.empty()) {
-            Message msg = buffer.front();
-            buffer.pop();
-            
-            if (can_deliver(msg)) {
-                deliver_message(msg);
-                delivered = true;
-            } else {
-                temp_buffer.push(msg);
+void Process::print_latency() {
+    // send->recv is the network (and simulated delay, and any relays on the
+    // way); recv->deliver is the time spent waiting in the causal buffer;
+    // send->deliver is both, over every sender
+    const char* names[] = {"send->recv", "recv->deliver", "send->deliver"};
+    std::vector<LatencyHistogram> end_to_end(1, delivery_latency);
+    const std::vector<LatencyHistogram>* histograms[] = {&network_latency, &buffer_latency, &end_to_end};
+    
+    LOG(LOG_INFO) << "Latency (us)     sender      count      p50      p99     p999      max";
+    for (int h = 0; h < 3; h++) {
+        bool by_sender = h < 2 && latency_by_sender;
+        for (size_t i = 0; i < histograms[h]->size(); i++) {
+            const LatencyHistogram& hist = (*histograms[h])[i];
+            if ((by_sender && (int)i == id) || hist.count() == 0) {
+                continue;
             }
+            char line[160];
+            snprintf(line, sizeof(line), "%-16s %6s %10llu %8.1f %8.1f %8.1f %8.1f",
+                     names[h], by_sender ? ("P" + std::to_string(i)).c_str() : "all", (unsigned long long)hist.count(),
+                     hist.percentile(50) / 1e3, hist.percentile(99) / 1e3,
+                     hist.percentile(99.9) / 1e3, hist.max() / 1e3);
+            LOG(LOG_INFO) << line;
         }
-        
-        // Update buffer with remaining messages
-        buffer = temp_buffer;
     }
 }
 
-bool Process::is_finished() {
-    if (debug_mode) {
-        std::cout << "Process " << id << " checking termination: sent=" << messages_sent;
-        for (int i = 0; i < 4; i++) {
-            if (i != id) {
-                std::cout << ", delivered from P" << i << "=" << msg_delivered[i];
-            }
+void Process::print_held_up() {
+    // How long each peer held things up: buffered messages that waited for
+    // one of its messages, and our own sending while it owed us credit
+    LOG(LOG_INFO) << "Held up (ms)       peer   delivery    sending";
+    for (int i = 0; i < num_processes; i++) {
+        if (i == id) {
+            continue;
         }
-        std::cout << std::endl;
-        
-        // Print buffer contents if there are items in it
-        if (!buffer.empty()) {
-            std::cout << "DEBUG: Process " << id << " has " << buffer.size() 
-                      << " messages in buffer" << std::endl;
-            
-            // Create a copy of the buffer to inspect
-            std::queue<Message> temp_buffer = buffer;
-            int count = 0;
-            
-            // Display up to 5 messages from the buffer
-            while (!temp_buffer.empty() && count < 5) {
-                Message msg = temp_buffer.front();
-                temp_buffer.pop();
-                
-                std::cout << "  Buffer[" << count << "]: From P" << msg.sender_id 
-                          << ", seq=" << msg.seq_number << ", VC=[";
-                for (size_t i = 0; i < msg.vector_clock.size(); i++) {
-                    std::cout << msg.vector_clock[i];
-                    if (i < msg.vector_clock.size() - 1) {
-                        std::cout << ",";
-                    }
-                }
-                std::cout << "]" << std::endl;
-                
-                count++;
-            }
-            
-            if (temp_buffer.size() > 0) {
-                std::cout << "  ... and " << temp_buffer.size() << " more messages" << std::endl;
+        char line[160];
+        snprintf(line, sizeof(line), "%-16s %6s %10.1f %10.1f", "", ("P" + std::to_string(i)).c_str(),
+                 held_up_ns[i] / 1e6, credit_stall_ns[i].load(std::memory_order_relaxed) / 1e6);
+        LOG(LOG_INFO) << line;
+    }
+}
+
+void Process::write_metrics() {
+    // Runs on the delivery thread, which owns everything read here except
+    // the atomics. Rates cover the time since the previous write.
+    Clock::time_point now = this->now();
+    double interval_s = std::chrono::duration<double>(now - last_metrics_time).count();
+    long long sent = messages_sent.load(std::memory_order_relaxed);
+    long long delivered = messages_delivered();
+    
+    // Age of the longest-waiting buffered message; each sender's head is the
+    // earliest of its messages to arrive unless the link reordered them
+    int64_t oldest_ns = 0;
+    int64_t timestamp = timestamp_ns();
+    for (std::unique_ptr<Channel>& channel : channels) {
+        for (int i = 0; i < num_processes; i++) {
+            const Message* head = channel->buffer.head(i);
+            if (head) {
+                oldest_ns = std::max(oldest_ns, timestamp - head->recv_time_ns);
             }
         }
     }
     
-    // Check if we've sent all messages
-    if (messages_sent < 100) {
-        return false;
+    metrics.clear();
+    metrics.family("causal_messages_sent_total", "counter", "Messages this node has broadcast");
+    metrics.sample("causal_messages_sent_total", sent);
+    metrics.family("causal_messages_delivered_total", "counter", "Messages delivered here, by sender");
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id) {
+            metrics.sample("causal_messages_delivered_total", "sender", i, msg_delivered[i]);
+        }
     }
+    metrics.family("causal_sent_per_second", "gauge", "Broadcast rate since the previous write");
+    metrics.sample("causal_sent_per_second", interval_s > 0 ? (sent - last_metrics_sent) / interval_s : 0);
+    metrics.family("causal_delivered_per_second", "gauge", "Delivery rate since the previous write");
+    metrics.sample("causal_delivered_per_second",
+                   interval_s > 0 ? (delivered - last_metrics_delivered) / interval_s : 0);
     
-    // Check if we've received all messages from each process
-    for (int i = 0; i < 4; i++) {
-        if (i != id && msg_delivered[i] < 100) {
-            return false;
+    metrics.family("causal_buffer_messages", "gauge", "Messages waiting in the causal buffer");
+    metrics.sample("causal_buffer_messages", buffered_messages());
+    metrics.family("causal_buffer_bytes", "gauge", "Size of the messages in the causal buffer");
+    metrics.sample("causal_buffer_bytes", buffered_bytes);
+    metrics.family("causal_buffer_oldest_seconds", "gauge", "How long the oldest buffered message has waited");
+    metrics.sample("causal_buffer_oldest_seconds", oldest_ns / 1e9);
+    
+    metrics.family("causal_wire_bytes_total", "counter", "Bytes written to and read from peer sockets");
+    metrics.sample("causal_wire_bytes_total", "direction", "sent", io.bytes_sent.load(std::memory_order_relaxed));
+    metrics.sample("causal_wire_bytes_total", "direction", "received",
+                   io.bytes_received.load(std::memory_order_relaxed));
+    metrics.family("causal_syscalls_total", "counter", "send, recv and epoll_wait calls on every thread");
+    metrics.sample("causal_syscalls_total", "call", "send", io.send_calls.load(std::memory_order_relaxed));
+    metrics.sample("causal_syscalls_total", "call", "recv", io.recv_calls.load(std::memory_order_relaxed));
+    metrics.sample("causal_syscalls_total", "call", "epoll_wait", io.epoll_waits.load(std::memory_order_relaxed));
+    
+    // Clock lag in both directions: our entry against the peer's view of
+    // it, and the peer's entry as sent against ours as delivered
+    metrics.family("causal_peer_lag_messages", "gauge",
+                   "Our messages the peer had not delivered when it last sent");
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id) {
+            metrics.sample("causal_peer_lag_messages", "peer", i, sent - peer_view[i]);
+        }
+    }
+    metrics.family("causal_local_lag_messages", "gauge", "Messages received from the peer but not yet delivered");
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id) {
+            metrics.sample("causal_local_lag_messages", "peer", i, received_from[i].contiguous() - msg_delivered[i]);
         }
     }
     
-    return true;
-}
-
-void Process::print_summary() {
-    std::cout << "======= SUMMARY =======" << std::endl;
-    std::cout << "Process " << id << " final state:" << std::endl;
-    std::cout << "Messages sent: " << messages_sent << std::endl;
-    for (int i = 0; i < 4; i++) {
+    metrics.family("causal_buffer_wait_seconds_total", "counter",
+                   "Time buffered messages waited for the peer's messages");
+    for (int i = 0; i < num_processes; i++) {
+        if (i != id) {
+            metrics.sample("causal_buffer_wait_seconds_total", "peer", i, held_up_ns[i] / 1e9);
+        }
+    }
+    metrics.family("causal_credit_stall_seconds_total", "counter", "Time our sending waited for the peer's credit");
+    for (int i = 0; i < num_processes; i++) {
         if (i != id) {
-            std::cout << "Messages delivered from P" << i << ": " << msg_delivered[i] << std::endl;
+            metrics.sample("causal_credit_stall_seconds_total", "peer", i,
+                           credit_stall_ns[i].load(std::memory_order_relaxed) / 1e9);
         }
     }
-    std::cout << "======================" << std::endl;
+    metrics.family("causal_reconnects_total", "counter", "Connections to peers made again after being lost");
+    metrics.sample("causal_reconnects_total", reconnects);
+    metrics.family("causal_resent_messages_total", "counter", "Our messages sent again to peers that reconnected");
+    metrics.sample("causal_resent_messages_total", resent_messages);
+    if (journal) {
+        metrics.family("causal_journal_bytes", "gauge", "Size of the journal's records");
+        metrics.sample("causal_journal_bytes", journal->end());
+        metrics.family("causal_journal_syncs_total", "counter", "fdatasync calls, each committing a group of records");
+        metrics.sample("causal_journal_syncs_total", journal->syncs());
+    }
+    
+    if (!metrics.write_file(metrics_path)) {
+        LOG(LOG_ERROR) << "Cannot write metrics to " << metrics_path << ": " << strerror(errno);
+    }
+    last_metrics_time = now;
+    last_metrics_sent = sent;
+    last_metrics_delivered = delivered;
 }
 
 int Process::random_int(int min, int max) {
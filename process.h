@@ -2,51 +2,364 @@
 #include <vector>
 #include <queue>
 #include <string>
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include "message.h"
+#include "wire.h"
+#include "config.h"
+#include "delivery_buffer.h"
+#include "workload.h"
+#include "latency.h"
+#include "spsc_ring.h"
+#include "transport.h"
+#include "vector_clock.h"
+#include "metrics.h"
+#include "shm_link.h"
+#include "journal.h"
+#include "retransmit_window.h"
+#include "received_set.h"
+#include "ordering.h"
+#include "relay.h"
+#include "peer_link.h"
 
-// Message structure with vector clock for causal ordering
-struct Message {
-    int sender_id;
-    int seq_number;
-    std::vector<int> vector_clock;
-    std::string data;
-};
+// Library callbacks: each delivery, and changes in outbound backpressure
+typedef std::function<void(const Delivery&)> DeliveryHandler;
+typedef std::function<void(bool congested)> BackpressureHandler;
 
 class Process {
 private:
-    int id;                           // Process ID (0-3)
+    typedef std::chrono::steady_clock Clock;
+
+    // A received message held back to simulate network delay
+    struct DelayedMessage {
+        Clock::time_point due;
+        Message msg;
+        bool operator>(const DelayedMessage& other) const { return due > other.due; }
+    };
+    
+    // A decoded frame passed from a receive thread to the delivery thread
+    struct Inbound {
+        int from_id;
+        FrameType type;
+        Message msg;
+    };
+    
+    // One broadcast group. Channels share the links, and our sequence
+    // numbers, which links, flow control and resending go by; each delivers
+    // its own messages in its own order, so one never waits on another.
+    struct Channel {
+        std::vector<int> clock;       // Delivered count per sender, ours = sent: the vector clock in causal order
+        DeliveryBuffer buffer;        // Messages waiting for delivery
+        std::unique_ptr<Ordering> ordering; // Delivery rule over clock and buffer
+        std::vector<std::atomic<int> > published; // Pipelined mode: clock as delivered, read by the sender thread
+        DeliveryHandler handler;      // Empty = the process's delivery handler
+        int sent;                     // Our messages in it (sending thread)
+        std::vector<int> last_sent_clock; // Clock of our last message in it, the delta base on every link;
+                                          // empty = send the next one with a full clock
+        std::vector<std::string> submissions; // Payloads waiting to be broadcast; slots are reused
+        size_t submitted;             // Slots of submissions in use
+        size_t submitted_bytes;
+        std::vector<std::string> taking; // Submissions being broadcast by the sending thread
+        size_t taken_count;           // Slots of taking filled by the last swap
+        size_t taken_next;            // Next of them to broadcast; the rest wait for credit
+        explicit Channel(int num_processes) :
+            clock(num_processes, 0),
+            buffer(num_processes),
+            published(num_processes),
+            sent(0),
+            submitted(0),
+            submitted_bytes(0),
+            taken_count(0),
+            taken_next(0) {}
+    };
+
+    Transport* transport = NULL;      // External clock, timers and links; NULL = own TCP reactor
+    int id;                           // Process ID (0..N-1)
+    int num_processes;                // Cluster size N
+    ClusterConfig cluster;            // Host and port of every process
+    Workload workload;                // Send schedule and payloads
     std::vector<int> connections;     // Socket connections to other processes
-    int server_socket = -1;           // Server socket for accepting connections
-    std::vector<int> vector_clock;    // Vector clock for causal ordering
-    std::queue<Message> buffer;       // Message buffer for out-of-order messages
-    int msg_counter;                  // Counter for local messages
+    std::vector<FrameDecoder> decoders; // Per-connection receive reassembly buffers
+    std::vector<OutboundQueue> outbound; // Per-connection queued outgoing frames
+    std::vector<std::unique_ptr<ShmLink> > shm_links; // Per peer; NULL where frames go over TCP
+    std::vector<char> send_buffer;    // Encoded frame reused across broadcasts
+    Message outgoing;                 // Message being broadcast, storage reused across broadcasts
+    Message unblocked;                // Message popped from the delivery buffer, likewise reused
+    std::vector<Message> spare_messages; // Recycled storage for messages entering the delay queue
+    int epoll_fd = -1;                // Reactor for all peer sockets and timers
+    int broadcast_timer = -1;         // timerfd scheduling the next broadcast
+    int delay_timer = -1;             // timerfd releasing delayed messages
+    int stats_timer = -1;             // timerfd for periodic statistics
+    double stats_interval_s = 10;     // Period of the statistics report, 0 = off
+    int batch_timer = -1;             // timerfd for the batch flush deadline
+    size_t batch_bytes = 0;           // Flush a batch at this size, 0 = batching off
+    long long batch_delay_us = 200;   // Flush a batch this long after its first message
+    std::vector<char> batch_buffer;   // FRAME_BATCH being filled
+    int batch_count = 0;              // Messages in batch_buffer
+    bool delta_clocks = true;         // Send only clock entries changed since our last message
+    int io_threads = 0;               // Receive threads in pipelined mode, 0 = single reactor thread
+    std::vector<std::unique_ptr<SpscRing<Inbound> > > inbound; // One per receive thread, drained by delivery
+    std::vector<std::thread> workers; // Receive threads and the sender thread
+    std::vector<int> receive_sockets; // Peer sockets as of startup, read by the receive threads
+    std::vector<int> retired_sockets; // Shut down by the sender thread, closed after the join
+    int send_epoll_fd = -1;           // Sender thread's reactor
+    int wake_fd = -1;                 // eventfd waking the delivery thread
+    int stop_fd = -1;                 // eventfd telling the workers to exit
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> worker_failed{false};
+    std::atomic<bool> sending_finished{false}; // FRAME_DONE queued and every queue drained
+    bool app_source = false;          // Broadcasts come from submit() instead of the workload
+    DeliveryHandler delivery_handler; // Called on the delivering thread for every delivery without its own
+    BackpressureHandler backpressure_handler; // Called on the sending thread when congestion changes
+    int submit_fd = -1;               // eventfd signalling new submissions or a stop request
+    std::mutex submit_lock;           // Guards the submission queue and stop_requested
+    size_t submitted = 0;             // Submissions queued on every channel
+    size_t submitted_bytes = 0;
+    size_t next_channel = 0;          // Channel whose turn it is to broadcast a submission
+    std::atomic<bool> stop_requested{false};
+    std::atomic<bool> backpressure{false}; // Outbound queues full; submit() refuses
+    bool failed = false;              // run() ended on an error
+    // Credit-based flow control. Each peer reports, in FRAME_CREDIT, how much
+    // of our traffic (by message_cost) it has delivered; we stop sending while
+    // any peer is a full window behind, so no peer buffers more than a window
+    // from us. Sizes are in bytes; a window of 0 turns flow control off.
+    size_t buffer_limit = 0;          // Causal buffer ceiling, split into one window per sender
+    long long credit_window = 0;
+    long long credit_step = 0;        // Delivered bytes between credit reports
+    long long sent_cost = 0;          // Our messages so far (sending thread)
+    std::vector<std::atomic<long long> > peer_acked; // Per peer: our bytes it has delivered
+    int stalled_on = -1;              // Peer whose credit we are waiting for, or -1 (sending thread)
+    Clock::time_point stall_start;
+    std::vector<std::atomic<long long> > credit_stall_ns; // Per peer: time our sending waited on it
+    std::vector<long long> delivered_cost; // Per sender: its bytes delivered here (delivery thread)
+    std::vector<long long> undelivered_cost; // Per sender: its bytes received but not yet delivered
+    std::vector<long long> credit_marked;  // Per sender: delivered_cost at the last report
+    std::vector<std::atomic<long long> > credit_due; // Pipelined mode: reports for the sender thread
+    std::vector<long long> credit_sent;    // Pipelined mode: reports sent (sender thread)
+    std::vector<char> credit_buffer;  // Encoded FRAME_CREDIT
+    int flow_fd = -1;                 // Pipelined mode: eventfd waking the sender thread for credit
+    size_t buffered_bytes = 0;        // message_cost of everything in the causal buffer
+    size_t peak_buffered_bytes = 0;
+    std::vector<long long> held_up_ns; // Per peer: buffered wait released by its messages
+    // Metrics file: rewritten from the delivery thread on its own timer, from
+    // state that thread owns plus relaxed atomic counters
+    IoCounters io;                    // System calls and wire bytes, from every thread
+    std::string metrics_path;         // Prometheus text file, empty = off
+    double metrics_interval_s = 1;
+    int metrics_timer = -1;
+    MetricsText metrics;
+    Clock::time_point last_metrics_time;
+    long long last_metrics_sent = 0;
+    long long last_metrics_delivered = 0;
+    std::vector<ReceivedSet> received_from; // Per sender: sequence numbers received
+    std::vector<int> arrived_from;    // Per sender: messages delivered or buffered, past any delay
+    std::vector<int> peer_view;       // Per peer: our entry in the clock of its latest message
+    // Journal: our sends and deliveries, durable before our frames leave
+    std::string journal_path;         // Empty = no journal
+    std::unique_ptr<Journal> journal;
+    double recovery_ms = 0;           // Time to open and recover the journal
+    std::vector<char> held;           // Frames for every peer awaiting journal durability
+    std::vector<std::pair<uint64_t, size_t> > held_marks; // (journal position, end of its frames in held)
+    std::vector<int> resume_from;     // Per peer: our messages it had received, as of its last notice
+    std::vector<char> resend_buffer;  // Our frames a peer is missing
+    // Reconnection: a connection that fails, or closes without a FRAME_CLOSE,
+    // is made again by peer_links, and each end resends what the other has
+    // not delivered. Runs on the delivery thread, with the pipeline threads
+    // paused while a link is dropped or restored.
+    long long retransmit_limit = -1;  // Bytes of recent messages kept, -1 = automatic
+    RetransmitWindow retransmit;      // Our recent messages, when there is no journal
+    bool retransmitting = false;
+    bool close_sent = false;          // Our FRAME_CLOSE has gone to every peer
+    std::vector<std::atomic<bool> > peer_closed; // Per peer: its FRAME_CLOSE arrived (set by the thread reading it)
+    std::vector<std::atomic<bool> > closed_seen; // Pipelined mode: a receive thread saw the close
+    std::atomic<bool> any_closed{false};
+    std::vector<long long> credit_base; // Per peer: sent_cost its credit reports count from
+    long long reconnects = 0;
+    long long resent_messages = 0;
+    RelayTree relay;                  // Links and forwarding in a spanning tree, if it has a fanout
+    std::vector<char> linked;         // Per peer: we have a link to it
+    int links = 0;
+    PeerLinks peer_links;             // Making connections, and making lost ones again
+    int pipeline_threads = 0;
+    std::atomic<int> workers_running{0};
+    long long message_bytes = 0;      // Encoded size of our messages, counted once per broadcast
+    OrderingMode ordering_mode = ORDER_CAUSAL;
+    std::vector<std::unique_ptr<Channel> > channels; // Fixed before run()
+    int announce_timer = -1;          // timerfd for announcing our clocks (total order)
+    std::atomic<bool> announce_armed{false};
+    std::vector<char> announce_buffer; // Encoded FRAME_TIMESTAMP
+    std::priority_queue<DelayedMessage, std::vector<DelayedMessage>,
+                        std::greater<DelayedMessage> > delayed; // Messages in simulated transit
+    int msg_counter;                  // Counter for local messages, in every channel
     std::vector<int> msg_delivered;   // Count of messages delivered from each process
-    int messages_sent;                // Count of messages sent
+    bool latency_by_sender = true;    // Else one histogram for all senders
+    std::vector<LatencyHistogram> network_latency; // Per sender: send -> receive
+    std::vector<LatencyHistogram> buffer_latency;  // Per sender: receive -> causal delivery
+    LatencyHistogram delivery_latency; // All senders: send -> delivery
+    size_t peak_buffer_depth;         // Most messages ever waiting in buffer
+    Clock::time_point last_stats_time; // Previous periodic report
+    long long last_stats_delivered = 0;
+    std::vector<long long> expected_from; // Messages each process sent, -1 until its FRAME_DONE
+    std::atomic<long long> messages_sent; // Count of messages sent
+    bool done_sent;                   // Our FRAME_DONE has been queued
+    Clock::time_point next_send;      // Scheduled time of the next open-loop send
     bool use_delay;                   // Flag for simulating network delay
     bool debug_mode;  // Add this new member for debug modes
+    Clock::time_point start_time;     // Process start, before any connection
+    Clock::time_point mesh_time;      // Our own connections established
+    Clock::time_point connected_time; // Every process connected: the start barrier passed
+    Clock::time_point finish_time;    // Every message sent and delivered
     
     // Connection setup
-    void setup_server_socket();
-    void connect_to_process(int target_id);
-    void accept_connection();
+    int notice_count(int peer);
+    void notice_received(int peer, int count);
+    void open_journal();
+    void resend_missing();
+    int resume_sending(int peer, int from);
+    void release_durable();
+    void setup_relay();
+    
+    // Reconnection
+    bool can_reconnect() const { return journal || retransmitting; }
+    void lose_link(int peer);
+    void link_broken(int peer);
+    void restore_link(int peer, int sock);
+    void check_closed_links();
+    void send_close();
+    
+    // Event loop
+    void setup_reactor();
+    void start_periodic_timers();
+    void register_peers();
+    void arm_timer(uint64_t tag, long long delay_us);
+    Clock::time_point now();
+    int64_t timestamp_ns();
+    void run_reactor();
+    void schedule_broadcast();
+    void send_due_messages();
+    void finish_sending();
+    void flush_batch();
+    void send_to_all(const char* data, size_t len);
+    void queue_for_all(const char* data, size_t len);
+    bool outbound_full() const;
+    void schedule_delayed();
+    void release_delayed();
+    void flush_outbound(int target_id);
+    void close_connection(int target_id);
+    bool all_sent() const;
+    void take_submissions();
+    bool take_queued();
+    int next_submission();
+    void update_backpressure();
+    
+    // Flow control
+    bool credit_exhausted();
+    void credit_received();
+    void report_credit(int sender, long long delivered);
+    void send_credits();
+    void send_to(int target_id, const char* data, size_t len);
+    
+    // Pipelined mode: receive threads decode, the sender thread broadcasts,
+    // and the calling thread alone delivers
+    void run_pipeline();
+    void setup_pipeline(int threads);
+    void receive_loop(int worker, int threads);
+    void send_loop();
+    bool drain_inbound();
+    void wake_delivery();
+    void stop_workers();
+    void start_workers();
+    bool pause_workers();
     
     // Message handling
-    void send_message(int sock, const Message& msg);
-    bool receive_message(int sock, Message& msg);
-    void process_message(const Message& msg);
-    bool can_deliver(const Message& msg);
-    void deliver_message(const Message& msg);
-    void check_buffer();
+    bool receive_messages(int from_id, int sock, SpscRing<Inbound>* ring = NULL);
+    bool decode_frames(int from_id, SpscRing<Inbound>* ring);
+    bool receive_shm(int from_id, int sock, SpscRing<Inbound>* ring);
+    void flush_shm(int target_id);
+    void ring_doorbell(int sock);
+    void retry_shm_backlog();
+    void accept_frame(int from_id, FrameType type, Message& msg);
+    void process_message(Message& msg);
+    bool can_deliver(Channel& channel, const Message& msg);
+    void deliver_message(Channel& channel, const Message& msg);
+    void check_buffer(Channel& channel, int released_by);
+    void sender_arrived(int sender);
+    void announce_clock();
+    bool announces() const { return channels[0]->ordering->announces(); }
+    size_t buffered_messages() const;
     
     // Utilities
     int random_int(int min, int max);
     void print_summary();
+    void print_stats();
+    void print_latency();
+    void print_held_up();
+    void print_debug_state();
+    void write_metrics();
+    void trace_event(int kind, const Message& msg);
 
 public:
-    Process(int process_id, bool delay);
+    Process(int process_id, const ClusterConfig& cluster_config, const WorkloadConfig& workload_config,
+            bool delay, bool debug = false);
     void run();
+    void set_stats_interval(double seconds) { stats_interval_s = seconds; }
+    void set_batching(size_t bytes, long long delay_us) { batch_bytes = bytes; batch_delay_us = delay_us; }
+    void set_delta_clocks(bool enabled) { delta_clocks = enabled; }
+    void set_ordering(OrderingMode mode);
+    // Run count independent broadcast groups over the same links, each
+    // ordered by the same mode; the workload sends on each in turn
+    void set_channels(int count);
+    void set_io_threads(int threads) { io_threads = threads; }
+    void set_seed(unsigned seed) { workload = Workload(workload.settings(), seed); }
+    void set_buffer_limit(size_t bytes);
+    void set_shared_memory(bool enabled) { peer_links.set_shared_memory(enabled); }
+    void set_connect_timeout(double seconds) { peer_links.set_timeout(seconds); }
+    void set_journal(const std::string& path) { journal_path = path; }
+    void set_retransmit_window(long long bytes) { retransmit_limit = bytes; }
+    void set_metrics_file(const std::string& path, double interval_s) { metrics_path = path; metrics_interval_s = interval_s; }
+    // Link only to neighbours in a spanning tree of this fanout and relay
+    // through it, instead of sending every message to every peer (0).
+    // Flow control and reconnection are then off, whatever the buffer
+    // limit and retransmit window.
+    void set_relay_tree(int fanout) { relay.set_fanout(fanout); }
+    // One latency histogram per sender, or one for all of them
+    void set_latency_by_sender(bool enabled);
+    
+    // Driving the process from a Transport instead of run(): attach it,
+    // call start() once every process exists, deliver its timers and bytes,
+    // and call finish() once is_finished()
+    void attach(Transport* t) { transport = t; }
+    void start();
+    void on_timer(uint64_t tag);
+    void on_receive(int from_id, const char* data, size_t len);
+    void finish();
+    long long messages_delivered() const;
+    long long messages_broadcast() const { return messages_sent.load(); }
+    long long relayed_wire_bytes() const { return relay.bytes_relayed(); }
+    size_t peak_buffer_bytes() const { return peak_buffered_bytes; }
+    const LatencyHistogram& end_to_end_latency() const { return delivery_latency; }
+    
+    // Embedding (see CausalNode): after use_application_source(), run()
+    // broadcasts payloads given to submit() instead of running the workload,
+    // and keeps going until request_stop(). submit() and request_stop() may
+    // be called from any thread. Each channel has its own queue, and the
+    // sending thread takes from them in turn.
+    void use_application_source();
+    void set_delivery_handler(const DeliveryHandler& handler) { delivery_handler = handler; }
+    void set_delivery_handler(int channel, const DeliveryHandler& handler);
+    void set_backpressure_handler(const BackpressureHandler& handler) { backpressure_handler = handler; }
+    BroadcastResult submit(int channel, const char* data, size_t len);
+    void request_stop();
+    bool congested() const { return backpressure.load(std::memory_order_relaxed); }
+    bool run_failed() const { return failed; }
+    
     void connect_to_others();
-    void broadcast_message();
-    void handle_incoming();
+    void broadcast_message(int channel, std::string* payload = NULL);
+    void handle_incoming(int from_id);
     bool is_finished();
-    Process(int process_id, bool delay, bool debug = false);
-};
\ No newline at end of file
+};
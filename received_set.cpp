@@ -0,0 +1,47 @@
+#include "received_set.h"
+#include <algorithm>
+
+const int MIN_AHEAD = 64;
+
+void ReceivedSet::grow(int span) {
+    int size = std::max(MIN_AHEAD, (int)ahead.size());
+    while (size < span) {
+        size *= 2;
+    }
+    std::vector<char> ring(size, 0);
+    for (int seq = below + 1; seq < end; seq++) {
+        ring[seq & (size - 1)] = ahead[seq & (ahead.size() - 1)];
+    }
+    ahead.swap(ring);
+}
+
+bool ReceivedSet::insert(int seq) {
+    if (seq < below) {
+        return false;
+    }
+    if (seq == below) {
+        // Anything that arrived early may now join up
+        below++;
+        while (below < end && ahead[below & (ahead.size() - 1)]) {
+            ahead[below & (ahead.size() - 1)] = 0;
+            below++;
+        }
+        end = std::max(end, below);
+        return true;
+    }
+    if (seq - below >= (int)ahead.size()) {
+        grow(seq - below + 1);
+    }
+    char& flag = ahead[seq & (ahead.size() - 1)];
+    if (flag) {
+        return false;
+    }
+    flag = 1;
+    end = std::max(end, seq + 1);
+    return true;
+}
+
+void ReceivedSet::reset(int count) {
+    below = end = count;
+    std::fill(ahead.begin(), ahead.end(), 0);
+}
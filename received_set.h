@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+
+// Which of one sender's sequence numbers have arrived, so that a copy of a
+// message seen before (resent after a reconnect) can be dropped on any path.
+// Over an ordered link every arrival is the next number and only a counter
+// moves; numbers that arrive early, on a link that reorders, are kept in a
+// power-of-two ring of flags until the gap below them fills.
+class ReceivedSet {
+private:
+    int below;                        // Every number below this has arrived
+    int end;                          // Highest number arrived + 1
+    std::vector<char> ahead;          // Arrived above below, slot = seq & (size - 1)
+
+    void grow(int span);
+
+public:
+    ReceivedSet() : below(0), end(0) {}
+
+    // Record seq; false if it had arrived before
+    bool insert(int seq);
+
+    // Numbers from 0 that have all arrived
+    int contiguous() const { return below; }
+
+    // Start again with 0..count-1 arrived
+    void reset(int count);
+};
@@ -0,0 +1,52 @@
+#include "relay.h"
+#include <stdexcept>
+#include <string>
+
+void RelayTree::set_fanout(int fanout) {
+    if (fanout < 0) {
+        throw std::invalid_argument("Relay tree fanout must not be negative: " + std::to_string(fanout));
+    }
+    tree_fanout = fanout;
+}
+
+void RelayTree::setup(int self_id, int count, int channels, bool delta, std::vector<char>& linked) {
+    // Our links are our parent and children in the tree
+    self = self_id;
+    num_processes = count;
+    delta_clocks = delta;
+    neighbours.clear();
+    if (self > 0) {
+        neighbours.push_back((self - 1) / tree_fanout);
+    }
+    long long first_child = (long long)self * tree_fanout + 1;
+    for (long long c = first_child; c < first_child + tree_fanout && c < num_processes; c++) {
+        neighbours.push_back((int)c);
+    }
+    linked.assign(num_processes, 0);
+    for (int peer : neighbours) {
+        linked[peer] = 1;
+    }
+    bases.assign(num_processes, std::vector<std::vector<int> >(channels));
+}
+
+void RelayTree::add(FrameType type, const Message& msg) {
+    // A leaf has nowhere to pass anything on to
+    if (tree_fanout == 0 || neighbours.size() < 2) {
+        return;
+    }
+    if (type == FRAME_DONE) {
+        encode_done(msg.sender_id, msg.seq_number, buffer);
+    } else if (type == FRAME_TIMESTAMP) {
+        encode_timestamp(decode_timestamp(msg), buffer);
+    } else {
+        // Everything we pass on from a sender goes the same way, so one
+        // delta base per sender and channel serves all those links
+        std::vector<int>& base = bases[msg.sender_id][msg.channel];
+        bool full = !delta_clocks || base.empty();
+        encode_frame(msg, buffer, full ? NULL : &base);
+        if (delta_clocks && full) {
+            base = msg.vector_clock;
+        }
+        messages++;
+    }
+}
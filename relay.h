@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "message.h"
+#include "wire.h"
+
+// Relaying: with a tree fanout, links follow a spanning tree (the parent of
+// process i is (i - 1) / fanout) instead of joining every pair, and each
+// process passes what it receives on to its other neighbours. The path
+// between two processes is unique and each link is FIFO, so every sender's
+// messages still arrive once and in order. Nothing can be resent over a lost
+// link, and credit has no way back to the sender, so a relaying process runs
+// with neither.
+//
+// Frames to pass on collect while the frames read from one link are decoded,
+// and then go out together on every other link.
+class RelayTree {
+private:
+    int self;
+    int num_processes;
+    int tree_fanout;                  // 0 = full mesh
+    bool delta_clocks;
+    std::vector<int> neighbours;      // Parent and children, in ID order
+    std::vector<char> buffer;         // Frames to pass on from the link being decoded
+    std::vector<std::vector<std::vector<int> > > bases; // Per sender and channel: delta base of what we pass on
+    long long messages;
+    long long bytes;                  // Wire bytes passed on, counted once per link
+
+public:
+    RelayTree() : self(0), num_processes(0), tree_fanout(0), delta_clocks(true), messages(0), bytes(0) {}
+
+    // 0 links every pair; throws if negative
+    void set_fanout(int fanout);
+    int fanout() const { return tree_fanout; }
+
+    // Relay as process self_id of count, with this many channels, marking
+    // its neighbours in linked and nothing else
+    void setup(int self_id, int count, int channels, bool delta, std::vector<char>& linked);
+
+    // True if a frame of this type from sender may come over a link from
+    // some other process: messages, and what their sender says of them
+    bool carries(FrameType type, int sender) const {
+        return tree_fanout > 0 && type != FRAME_CREDIT && type != FRAME_CLOSE
+               && sender >= 0 && sender < num_processes && sender != self;
+    }
+
+    // A frame from another sender arrived, to be passed on down the tree
+    void add(FrameType type, const Message& msg);
+
+    // Pass on what was added through send(peer, data, len), on every link
+    // but the one the frames came in on: those lead to processes that have
+    // not seen them
+    template <typename Send>
+    void forward(int from_id, Send send) {
+        if (buffer.empty()) {
+            return;
+        }
+        for (int peer : neighbours) {
+            if (peer != from_id) {
+                send(peer, buffer.data(), buffer.size());
+                bytes += buffer.size();
+            }
+        }
+        buffer.clear();
+    }
+
+    long long messages_relayed() const { return messages; }
+    long long bytes_relayed() const { return bytes; }
+};
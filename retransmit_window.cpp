@@ -0,0 +1,61 @@
+#include "retransmit_window.h"
+#include "wire.h"
+#include <algorithm>
+
+RetransmitWindow::RetransmitWindow(size_t limit_bytes) :
+    start(0),
+    base(0),
+    head(0),
+    kept(0),
+    first_seq(0),
+    limit(limit_bytes) {}
+
+// Double the ring, oldest offset first. A deque would free and allocate a
+// block every few dozen messages as the window slides.
+void RetransmitWindow::grow() {
+    std::vector<uint64_t> ring(std::max<size_t>(64, offsets.size() * 2));
+    for (size_t i = 0; i < kept; i++) {
+        ring[i] = offsets[(head + i) & (offsets.size() - 1)];
+    }
+    offsets.swap(ring);
+    head = 0;
+}
+
+void RetransmitWindow::add(const Message& msg) {
+    if (kept == 0) {
+        first_seq = msg.seq_number;
+    }
+    if (kept == offsets.size()) {
+        grow();
+    }
+    size_t mask = offsets.size() - 1;
+    offsets[(head + kept++) & mask] = base + buf.size();
+    encode_frame(msg, buf, NULL);
+
+    // Forget the oldest frames beyond the limit, and move the rest down once
+    // the forgotten ones take up half the buffer, so each byte moves about
+    // once and the storage is reused
+    while (bytes() > limit && kept > 1) {
+        head = (head + 1) & mask;
+        kept--;
+        start = offsets[head] - base;
+        first_seq++;
+    }
+    if (start > buf.size() / 2) {
+        buf.erase(buf.begin(), buf.begin() + start);
+        base += start;
+        start = 0;
+    }
+}
+
+bool RetransmitWindow::read(int from_seq, std::vector<char>& out) const {
+    if (from_seq < first_seq || from_seq > first_seq + (int)kept) {
+        return false;
+    }
+    if (from_seq == first_seq + (int)kept) {
+        return true;
+    }
+    size_t from = offsets[(head + from_seq - first_seq) & (offsets.size() - 1)] - base;
+    out.insert(out.end(), buf.begin() + from, buf.end());
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "message.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Our most recent messages, kept as full-clock frames so that any run of
+// them up to the latest can be sent again to a peer whose connection
+// dropped: a full clock does not depend on what the peer last received.
+// Every peer is sent the same messages, so one window serves all of them.
+// It is bounded in bytes and forgets the oldest messages first, but always
+// keeps the latest one.
+class RetransmitWindow {
+private:
+    std::vector<char> buf;            // Frames, oldest first, from offset start
+    size_t start;
+    uint64_t base;                    // Stream position of buf[0]
+    std::vector<uint64_t> offsets;    // Ring of the stream position of each kept frame
+    size_t head;                      // Slot of the oldest kept frame
+    size_t kept;                      // Frames kept
+    int first_seq;                    // Sequence number of the oldest kept frame
+    size_t limit;
+
+    void grow();
+
+public:
+    explicit RetransmitWindow(size_t limit_bytes = 0);
+    void set_limit(size_t bytes) { limit = bytes; }
+
+    // Keep msg, whose sequence number must follow the last one kept
+    void add(const Message& msg);
+
+    // Append the frames of messages from from_seq to the latest to out.
+    // False, with nothing appended, if some of them are no longer kept.
+    bool read(int from_seq, std::vector<char>& out) const;
+
+    int first() const { return first_seq; }
+    size_t bytes() const { return buf.size() - start; }
+};
@@ -0,0 +1,170 @@
+#include "shm_link.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Positions count every byte ever written and read, so head - tail is the
+// fill level and the offset is the low bits. The writer's and reader's
+// fields sit on separate cache lines. Only lock-free atomics are used, which
+// are address-free and so work across processes.
+struct ShmLink::Ring {
+    std::atomic<uint64_t> head;       // Written by the writer
+    char pad1[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail;       // Written by the reader
+    char pad2[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint32_t> reader_asleep;
+    std::atomic<uint32_t> writer_waiting;
+    char pad3[64 - 2 * sizeof(std::atomic<uint32_t>)];
+};
+
+struct ShmLink::Segment {
+    std::atomic<uint32_t> attached;
+    char pad[64 - sizeof(std::atomic<uint32_t>)];
+    Ring rings[2];                    // [0] creator -> peer, [1] peer -> creator
+
+    static size_t bytes() { return sizeof(Segment) + 2 * RING_BYTES; }
+};
+
+const size_t ShmLink::RING_BYTES;
+
+ShmLink::ShmLink(const std::string& name, void* memory, size_t bytes, bool owner) :
+    name(name),
+    segment((Segment*)memory),
+    mapped_bytes(bytes),
+    owner(owner),
+    backlog(false) {
+    char* data = (char*)memory + sizeof(Segment);
+    int out_ring = owner ? 0 : 1;
+    out = &segment->rings[out_ring];
+    in = &segment->rings[1 - out_ring];
+    out_data = data + out_ring * RING_BYTES;
+    in_data = data + (1 - out_ring) * RING_BYTES;
+}
+
+std::unique_ptr<ShmLink> ShmLink::create(const std::string& name) {
+    shm_unlink(name.c_str());         // Left behind by a run that crashed
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return std::unique_ptr<ShmLink>();
+    }
+
+    // Reserve the pages now: on a full tmpfs a sparse file would only fail
+    // later, with SIGBUS on first touch
+    size_t bytes = Segment::bytes();
+    int err = posix_fallocate(fd, 0, bytes);
+    void* memory = err == 0 ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (memory == MAP_FAILED) {
+        err = err ? err : errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        errno = err;
+        return std::unique_ptr<ShmLink>();
+    }
+    close(fd);
+
+    // Both readers start asleep, so the first write to each ring wakes it
+    Segment* segment = new (memory) Segment();
+    segment->rings[0].reader_asleep.store(1);
+    segment->rings[1].reader_asleep.store(1);
+    return std::unique_ptr<ShmLink>(new ShmLink(name, memory, bytes, true));
+}
+
+std::unique_ptr<ShmLink> ShmLink::open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return std::unique_ptr<ShmLink>();
+    }
+    size_t bytes = Segment::bytes();
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != bytes) {
+        close(fd);
+        errno = EINVAL;
+        return std::unique_ptr<ShmLink>();
+    }
+    void* memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return std::unique_ptr<ShmLink>();
+    }
+
+    std::unique_ptr<ShmLink> link(new ShmLink(name, memory, bytes, false));
+    link->segment->attached.store(1, std::memory_order_release);
+    return link;
+}
+
+ShmLink::~ShmLink() {
+    unlink();
+    munmap(segment, mapped_bytes);
+}
+
+bool ShmLink::attached() const {
+    return segment->attached.load(std::memory_order_acquire) != 0;
+}
+
+void ShmLink::unlink() {
+    if (owner && !name.empty()) {
+        shm_unlink(name.c_str());
+        name.clear();
+    }
+}
+
+size_t ShmLink::write(const char* data, size_t len) {
+    uint64_t head = out->head.load(std::memory_order_relaxed);
+    uint64_t tail = out->tail.load(std::memory_order_acquire);
+    size_t n = std::min(len, RING_BYTES - (size_t)(head - tail));
+    size_t offset = head & (RING_BYTES - 1);
+    size_t first = std::min(n, RING_BYTES - offset);
+    memcpy(out_data + offset, data, first);
+    memcpy(out_data, data + first, n - first);
+
+    // Sequentially consistent, like the reader's flag and check in sleep():
+    // either we see it asleep or it sees these bytes
+    out->head.store(head + n, std::memory_order_seq_cst);
+    return n;
+}
+
+bool ShmLink::reader_woken() {
+    return out->reader_asleep.load(std::memory_order_seq_cst) != 0
+        && out->reader_asleep.exchange(0, std::memory_order_seq_cst) != 0;
+}
+
+bool ShmLink::wait_for_space() {
+    out->writer_waiting.store(1, std::memory_order_seq_cst);
+    uint64_t head = out->head.load(std::memory_order_relaxed);
+    if (head - out->tail.load(std::memory_order_seq_cst) < RING_BYTES) {
+        out->writer_waiting.store(0, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+size_t ShmLink::read(char* dst, size_t len) {
+    uint64_t tail = in->tail.load(std::memory_order_relaxed);
+    uint64_t head = in->head.load(std::memory_order_acquire);
+    size_t n = std::min(len, (size_t)(head - tail));
+    size_t offset = tail & (RING_BYTES - 1);
+    size_t first = std::min(n, RING_BYTES - offset);
+    memcpy(dst, in_data + offset, first);
+    memcpy(dst + first, in_data, n - first);
+    in->tail.store(tail + n, std::memory_order_seq_cst);
+    return n;
+}
+
+bool ShmLink::writer_woken() {
+    return in->writer_waiting.load(std::memory_order_seq_cst) != 0
+        && in->writer_waiting.exchange(0, std::memory_order_seq_cst) != 0;
+}
+
+bool ShmLink::sleep() {
+    in->reader_asleep.store(1, std::memory_order_seq_cst);
+    if (in->head.load(std::memory_order_seq_cst) != in->tail.load(std::memory_order_relaxed)) {
+        in->reader_asleep.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
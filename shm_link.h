@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A link between two processes on the same host: a pair of lock-free
+// single-producer/single-consumer byte rings in POSIX shared memory, one per
+// direction. It carries exactly the bytes a TCP connection would (encoded
+// frames), so the receiving side decodes them with the same FrameDecoder.
+//
+// Neither side can sleep on a ring, so each side says when it is about to:
+// the reader sets reader_asleep once it has found its ring empty, the writer
+// sets writer_waiting once it has found its ring full. The other side checks
+// the flag after every write or read and, if it was set, sends a wakeup
+// through some channel the sleeper is polling (Process uses a byte on the
+// peer's TCP connection, which stays open alongside). Under load nobody is
+// asleep, and messages cross with no system call at all.
+//
+// The lower process ID creates the segment before it listens; the higher one
+// maps it and marks it attached before sending its ID over TCP, so by the
+// time the creator knows who connected it also knows whether the link is in
+// use. Whoever creates a segment also removes its name.
+class ShmLink {
+private:
+    struct Ring;
+    struct Segment;
+
+    std::string name;
+    Segment* segment;
+    size_t mapped_bytes;
+    Ring* out;                        // Ring we write
+    Ring* in;                         // Ring we read
+    char* out_data;
+    char* in_data;
+    bool owner;                       // Created the segment, so unlinks its name
+    std::atomic<bool> backlog;        // Local: the writer holds bytes that did not fit
+
+    ShmLink(const std::string& name, void* memory, size_t bytes, bool owner);
+
+public:
+    // Bytes of buffer in each direction
+    static const size_t RING_BYTES = 256 * 1024;
+
+    // Create a fresh segment under name, replacing any left by an earlier
+    // run; NULL (with errno set) if shared memory is unavailable or full
+    static std::unique_ptr<ShmLink> create(const std::string& name);
+
+    // Map the segment a peer created and mark it attached; NULL if there is
+    // none (for example, the peer has shared memory turned off)
+    static std::unique_ptr<ShmLink> open(const std::string& name);
+
+    ~ShmLink();
+
+    // The peer has mapped the segment; only meaningful to the creator
+    bool attached() const;
+
+    // Remove the segment's name; the mappings stay valid. Idempotent.
+    void unlink();
+
+    // Writer side. write() takes as many bytes as fit and returns how many.
+    // After a write, reader_woken() is true if the reader had gone to sleep
+    // and must be woken. When not everything fit, wait_for_space() marks the
+    // writer as waiting and returns true if room appeared meanwhile.
+    size_t write(const char* data, size_t len);
+    bool reader_woken();
+    bool wait_for_space();
+
+    // Whether the writer is holding bytes back, for whichever thread takes
+    // the reader's wakeup to know it should have the writer try again
+    void set_backlog(bool waiting) { backlog.store(waiting, std::memory_order_release); }
+    bool has_backlog() const { return backlog.load(std::memory_order_acquire); }
+
+    // Reader side. read() copies out up to len bytes and returns how many.
+    // After reading, writer_woken() is true if the writer was waiting for
+    // room and must be woken. Once read() returns 0, sleep() marks the reader
+    // as asleep; it returns false if data arrived meanwhile and reading
+    // should go on.
+    size_t read(char* dst, size_t len);
+    bool writer_woken();
+    bool sleep();
+};
@@ -0,0 +1,157 @@
+#include "sim_network.h"
+#include "process.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Like the reactor's outbound queues, a link this full pushes back on
+// unthrottled senders
+const size_t SIM_MAX_IN_FLIGHT_BYTES = 4 * 1024 * 1024;
+
+SimNetwork::SimNetwork(int n, const SimConfig& sim_config) :
+    num_processes(n),
+    config(sim_config),
+    gen(sim_config.seed),
+    clock_ns(0),
+    next_order(0),
+    events_run(0),
+    last_arrival(n * n, 0),
+    in_flight_bytes(n * n, 0),
+    congested_links(n, 0),
+    in_flight_frames(n, 0),
+    sent_bytes(n, 0),
+    egress_free(n, 0) {
+    for (int i = 0; i < n; i++) {
+        endpoints.push_back(std::unique_ptr<Endpoint>(new Endpoint(this, i)));
+    }
+}
+
+void SimNetwork::schedule(Event& e) {
+    e.order = next_order++;
+    events.push(e);
+}
+
+void SimNetwork::Endpoint::arm_timer(uint64_t tag, long long delay_us) {
+    // Re-arming bumps the tag's count, so the earlier event is ignored
+    size_t t = 0;
+    while (t < timers.size() && timers[t].first != tag) {
+        t++;
+    }
+    if (t == timers.size()) {
+        timers.push_back(std::make_pair(tag, 0));
+    }
+
+    Event e;
+    e.time = net->clock_ns + std::max(0LL, delay_us) * 1000;
+    e.process = id;
+    e.from = -1;
+    e.tag = tag;
+    e.generation = ++timers[t].second;
+    net->schedule(e);
+}
+
+void SimNetwork::Endpoint::send(int peer, const char* data, size_t len) {
+    int slot;
+    if (!net->free_payloads.empty()) {
+        slot = net->free_payloads.back();
+        net->free_payloads.pop_back();
+    } else {
+        slot = net->payloads.size();
+        net->payloads.push_back(std::vector<char>());
+    }
+    net->payloads[slot].assign(data, data + len);
+
+    int link = id * net->num_processes + peer;
+    int64_t departure = net->clock_ns;
+    if (net->config.bandwidth_mbps > 0) {
+        int64_t& free_at = net->egress_free[id];
+        departure = std::max(departure, free_at) + (int64_t)len * 8000 / net->config.bandwidth_mbps;
+        free_at = departure;
+    }
+    long long jitter = net->config.jitter_us > 0
+        ? (long long)(net->gen() % (uint64_t)(net->config.jitter_us * 1000 + 1)) : 0;
+    bool slow = id == net->config.slow_from && peer == net->config.slow_to;
+    int64_t arrival = departure + (slow ? net->config.slow_latency_us : net->config.latency_us) * 1000 + jitter;
+    if (!net->config.reorder) {
+        // FIFO: never arrive before an earlier frame on the same link
+        arrival = std::max(arrival, net->last_arrival[link]);
+        net->last_arrival[link] = arrival;
+    }
+
+    size_t& bytes = net->in_flight_bytes[link];
+    if (bytes < SIM_MAX_IN_FLIGHT_BYTES && bytes + len >= SIM_MAX_IN_FLIGHT_BYTES) {
+        net->congested_links[id]++;
+    }
+    bytes += len;
+    net->in_flight_frames[id]++;
+    net->sent_bytes[id] += len;
+
+    Event e;
+    e.time = arrival;
+    e.process = peer;
+    e.from = id;
+    e.tag = slot;
+    e.generation = 0;
+    net->schedule(e);
+}
+
+bool SimNetwork::run(const std::vector<Process*>& processes) {
+    if ((int)processes.size() != num_processes) {
+        throw std::runtime_error("SimNetwork: expected " + std::to_string(num_processes) + " processes");
+    }
+
+    std::vector<char> finished(num_processes, 0);
+    int remaining = num_processes;
+    auto check = [&](int p) {
+        if (!finished[p] && processes[p]->is_finished()) {
+            processes[p]->finish();
+            finished[p] = 1;
+            remaining--;
+        }
+    };
+
+    for (Process* p : processes) {
+        p->start();
+    }
+    for (int p = 0; p < num_processes; p++) {
+        check(p);
+    }
+
+    while (remaining > 0 && !events.empty()) {
+        Event e = events.top();
+        events.pop();
+        clock_ns = e.time;
+        events_run++;
+
+        if (e.from < 0) {
+            Endpoint& owner = *endpoints[e.process];
+            bool current = false;
+            for (size_t t = 0; t < owner.timers.size(); t++) {
+                if (owner.timers[t].first == e.tag) {
+                    current = owner.timers[t].second == e.generation;
+                }
+            }
+            if (current) {
+                processes[e.process]->on_timer(e.tag);
+                check(e.process);
+            }
+            continue;
+        }
+
+        // Frame arrival: account for it before the receiver reacts, so a
+        // sender that is waiting on its links sees them drain
+        std::vector<char>& data = payloads[e.tag];
+        int link = e.from * num_processes + e.process;
+        size_t& bytes = in_flight_bytes[link];
+        if (bytes >= SIM_MAX_IN_FLIGHT_BYTES && bytes - data.size() < SIM_MAX_IN_FLIGHT_BYTES) {
+            congested_links[e.from]--;
+        }
+        bytes -= data.size();
+        in_flight_frames[e.from]--;
+
+        processes[e.process]->on_receive(e.from, data.data(), data.size());
+        free_payloads.push_back(e.tag);
+        check(e.process);
+        check(e.from);
+    }
+    return remaining == 0;
+}
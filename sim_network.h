@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+#include "transport.h"
+
+class Process;
+
+// Link behaviour of the simulated network
+struct SimConfig {
+    long long latency_us = 100;       // One-way delay of every frame
+    long long jitter_us = 20;         // Uniform extra delay per frame, 0..jitter
+    bool reorder = false;             // Frames on a link may overtake each other
+    int slow_from = -1;               // One slow link, slow_from -> slow_to, if set
+    int slow_to = -1;
+    long long slow_latency_us = 0;    // Its one-way delay in place of latency_us
+    long long bandwidth_mbps = 0;     // Egress of every node in Mbit/s, 0 = unlimited
+    unsigned seed = 1;
+};
+
+// In-memory network and virtual clock for N Process instances in one
+// binary. Frame arrivals and timers are events run in time order, ties in
+// the order they were scheduled, and all randomness comes from the seed, so
+// a run is exactly reproducible and takes no ports or real time.
+//
+// Links are FIFO like TCP unless reordering is on. Reordered links carry
+// whole frames out of order, which delta-encoded clocks cannot survive, so
+// processes on such a network must send full clocks. With a bandwidth, each
+// node's frames leave it one after another at that rate, whichever link
+// they take, so sending a frame to many peers takes time.
+class SimNetwork {
+private:
+    class Endpoint : public Transport {
+    public:
+        SimNetwork* net;
+        int id;
+        std::vector<std::pair<uint64_t, uint64_t> > timers; // Tag, arm count
+
+        Endpoint(SimNetwork* network, int process_id) : net(network), id(process_id) {}
+        int64_t now_ns() override { return net->clock_ns; }
+        void arm_timer(uint64_t tag, long long delay_us) override;
+        void send(int peer, const char* data, size_t len) override;
+        bool congested() override { return net->congested_links[id] > 0; }
+        bool drained() override { return net->in_flight_frames[id] == 0; }
+    };
+
+    struct Event {
+        int64_t time;
+        uint64_t order;               // Scheduling order, breaks ties
+        int process;                  // Receiver of a frame, owner of a timer
+        int from;                     // Sender of a frame, -1 for a timer
+        uint64_t tag;                 // Timer tag, or payload index of a frame
+        uint64_t generation;          // Timer arm count; stale if re-armed since
+        bool operator>(const Event& other) const {
+            return time != other.time ? time > other.time : order > other.order;
+        }
+    };
+
+    int num_processes;
+    SimConfig config;
+    std::mt19937_64 gen;
+    int64_t clock_ns;
+    uint64_t next_order;
+    uint64_t events_run;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+    std::vector<std::unique_ptr<Endpoint> > endpoints;
+    std::vector<std::vector<char> > payloads; // Frames in flight, slots recycled
+    std::vector<int> free_payloads;
+    std::vector<int64_t> last_arrival;        // Per link (from * N + to)
+    std::vector<size_t> in_flight_bytes;      // Per link
+    std::vector<int> congested_links;         // Per sender: links over the limit
+    std::vector<long long> in_flight_frames;  // Per sender
+    std::vector<long long> sent_bytes;        // Per sender, over the whole run
+    std::vector<int64_t> egress_free;         // Per sender: when its last frame has left
+
+    void schedule(Event& e);
+
+public:
+    SimNetwork(int n, const SimConfig& sim_config);
+
+    // The transport to attach to process id
+    Transport* transport(int id) { return endpoints[id].get(); }
+
+    // Start every process and run events until all are finished or nothing
+    // is left to happen. Returns true if every process finished.
+    bool run(const std::vector<Process*>& processes);
+
+    int64_t now_ns() const { return clock_ns; }
+    long long bytes_sent(int id) const { return sent_bytes[id]; }
+    uint64_t events_processed() const { return events_run; }
+};
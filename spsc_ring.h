@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Lock-free single-producer/single-consumer queue of T with a power-of-two
+// capacity. Items are swapped in and out rather than copied, so a slot hands
+// its previous occupant back to the caller: a Message keeps its clock and
+// payload capacity as it cycles between the two threads.
+template <typename T>
+class SpscRing {
+private:
+    std::vector<T> slots;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> head;         // Next slot the producer fills
+    char pad1[64];
+    std::atomic<size_t> tail;         // Next slot the consumer empties
+    char pad2[64];
+
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1), head(0), tail(0) {}
+
+    // Producer: swap item into the ring; false when full
+    bool try_push(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        std::swap(slots[h & mask], item);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: swap the oldest item out into item; false when empty
+    bool try_pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::swap(item, slots[t & mask]);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+};
@@ -0,0 +1,283 @@
+// loopback - Run a cluster of embedded nodes in one process through the
+// library API (causal.h), over real localhost connections (shared memory
+// rings unless turned off, TCP otherwise).
+//
+// Each node has an application thread that broadcasts its messages as fast as
+// broadcast() accepts them, waiting on the backpressure callback whenever it
+// is refused. Every delivery is checked against the order the callback
+// promises (causal unless --ordering says otherwise). Then all nodes stop.
+//
+// With --cut-links, a connection between two nodes is shut down every so
+// many milliseconds while messages are being broadcast, to exercise
+// reconnection: the nodes must make it again and resend what was lost.
+//
+// With --channels, each node's messages take the channels in turn, and
+// every channel is checked on its own.
+//
+// With --relay-tree, nodes link only along a spanning tree and relay each
+// other's messages, and the same checks hold at every node.
+//
+// Usage: tools/loopback [--nodes n] [--messages m] [--size bytes] [--port p] [--io-threads t]
+//                      [--shared-memory on|off] [--cut-links ms] [--ordering fifo|causal|total]
+//                      [--channels c] [--relay-tree fanout]
+// Exit status: 0 if every node delivered every message in the promised order.
+
+#include "causal.h"
+#include "logger.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct Node {
+    std::unique_ptr<CausalNode> node;
+    std::vector<std::vector<int> > delivered; // Per channel and sender, touched only by the delivery callback
+    std::vector<int> last_ts;         // Total order, per channel: (timestamp, sender) of the last delivery
+    std::vector<int> last_sender;
+    long long violations = 0;
+    std::mutex lock;
+    std::condition_variable writable;
+    bool congested = false;
+};
+
+// Shut down one of the cluster's TCP connections, chosen at random among the
+// sockets of this process with an end on one of the nodes' ports
+static bool cut_link(int port, int nodes, unsigned& seed) {
+    std::vector<int> links;
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return false;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        int fd = atoi(entry->d_name);
+        struct sockaddr_in local, remote;
+        socklen_t local_len = sizeof(local), remote_len = sizeof(remote);
+        if (fd <= 2 || getsockname(fd, (struct sockaddr*)&local, &local_len) < 0
+            || getpeername(fd, (struct sockaddr*)&remote, &remote_len) < 0 || local.sin_family != AF_INET) {
+            continue;
+        }
+        int local_port = ntohs(local.sin_port), remote_port = ntohs(remote.sin_port);
+        if ((local_port >= port && local_port < port + nodes) || (remote_port >= port && remote_port < port + nodes)) {
+            links.push_back(fd);
+        }
+    }
+    closedir(dir);
+    if (links.empty()) {
+        return false;
+    }
+    return shutdown(links[rand_r(&seed) % links.size()], SHUT_RDWR) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int nodes = 4;
+    long long messages = 100000;
+    size_t size = 64;
+    int port = 9000;
+    int io_threads = 0;
+    bool shared_memory = true;
+    int cut_ms = 0;
+    OrderingMode ordering = ORDER_CAUSAL;
+    int channels = 1;
+    int relay_fanout = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--nodes" && i + 1 < argc) {
+            nodes = atoi(argv[++i]);
+        } else if (arg == "--messages" && i + 1 < argc) {
+            messages = atoll(argv[++i]);
+        } else if (arg == "--size" && i + 1 < argc) {
+            size = atol(argv[++i]);
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            io_threads = atoi(argv[++i]);
+        } else if (arg == "--shared-memory" && i + 1 < argc) {
+            shared_memory = std::string(argv[++i]) != "off";
+        } else if (arg == "--cut-links" && i + 1 < argc) {
+            cut_ms = atoi(argv[++i]);
+        } else if (arg == "--ordering" && i + 1 < argc) {
+            if (!parse_ordering(argv[++i], ordering)) {
+                fprintf(stderr, "Unknown ordering: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--channels" && i + 1 < argc) {
+            channels = atoi(argv[++i]);
+        } else if (arg == "--relay-tree" && i + 1 < argc) {
+            relay_fanout = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--nodes n] [--messages m] [--size bytes] [--port p] [--io-threads t]"
+                    " [--shared-memory on|off] [--cut-links ms] [--ordering fifo|causal|total]"
+                    " [--channels c] [--relay-tree fanout]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nodes < 2) {
+        fprintf(stderr, "Need at least 2 nodes\n");
+        return 1;
+    }
+    if (channels < 1 || channels > MAX_CHANNELS) {
+        fprintf(stderr, "Need 1 to %d channels\n", MAX_CHANNELS);
+        return 1;
+    }
+
+    Logger::instance().configure(LOG_ERROR, 1, "", 0, nodes);
+    Logger::instance().start();
+
+    ClusterConfig cluster = ClusterConfig::local(nodes, port);
+    std::vector<std::unique_ptr<Node> > cluster_nodes;
+    for (int i = 0; i < nodes; i++) {
+        cluster_nodes.push_back(std::unique_ptr<Node>(new Node));
+        Node& n = *cluster_nodes.back();
+        n.node.reset(new CausalNode(i, cluster));
+        n.delivered.assign(channels, std::vector<int>(nodes, 0));
+        n.last_ts.assign(channels, 0);
+        n.last_sender.assign(channels, -1);
+        n.node->set_stats_interval(0);
+        n.node->set_io_threads(io_threads);
+        n.node->set_shared_memory(shared_memory);
+        n.node->set_channels(channels);
+        n.node->set_relay_tree(relay_fanout);
+        n.node->set_ordering(ordering);
+
+        // Next from its sender in its channel, with its payload intact. In
+        // causal order nothing it depends on in the channel is missing (our
+        // own entry is always satisfied); in total order it sorts after the
+        // channel's last delivery.
+        n.node->on_deliver([&n, i, size, ordering, channels](const Delivery& d) {
+            if (d.channel < 0 || d.channel >= channels) {
+                n.violations++;
+                return;
+            }
+            std::vector<int>& delivered = n.delivered[d.channel];
+            bool ok = d.seq_number == delivered[d.sender_id]
+                      && d.size == size && (size == 0 || d.data[size - 1] == (char)('a' + d.sender_id % 26));
+            if (ordering == ORDER_CAUSAL) {
+                ok = ok && d.vector_clock[d.sender_id] == d.seq_number + 1;
+                for (size_t j = 0; j < d.clock_size; j++) {
+                    if ((int)j != d.sender_id && (int)j != i && d.vector_clock[j] > delivered[j]) {
+                        ok = false;
+                    }
+                }
+            } else if (ordering == ORDER_TOTAL) {
+                int ts = d.vector_clock[0];
+                int& last_ts = n.last_ts[d.channel];
+                int& last_sender = n.last_sender[d.channel];
+                ok = ok && (ts > last_ts || (ts == last_ts && d.sender_id > last_sender));
+                last_ts = ts;
+                last_sender = d.sender_id;
+            }
+            n.violations += !ok;
+            delivered[d.sender_id]++;
+        });
+        n.node->on_backpressure([&n](bool congested) {
+            std::lock_guard<std::mutex> guard(n.lock);
+            n.congested = congested;
+            if (!congested) {
+                n.writable.notify_all();
+            }
+        });
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> senders;
+    for (int i = 0; i < nodes; i++) {
+        cluster_nodes[i]->node->start();
+        senders.push_back(std::thread([&cluster_nodes, i, messages, size, channels] {
+            Node& n = *cluster_nodes[i];
+            std::string payload(size, (char)('a' + i % 26));
+            for (long long k = 0; k < messages;) {
+                BroadcastResult r = n.node->broadcast(k % channels, payload.data(), payload.size());
+                if (r == BROADCAST_QUEUED) {
+                    k++;
+                } else if (r == BROADCAST_BUSY) {
+                    // The flag may already have cleared; never wait long
+                    std::unique_lock<std::mutex> guard(n.lock);
+                    n.writable.wait_for(guard, std::chrono::milliseconds(1), [&n] { return !n.congested; });
+                } else {
+                    return;
+                }
+            }
+        }));
+    }
+    
+    // Cutting stops once every message is broadcast: a node that has
+    // delivered everything closes its connections and exits, and a link cut
+    // just then could not be made again
+    std::mutex cut_lock;
+    std::condition_variable cut_done;
+    bool sending = true;
+    int cuts = 0;
+    std::thread cutter;
+    if (cut_ms > 0) {
+        cutter = std::thread([&] {
+            unsigned seed = 1;
+            std::unique_lock<std::mutex> guard(cut_lock);
+            while (!cut_done.wait_for(guard, std::chrono::milliseconds(cut_ms), [&sending] { return !sending; })) {
+                cuts += cut_link(port, nodes, seed);
+            }
+        });
+    }
+    for (std::thread& t : senders) {
+        t.join();
+    }
+    if (cutter.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(cut_lock);
+            sending = false;
+        }
+        cut_done.notify_all();
+        cutter.join();
+    }
+
+    // stop() waits for every peer to stop too, so stop them all at once
+    std::vector<std::thread> stoppers;
+    std::vector<char> stopped(nodes, 0);
+    for (int i = 0; i < nodes; i++) {
+        stoppers.push_back(std::thread([&cluster_nodes, &stopped, i] {
+            stopped[i] = cluster_nodes[i]->node->stop();
+        }));
+    }
+    for (std::thread& t : stoppers) {
+        t.join();
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Logger::instance().stop();
+
+    bool ok = true;
+    long long total = 0;
+    for (int i = 0; i < nodes; i++) {
+        Node& n = *cluster_nodes[i];
+        for (int j = 0; j < nodes; j++) {
+            long long from = 0;
+            for (int c = 0; c < channels; c++) {
+                from += n.delivered[c][j];
+            }
+            total += from;
+            if (j != i && from != messages) {
+                printf("Node %d delivered %lld of %lld messages from node %d\n", i, from, messages, j);
+                ok = false;
+            }
+        }
+        if (n.violations > 0 || !stopped[i]) {
+            printf("Node %d: %lld out-of-order deliveries%s\n", i, n.violations, stopped[i] ? "" : ", failed");
+            ok = false;
+        }
+    }
+    printf("%d nodes, %lld messages of %zu bytes each: %lld deliveries in %.3f s (%.0f/s)\n", nodes, messages,
+           size, total, elapsed_s, total / elapsed_s);
+    if (cut_ms > 0) {
+        printf("%d connections cut\n", cuts);
+    }
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
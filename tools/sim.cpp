@@ -0,0 +1,224 @@
+// sim - Run a whole cluster in one process over the simulated network.
+//
+// Every node is a real Process (encoding, decoding, batching, causal
+// delivery) attached to an in-memory SimNetwork with a virtual clock, so a
+// run needs no ports, takes only as long as the CPU work, and is exactly
+// reproducible from its seed.
+//
+// Usage: tools/sim [--nodes n] [--latency us] [--jitter us] [--bandwidth mbps] [--reorder]
+//                  [--slow-link from,to,us] [--buffer-limit bytes] [--seed s]
+//                  [--log-level l] [--batch-size b] [--batch-delay us]
+//                  [--clock-encoding delta|full] [--ordering fifo|causal|total]
+//                  [--channels c] [--relay-tree fanout] [workload options]
+// Exit status: 0 if every node delivered every message, 1 otherwise.
+//
+// Besides delivery, it reports what each broadcast costs its sender on the
+// wire, the most any node sent in all (with --relay-tree, mostly other
+// nodes' messages passed on), and send-to-delivery latency over every
+// delivery. Nodes keep one latency histogram for all senders, so clusters
+// of hundreds fit in memory.
+
+#include "config.h"
+#include "logger.h"
+#include "process.h"
+#include "sim_network.h"
+#include "workload.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options] [workload options]\n"
+              << "Simulation options:\n"
+              << "  --nodes <n>           cluster size (default 4)\n"
+              << "  --latency <us>        one-way link latency (default 100)\n"
+              << "  --jitter <us>         uniform extra delay per frame (default 20)\n"
+              << "  --bandwidth <mbps>    egress of every node in Mbit/s (default 0: unlimited)\n"
+              << "  --reorder             let frames overtake each other on a link (full clocks)\n"
+              << "  --slow-link <a,b,us>  give the link from node a to node b this latency instead\n"
+              << "  --buffer-limit <bytes> causal buffer ceiling per node (default 64 MB, 0 = none)\n"
+              << "  --seed <s>            seed for links and workloads (default 1)\n"
+              << "  --log-level <level>   error (default) | info | event | debug\n"
+              << "  --batch-size <bytes>  batch outgoing messages (default off)\n"
+              << "  --batch-delay <us>    batch flush deadline (default 200)\n"
+              << "  --clock-encoding <e>  delta (default) | full\n"
+              << "  --ordering <mode>     causal (default) | fifo | total\n"
+              << "  --channels <c>        broadcast groups sharing the links (default 1)\n"
+              << "  --relay-tree <k>      relay through a spanning tree of fanout k (default 0: full mesh)\n";
+    std::cerr << WorkloadConfig::usage();
+}
+
+int main(int argc, char* argv[]) {
+    int nodes = 4;
+    int log_level = LOG_ERROR;
+    long long batch_size = 0;
+    long long batch_delay = 200;
+    bool delta_clocks = true;
+    OrderingMode ordering = ORDER_CAUSAL;
+    int channels = 1;
+    int relay_fanout = 0;
+    long long buffer_limit = -1;
+    SimConfig sim;
+    WorkloadConfig workload;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            int consumed = workload.parse_option(argc, argv, i);
+            if (consumed > 0) {
+                i += consumed - 1;
+            } else if (arg == "--nodes" && i + 1 < argc) {
+                nodes = std::stoi(argv[++i]);
+            } else if (arg == "--latency" && i + 1 < argc) {
+                sim.latency_us = std::stoll(argv[++i]);
+            } else if (arg == "--jitter" && i + 1 < argc) {
+                sim.jitter_us = std::stoll(argv[++i]);
+            } else if (arg == "--bandwidth" && i + 1 < argc) {
+                sim.bandwidth_mbps = std::stoll(argv[++i]);
+            } else if (arg == "--reorder") {
+                sim.reorder = true;
+            } else if (arg == "--slow-link" && i + 1 < argc) {
+                if (sscanf(argv[++i], "%d,%d,%lld", &sim.slow_from, &sim.slow_to, &sim.slow_latency_us) != 3) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--buffer-limit" && i + 1 < argc) {
+                buffer_limit = std::stoll(argv[++i]);
+            } else if (arg == "--seed" && i + 1 < argc) {
+                sim.seed = std::stoul(argv[++i]);
+            } else if (arg == "--log-level" && i + 1 < argc) {
+                std::string name = argv[++i];
+                const char* names[] = {"error", "info", "event", "debug"};
+                log_level = -1;
+                for (int l = LOG_ERROR; l <= LOG_DEBUG; l++) {
+                    if (name == names[l]) {
+                        log_level = l;
+                    }
+                }
+                if (log_level < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--batch-size" && i + 1 < argc) {
+                batch_size = std::stoll(argv[++i]);
+            } else if (arg == "--batch-delay" && i + 1 < argc) {
+                batch_delay = std::stoll(argv[++i]);
+            } else if (arg == "--clock-encoding" && i + 1 < argc) {
+                std::string encoding = argv[++i];
+                if (encoding != "delta" && encoding != "full") {
+                    usage(argv[0]);
+                    return 1;
+                }
+                delta_clocks = encoding == "delta";
+            } else if (arg == "--ordering" && i + 1 < argc) {
+                if (!parse_ordering(argv[++i], ordering)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--channels" && i + 1 < argc) {
+                channels = std::stoi(argv[++i]);
+            } else if (arg == "--relay-tree" && i + 1 < argc) {
+                relay_fanout = std::stoi(argv[++i]);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        workload.validate();
+        if (relay_fanout > 0 && buffer_limit > 0) {
+            throw std::invalid_argument("--relay-tree cannot be combined with --buffer-limit");
+        }
+        if (nodes < 2 || sim.latency_us < 0 || sim.jitter_us < 0 || sim.bandwidth_mbps < 0 || channels < 1 || channels > MAX_CHANNELS
+            || relay_fanout < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    Logger::instance().configure((LogLevel)log_level, 1, "", 0, nodes);
+    Logger::instance().start();
+
+    bool complete = false;
+    try {
+        ClusterConfig cluster = ClusterConfig::local(nodes);
+        SimNetwork network(nodes, sim);
+        std::vector<std::unique_ptr<Process> > owned;
+        std::vector<Process*> processes;
+        for (int i = 0; i < nodes; i++) {
+            owned.push_back(std::unique_ptr<Process>(new Process(i, cluster, workload, false)));
+            Process& p = *owned.back();
+            p.attach(network.transport(i));
+            p.set_seed(sim.seed * 2654435761u + i);
+            p.set_stats_interval(0);
+            // Frames that overtake each other need self-contained clocks
+            p.set_delta_clocks(delta_clocks && !sim.reorder);
+            p.set_channels(channels);
+            p.set_ordering(ordering);
+            p.set_relay_tree(relay_fanout);
+            p.set_latency_by_sender(false);
+            if (batch_size > 0) {
+                p.set_batching(batch_size, batch_delay);
+            }
+            if (buffer_limit >= 0) {
+                p.set_buffer_limit(buffer_limit);
+            }
+            processes.push_back(&p);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        complete = network.run(processes);
+        double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        long long delivered = 0;
+        size_t peak_buffer = 0;
+        long long broadcast = 0;
+        long long own_bytes = 0;
+        long long peak_egress = 0;
+        long long peak_relayed = 0;
+        LatencyHistogram latency;
+        for (int i = 0; i < nodes; i++) {
+            Process* p = processes[i];
+            delivered += p->messages_delivered();
+            peak_buffer = std::max(peak_buffer, p->peak_buffer_bytes());
+            broadcast += p->messages_broadcast();
+            own_bytes += network.bytes_sent(i) - p->relayed_wire_bytes();
+            if (network.bytes_sent(i) > peak_egress) {
+                peak_egress = network.bytes_sent(i);
+                peak_relayed = p->relayed_wire_bytes();
+            }
+            latency.merge(p->end_to_end_latency());
+        }
+        Logger::instance().stop();
+
+        printf("Simulated %d nodes, latency %lld us, jitter %lld us%s%s, seed %u\n", nodes,
+               sim.latency_us, sim.jitter_us, sim.reorder ? ", reordering" : "",
+               sim.bandwidth_mbps > 0 ? (", " + std::to_string(sim.bandwidth_mbps) + " Mbit/s egress").c_str() : "",
+               sim.seed);
+        printf("Virtual time: %.3f ms\n", network.now_ns() / 1e6);
+        printf("Events: %llu\n", (unsigned long long)network.events_processed());
+        printf("Messages delivered: %lld\n", delivered);
+        printf("Peak causal buffer: %zu bytes\n", peak_buffer);
+        printf("Sender egress: %.0f bytes per message broadcast\n", broadcast > 0 ? (double)own_bytes / broadcast : 0);
+        printf("Peak node egress: %.3f MB (%.3f MB relayed)\n", peak_egress / 1e6, peak_relayed / 1e6);
+        printf("End-to-end latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", latency.percentile(50) / 1e3,
+               latency.percentile(99) / 1e3, latency.max() / 1e3);
+        printf("Wall time: %.3f s (%.0f deliveries/s)\n", wall_s, wall_s > 0 ? delivered / wall_s : 0);
+        if (!complete) {
+            printf("STALLED: not every node delivered every message\n");
+        }
+    } catch (const std::exception& e) {
+        Logger::instance().stop();
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return complete ? 0 : 1;
+}
@@ -0,0 +1,419 @@
+// verify - Check that a run delivered every message in the order promised.
+//
+// Reads every node's output: the text log (stdout of causal_broadcast) or
+// the binary trace written with --trace. Files are read one record at a
+// time, so memory is O(N^2) whatever the number of messages. Checks:
+//
+//   causal order  a message is delivered only after everything its clock
+//                 says it depends on has been delivered at that node
+//   total order   each node delivers in increasing (timestamp, sender)
+//                 order, so with completeness every node delivers the
+//                 messages they share in the same order
+//   FIFO          each sender's messages are delivered in sequence order
+//   completeness  no duplicates, and every message a node sent is delivered
+//                 exactly once at every other node
+//
+// The ordering mode (--ordering) is told by the size of the clocks: N
+// entries for causal order, one timestamp for total order, none for FIFO,
+// which gets only the last two checks.
+//
+// Runs with several channels (--channels) get every check per channel:
+// the orders hold within a channel, and messages are numbered in theirs.
+//
+// A node's dependencies on its own messages are checked against its total
+// send count only: sends and deliveries may be logged from different
+// threads, so their relative order in the output is not meaningful.
+// Text logs must not be sampled (--log-sample) or filtered (--log-level
+// below event), since every delivery line is needed.
+//
+// Usage: tools/verify <log or trace>...
+// Exit status: 0 all checks passed, 1 violation found, 2 unreadable input.
+
+#include "trace.h"
+#include "wire.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+const long long MAX_REPORTED = 20;    // Violations printed per node
+
+// One node's messages in one channel
+struct Channel {
+    long long sent;                   // Messages it broadcast in the channel
+    std::vector<long long> delivered; // Next expected seq from each sender
+    int max_own;                      // Highest own clock entry it depended on
+    int last_sent_ts;                 // Total order: timestamp of its last send
+    int last_ts;                      // Total order: (timestamp, sender) of its last delivery
+    int last_sender;
+    explicit Channel(int n) : sent(0), delivered(n, 0), max_own(0), last_sent_ts(0), last_ts(0), last_sender(-1) {}
+};
+
+// Everything known about one node once its file has been read
+struct Node {
+    bool seen;
+    long long sent;                   // Messages it broadcast, -1 if unknown
+    long long deliveries;
+    std::vector<Channel> channels;    // Grown as channels are seen
+    Node() : seen(false), sent(-1), deliveries(0) {}
+};
+
+enum Ordering { ORDER_UNKNOWN, ORDER_FIFO, ORDER_CAUSAL, ORDER_TOTAL };
+
+class Verifier {
+private:
+    int num_processes;
+    Ordering ordering;                // Told by the first clock seen
+    std::vector<Node> nodes;
+    long long violations;
+    long long reported;
+    int node;                         // Node whose file is being read
+    long long sends;                  // Sends seen in that file, in all channels
+
+    void violation(const std::string& what) {
+        violations++;
+        if (reported++ < MAX_REPORTED) {
+            printf("P%d: %s\n", node, what.c_str());
+        }
+    }
+
+    static std::string clock_text(const std::vector<int>& vc) {
+        std::string s = "[";
+        for (size_t i = 0; i < vc.size(); i++) {
+            s += (i ? "," : "") + std::to_string(vc[i]);
+        }
+        return s + "]";
+    }
+
+    // A node's state in a channel, or NULL if the number is out of range
+    Channel* channel_of(Node& n, int channel) {
+        if (channel < 0 || channel >= MAX_CHANNELS) {
+            return NULL;
+        }
+        while ((int)n.channels.size() <= channel) {
+            n.channels.push_back(Channel(num_processes));
+        }
+        return &n.channels[channel];
+    }
+
+    static std::string channel_text(int channel) {
+        return channel == 0 ? "" : " on channel " + std::to_string(channel);
+    }
+
+    // Whether a clock has the size of the run's ordering mode
+    bool clock_fits(const std::vector<int>& vc) {
+        if (ordering == ORDER_UNKNOWN) {
+            ordering = (int)vc.size() == num_processes ? ORDER_CAUSAL
+                     : vc.size() == 1 ? ORDER_TOTAL : vc.size() == 0 ? ORDER_FIFO : ORDER_UNKNOWN;
+        }
+        return ordering != ORDER_UNKNOWN
+               && (int)vc.size() == (ordering == ORDER_CAUSAL ? num_processes : ordering == ORDER_TOTAL ? 1 : 0);
+    }
+
+public:
+    Verifier() : num_processes(0), ordering(ORDER_UNKNOWN), violations(0), reported(0), node(-1), sends(0) {}
+
+    const char* ordering_name() const {
+        return ordering == ORDER_FIFO ? "FIFO" : ordering == ORDER_TOTAL ? "total" : "causal";
+    }
+
+    long long failures() const { return violations; }
+
+    // Start a node's file; false if it cannot be accepted
+    bool begin(int node_id, int n, const char* path) {
+        if (num_processes == 0 && n > 0) {
+            num_processes = n;
+            nodes.resize(n);
+        }
+        if (n != num_processes || node_id < 0 || node_id >= num_processes) {
+            fprintf(stderr, "%s: node %d of %d does not match a %d-node cluster\n",
+                    path, node_id, n, num_processes);
+            return false;
+        }
+        if (nodes[node_id].seen) {
+            fprintf(stderr, "%s: node %d was already read\n", path, node_id);
+            return false;
+        }
+        node = node_id;
+        sends = 0;
+        reported = 0;
+        nodes[node].seen = true;
+        nodes[node].channels.assign(1, Channel(num_processes));
+        return true;
+    }
+
+    void send(int channel, int seq, const std::vector<int>& vc) {
+        std::string msg = "message " + std::to_string(seq) + channel_text(channel);
+        Channel* self = channel_of(nodes[node], channel);
+        if (!self || !clock_fits(vc)) {
+            violation("malformed send of " + msg + " with a clock of size " + std::to_string(vc.size()));
+            return;
+        }
+        if (seq != self->sent) {
+            violation("sent " + msg + " after " + std::to_string(self->sent) + " sends");
+        }
+        if (ordering == ORDER_CAUSAL && vc[node] != seq + 1) {
+            violation("sent " + msg + " with own clock entry " + std::to_string(vc[node]));
+        }
+        if (ordering == ORDER_TOTAL) {
+            if (vc[0] <= self->last_sent_ts) {
+                violation("sent " + msg + " with timestamp " + std::to_string(vc[0])
+                          + ", not above its last one " + std::to_string(self->last_sent_ts));
+            }
+            self->last_sent_ts = vc[0];
+        }
+        self->sent = seq + 1;
+        sends++;
+    }
+
+    void deliver(int sender, int channel, int seq, const std::vector<int>& vc) {
+        std::string msg = "message " + std::to_string(seq) + " from P" + std::to_string(sender) + channel_text(channel);
+        Channel* self = channel_of(nodes[node], channel);
+        if (!self || sender < 0 || sender >= num_processes || sender == node || !clock_fits(vc)) {
+            violation("malformed delivery of " + msg);
+            return;
+        }
+        nodes[node].deliveries++;
+
+        // FIFO: the next sequence number from this sender in the channel,
+        // exactly once
+        long long& next = self->delivered[sender];
+        if (seq < next) {
+            violation("delivered " + msg + " twice or out of order");
+            return;
+        }
+        if (seq > next) {
+            violation("delivered " + msg + " but message " + std::to_string(next)
+                      + " from P" + std::to_string(sender) + " was never delivered before it");
+        }
+        next = seq + 1;
+        if (ordering == ORDER_TOTAL) {
+            // Total order: one sequence by (timestamp, sender) everywhere
+            if (vc[0] < self->last_ts || (vc[0] == self->last_ts && sender <= self->last_sender)) {
+                violation("delivered " + msg + " with timestamp " + std::to_string(vc[0]) + " after one from P"
+                          + std::to_string(self->last_sender) + " with timestamp " + std::to_string(self->last_ts));
+            }
+            self->last_ts = vc[0];
+            self->last_sender = sender;
+            return;
+        }
+        if (ordering != ORDER_CAUSAL) {
+            return;
+        }
+        if (vc[sender] != seq + 1) {
+            violation(msg + " carries clock " + clock_text(vc));
+        }
+
+        // Causal order: every dependency on a third node is already here
+        for (int j = 0; j < num_processes; j++) {
+            if (j != sender && j != node && vc[j] > self->delivered[j]) {
+                violation("delivered " + msg + ", VC=" + clock_text(vc) + ", before message "
+                          + std::to_string(vc[j] - 1) + " from P" + std::to_string(j));
+            }
+        }
+        self->max_own = std::max(self->max_own, vc[node]);
+    }
+
+    // Finish a node's file; total_sent is -1 if the file did not say
+    void end(long long total_sent) {
+        Node& self = nodes[node];
+        self.sent = total_sent >= 0 ? total_sent : sends;
+        if (total_sent >= 0 && sends > 0 && sends != total_sent) {
+            violation("logged " + std::to_string(sends) + " sends but reports " + std::to_string(total_sent));
+        }
+        if (sends == 0) {
+            // No send lines: a single channel, counted by the report alone
+            self.channels[0].sent = self.sent;
+        }
+        if (reported > MAX_REPORTED) {
+            printf("P%d: ... %lld more\n", node, reported - MAX_REPORTED);
+        }
+    }
+
+    // Cross-node checks once every file has been read
+    void finish() {
+        for (node = 0; node < num_processes; node++) {
+            Node& self = nodes[node];
+            if (!self.seen) {
+                printf("P%d: no log given; its deliveries are not checked\n", node);
+                continue;
+            }
+            reported = 0;
+            for (int s = 0; s < num_processes; s++) {
+                if (nodes[s].seen) {
+                    channel_of(self, (int)nodes[s].channels.size() - 1);
+                }
+            }
+            for (size_t c = 0; c < self.channels.size(); c++) {
+                Channel& mine = self.channels[c];
+                std::string in = channel_text(c);
+                if (mine.max_own > mine.sent) {
+                    violation("delivered a message depending on own message " + std::to_string(mine.max_own - 1)
+                              + in + ", but only " + std::to_string(mine.sent) + " were sent");
+                }
+                for (int s = 0; s < num_processes; s++) {
+                    if (s == node || !nodes[s].seen) {
+                        continue;
+                    }
+                    long long sent = c < nodes[s].channels.size() ? nodes[s].channels[c].sent : 0;
+                    if (mine.delivered[s] < sent) {
+                        violation("lost " + std::to_string(sent - mine.delivered[s]) + " of "
+                                  + std::to_string(sent) + " messages from P" + std::to_string(s) + in);
+                    } else if (mine.delivered[s] > sent) {
+                        violation("delivered " + std::to_string(mine.delivered[s]) + " messages from P"
+                                  + std::to_string(s) + in + ", which sent " + std::to_string(sent));
+                    }
+                }
+            }
+            printf("P%d: %lld sent, %lld delivered\n", node, self.sent, self.deliveries);
+        }
+    }
+};
+
+// Clock text "[a,b,c]" starting at p
+static bool parse_clock(const char* p, std::vector<int>& vc) {
+    vc.clear();
+    if (*p++ != '[') {
+        return false;
+    }
+    while (*p && *p != ']') {
+        char* end;
+        vc.push_back(strtol(p, &end, 10));
+        if (end == p) {
+            return false;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return *p == ']';
+}
+
+// Optional " on channel c" at p, moving p past it; channel 0 if absent
+static bool parse_channel(const char*& p, int& channel) {
+    channel = 0;
+    int pos = 0;
+    if (strncmp(p, " on channel ", 12) != 0) {
+        return true;
+    }
+    if (sscanf(p, " on channel %d%n", &channel, &pos) != 1 || pos == 0) {
+        return false;
+    }
+    p += pos;
+    return true;
+}
+
+static bool read_text(Verifier& verifier, const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    std::vector<int> vc;
+    bool started = false;
+    long long total_sent = -1;
+    while (std::getline(in, line)) {
+        const char* s = line.c_str();
+        int node_id, n, seq, sender, channel, pos = 0;
+        long long count;
+        if (!started) {
+            if (sscanf(s, "Process %d initialized. Cluster size: %d", &node_id, &n) == 2) {
+                if (!verifier.begin(node_id, n, path)) {
+                    return false;
+                }
+                started = true;
+            }
+        } else if (sscanf(s, "Delivered message %d from P%d%n", &seq, &sender, &pos) == 2 && pos > 0) {
+            const char* rest = s + pos;
+            if (!parse_channel(rest, channel) || strncmp(rest, ", VC=", 5) != 0 || !parse_clock(rest + 5, vc)) {
+                vc.clear();
+            }
+            verifier.deliver(sender, channel, seq, vc);
+        } else if (sscanf(s, "Sent message %d%n", &seq, &pos) == 1 && pos > 0) {
+            const char* rest = s + pos;
+            if (!parse_channel(rest, channel) || strncmp(rest, ", VC=", 5) != 0 || !parse_clock(rest + 5, vc)) {
+                vc.clear();
+            }
+            verifier.send(channel, seq, vc);
+        } else if (sscanf(s, "Messages sent: %lld", &count) == 1) {
+            total_sent = count;
+        }
+    }
+    if (!started) {
+        fprintf(stderr, "%s: no \"Process N initialized\" line\n", path);
+        return false;
+    }
+    verifier.end(total_sent);
+    return true;
+}
+
+static bool read_trace(Verifier& verifier, FILE* f, const char* path) {
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || !verifier.begin(header.node_id, header.num_processes, path)) {
+        return false;
+    }
+
+    TraceRecord record;
+    std::vector<int> vc;
+    while (fread(&record, sizeof(record), 1, f) == 1) {
+        if (record.vc_size > 1u << 20) {
+            fprintf(stderr, "%s: corrupt record (vc_size %u)\n", path, record.vc_size);
+            return false;
+        }
+        vc.resize(record.vc_size);
+        if (record.vc_size > 0 && fread(vc.data(), sizeof(int32_t), vc.size(), f) != vc.size()) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            return false;
+        }
+        if (record.kind == TRACE_SEND) {
+            verifier.send(record.channel, record.seq_number, vc);
+        } else if (record.kind == TRACE_DELIVER) {
+            verifier.deliver(record.sender_id, record.channel, record.seq_number, vc);
+        }
+    }
+    verifier.end(-1);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <log or trace>...\n", argv[0]);
+        return 2;
+    }
+
+    Verifier verifier;
+    for (int i = 1; i < argc; i++) {
+        FILE* f = fopen(argv[i], "rb");
+        if (!f) {
+            fprintf(stderr, "Cannot open %s\n", argv[i]);
+            return 2;
+        }
+        // Traces start with a magic string; anything else is a text log
+        char magic[sizeof(TRACE_MAGIC)];
+        bool is_trace = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+                        && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+        bool ok;
+        if (is_trace) {
+            rewind(f);
+            ok = read_trace(verifier, f, argv[i]);
+            fclose(f);
+        } else {
+            fclose(f);
+            ok = read_text(verifier, argv[i]);
+        }
+        if (!ok) {
+            return 2;
+        }
+    }
+    verifier.finish();
+
+    if (verifier.failures() > 0) {
+        printf("FAILED: %lld violation(s)\n", verifier.failures());
+        return 1;
+    }
+    printf("OK: %s order, FIFO and exactly-once delivery hold\n", verifier.ordering_name());
+    return 0;
+}
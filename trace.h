@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+
+// Binary event trace written with --trace and read by the verifier. All
+// fields are host byte order; the trace is meant to be checked on the
+// machine (or architecture) that wrote it.
+//
+//   TraceFileHeader
+//   { TraceRecord, int32 vector_clock[vc_size] } ...
+const char TRACE_MAGIC[8] = {'C', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+struct TraceFileHeader {
+    char magic[8];
+    int32_t node_id;                  // Process that wrote the trace
+    int32_t num_processes;
+};
+
+enum TraceKind {
+    TRACE_SEND = 1,                   // node_id broadcast this message
+    TRACE_DELIVER = 2                 // node_id delivered this message
+};
+
+struct TraceRecord {
+    uint8_t kind;                     // TraceKind
+    uint8_t reserved;
+    uint16_t channel;
+    int32_t sender_id;
+    int32_t seq_number;               // Within the channel
+    uint32_t vc_size;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Everything a Process needs from the outside world when it does not own
+// real sockets: a clock, one-shot timers, and byte links to its peers.
+// Without a Transport, Process runs its own TCP/epoll reactor on the real
+// clock; with one, whoever implements it drives the Process through
+// Process::start(), on_timer() and on_receive() (see SimNetwork).
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    // Current time in nanoseconds; also used for message timestamps
+    virtual int64_t now_ns() = 0;
+
+    // Call Process::on_timer(tag) after delay_us; re-arming a tag replaces
+    // its previous deadline
+    virtual void arm_timer(uint64_t tag, long long delay_us) = 0;
+
+    // Queue encoded frames for a peer, to arrive in Process::on_receive()
+    virtual void send(int peer, const char* data, size_t len) = 0;
+
+    // True while the links are too full to take more unthrottled sends
+    virtual bool congested() = 0;
+
+    // True once everything sent has arrived
+    virtual bool drained() = 0;
+};
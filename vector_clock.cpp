@@ -0,0 +1,135 @@
+#include "vector_clock.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLOCK_KERNELS_X86 1
+#endif
+
+static bool ready_scalar(const int* clock, const int* local, int n, int sender, int self) {
+    for (int j = 0; j < n; j++) {
+        if (j != sender && j != self && clock[j] > local[j]) {
+            return false;
+        }
+    }
+    return clock[sender] == local[sender] + 1;
+}
+
+static void merge_scalar(int* local, const int* clock, int n) {
+    for (int i = 0; i < n; i++) {
+        if (clock[i] > local[i]) {
+            local[i] = clock[i];
+        }
+    }
+}
+
+#ifdef CLOCK_KERNELS_X86
+
+// Bit of entry j within the lanes starting at entry base, or 0
+static inline unsigned lane_bit(int j, int base, int lanes) {
+    unsigned offset = j - base;
+    return offset < (unsigned)lanes ? 1u << offset : 0;
+}
+
+// The vector versions compare a whole block at once and only look at which
+// lanes are ahead when some are: a deliverable message is ahead of local in
+// its sender's entry and possibly in self's, and nowhere else. Clocks are
+// plain std::vector storage, so loads are unaligned.
+
+__attribute__((target("sse4.1")))
+static bool ready_sse41(const int* clock, const int* local, int n, int sender, int self) {
+    int j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m128i ahead = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(clock + j)),
+                                        _mm_loadu_si128((const __m128i*)(local + j)));
+        unsigned bits = _mm_movemask_ps(_mm_castsi128_ps(ahead));
+        if (bits && (bits & ~lane_bit(sender, j, 4) & ~lane_bit(self, j, 4))) {
+            return false;
+        }
+    }
+    for (; j < n; j++) {
+        if (j != sender && j != self && clock[j] > local[j]) {
+            return false;
+        }
+    }
+    return clock[sender] == local[sender] + 1;
+}
+
+__attribute__((target("sse4.1")))
+static void merge_sse41(int* local, const int* clock, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i* dst = (__m128i*)(local + i);
+        _mm_storeu_si128(dst, _mm_max_epi32(_mm_loadu_si128(dst), _mm_loadu_si128((const __m128i*)(clock + i))));
+    }
+    merge_scalar(local + i, clock + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static bool ready_avx2(const int* clock, const int* local, int n, int sender, int self) {
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256i ahead = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(clock + j)),
+                                           _mm256_loadu_si256((const __m256i*)(local + j)));
+        unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(ahead));
+        if (bits && (bits & ~lane_bit(sender, j, 8) & ~lane_bit(self, j, 8))) {
+            return false;
+        }
+    }
+    // The rest in half blocks, which is all there is for small clusters.
+    // Indices shift with the pointers, so its final check is still on the
+    // sender's entry.
+    return ready_sse41(clock + j, local + j, n - j, sender - j, self - j);
+}
+
+__attribute__((target("avx2")))
+static void merge_avx2(int* local, const int* clock, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i* dst = (__m256i*)(local + i);
+        _mm256_storeu_si256(dst, _mm256_max_epi32(_mm256_loadu_si256(dst),
+                                                  _mm256_loadu_si256((const __m256i*)(clock + i))));
+    }
+    merge_sse41(local + i, clock + i, n - i);
+}
+
+#endif
+
+std::vector<ClockKernels> supported_clock_kernels() {
+    std::vector<ClockKernels> kernels;
+    ClockKernels scalar = {"scalar", ready_scalar, merge_scalar};
+    kernels.push_back(scalar);
+#ifdef CLOCK_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        ClockKernels sse41 = {"sse4.1", ready_sse41, merge_sse41};
+        kernels.push_back(sse41);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        ClockKernels avx2 = {"avx2", ready_avx2, merge_avx2};
+        kernels.push_back(avx2);
+    }
+#endif
+    return kernels;
+}
+
+// The last supported set is the widest
+static ClockKernels best_clock_kernels() {
+    return supported_clock_kernels().back();
+}
+
+ClockKernels clock_kernels = best_clock_kernels();
+
+bool select_clock_kernels(const std::string& name) {
+    std::vector<ClockKernels> kernels = supported_clock_kernels();
+    if (name == "auto") {
+        clock_kernels = kernels.back();
+        return true;
+    }
+    for (const ClockKernels& k : kernels) {
+        if (name == k.name) {
+            clock_kernels = k;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// The two vector clock operations on the delivery path, kept apart from
+// Process so they can be benchmarked on their own (bench/bench_core).
+//
+// Both run for every received message and, in check_buffer, for every
+// buffered head on every sweep, so for large clusters they have SSE4.1 and
+// AVX2 versions. The best one the CPU supports is picked at startup; the
+// scalar loops are the fallback and the reference.
+struct ClockKernels {
+    const char* name;
+    bool (*ready)(const int* clock, const int* local, int n, int sender, int self);
+    void (*merge)(int* local, const int* clock, int n);
+};
+
+// Kernels in use, and every set this CPU can run (scalar first)
+extern ClockKernels clock_kernels;
+std::vector<ClockKernels> supported_clock_kernels();
+
+// Switch to the named set ("scalar", "sse4.1", "avx2" or "auto"); false if
+// the name is unknown or the CPU cannot run it
+bool select_clock_kernels(const std::string& name);
+
+// True if a message from sender stamped with clock can be causally delivered
+// at a process whose delivered counts are local: it is the next message from
+// its sender, and everything it depends on from any other process except
+// self has been delivered. A process's own messages count as delivered as
+// soon as they are sent, so its own entry is never checked.
+inline bool clock_ready(const std::vector<int>& clock, const std::vector<int>& local, int sender, int self) {
+    return clock_kernels.ready(clock.data(), local.data(), local.size(), sender, self);
+}
+
+// local = component-wise maximum of local and clock
+inline void clock_merge(std::vector<int>& local, const std::vector<int>& clock) {
+    clock_kernels.merge(local.data(), clock.data(), local.size());
+}
@@ -0,0 +1,414 @@
+#include "wire.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+const size_t MIN_OUTBOUND_CAPACITY = 64 * 1024;
+
+static void put_u64(char* p, uint64_t v) {
+    put_u32(p, v >> 32);
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static uint64_t get_u64(const char* p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static void put_varint(std::vector<char>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static uint32_t get_varint(const char*& p, const char* end) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p >= end) {
+            throw std::runtime_error("Truncated varint in clock");
+        }
+        uint8_t byte = *p++;
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return v;
+        }
+    }
+    throw std::runtime_error("Overlong varint in clock");
+}
+
+// clock_bytes covers everything between the header and the data
+static void write_header(char* p, FrameType type, uint8_t flags, int channel, int sender_id, int seq_number,
+                         uint32_t vc_size, uint32_t clock_bytes, uint32_t data_size, int64_t send_time_ns) {
+    put_u32(p, FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE + clock_bytes + data_size);
+    put_u32(p + 4, (uint32_t)type << 24 | (uint32_t)flags << 16 | (uint16_t)channel);
+    put_u32(p + 8, sender_id);
+    put_u32(p + 12, seq_number);
+    put_u32(p + 16, vc_size);
+    put_u32(p + 20, data_size);
+    put_u64(p + 24, send_time_ns);
+}
+
+static char* append_header(std::vector<char>& out, FrameType type, int sender_id, int seq_number,
+                           uint32_t vc_size, uint32_t data_size, int64_t send_time_ns, int channel = 0) {
+    size_t offset = out.size();
+    out.resize(offset + FRAME_HEADER_SIZE + vc_size * 4 + data_size);
+    char* p = &out[offset];
+    write_header(p, type, 0, channel, sender_id, seq_number, vc_size, vc_size * 4, data_size, send_time_ns);
+    return p + FRAME_HEADER_SIZE;
+}
+
+// Bytes of channel_seq msg carries after the header
+static uint32_t channel_seq_size(const Message& msg) {
+    return msg.channel_seq != msg.seq_number ? 4 : 0;
+}
+
+static void encode_delta_frame(const Message& msg, std::vector<char>& out, std::vector<int>& clock_base) {
+    uint32_t vc_size = msg.vector_clock.size();
+    uint32_t data_size = msg.data.size();
+    uint32_t seq_size = channel_seq_size(msg);
+    clock_base.resize(vc_size, 0);
+
+    size_t offset = out.size();
+    out.resize(offset + FRAME_HEADER_SIZE + seq_size);
+    if (seq_size > 0) {
+        put_u32(&out[offset + FRAME_HEADER_SIZE], msg.channel_seq);
+    }
+
+    // Changed entries as (index gap, increase) pairs; clocks only grow
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < vc_size; i++) {
+        changed += msg.vector_clock[i] != clock_base[i];
+    }
+    put_varint(out, changed);
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < vc_size; i++) {
+        if (msg.vector_clock[i] != clock_base[i]) {
+            put_varint(out, i - prev);
+            put_varint(out, msg.vector_clock[i] - clock_base[i]);
+            clock_base[i] = msg.vector_clock[i];
+            prev = i;
+        }
+    }
+    uint32_t clock_bytes = out.size() - offset - FRAME_HEADER_SIZE;
+
+    out.insert(out.end(), msg.data.begin(), msg.data.end());
+    write_header(&out[offset], FRAME_MESSAGE, FRAME_FLAG_DELTA_CLOCK | (seq_size ? FRAME_FLAG_CHANNEL_SEQ : 0),
+                 msg.channel, msg.sender_id, msg.seq_number, vc_size, clock_bytes, data_size, msg.send_time_ns);
+}
+
+void encode_frame(const Message& msg, std::vector<char>& out, std::vector<int>* clock_base) {
+    if (clock_base) {
+        encode_delta_frame(msg, out, *clock_base);
+        return;
+    }
+
+    uint32_t vc_size = msg.vector_clock.size();
+    uint32_t data_size = msg.data.size();
+    uint32_t seq_size = channel_seq_size(msg);
+    size_t offset = out.size();
+    out.resize(offset + FRAME_HEADER_SIZE + seq_size + vc_size * 4 + data_size);
+    char* p = &out[offset];
+    write_header(p, FRAME_MESSAGE, seq_size ? FRAME_FLAG_CHANNEL_SEQ : 0, msg.channel, msg.sender_id,
+                 msg.seq_number, vc_size, seq_size + vc_size * 4, data_size, msg.send_time_ns);
+    p += FRAME_HEADER_SIZE;
+    if (seq_size > 0) {
+        put_u32(p, msg.channel_seq);
+        p += 4;
+    }
+
+    for (uint32_t i = 0; i < vc_size; i++) {
+        put_u32(p, msg.vector_clock[i]);
+        p += 4;
+    }
+
+    if (data_size > 0) {
+        memcpy(p, msg.data.data(), data_size);
+    }
+}
+
+void encode_done(int sender_id, long long total, std::vector<char>& out) {
+    append_header(out, FRAME_DONE, sender_id, (int)total, 0, 0, 0);
+}
+
+void encode_credit(int sender_id, long long delivered_bytes, std::vector<char>& out) {
+    char* p = append_header(out, FRAME_CREDIT, sender_id, 0, 0, 8, 0);
+    put_u64(p, delivered_bytes);
+}
+
+CreditFrame decode_credit(const Message& frame) {
+    if (frame.data.size() != 8) {
+        throw std::runtime_error("Malformed credit frame: " + std::to_string(frame.data.size()) + " bytes");
+    }
+    CreditFrame credit;
+    credit.sender_id = frame.sender_id;
+    credit.delivered_bytes = (long long)get_u64(frame.data.data());
+    return credit;
+}
+
+long long frames_cost(const char* data, size_t len) {
+    long long cost = 0;
+    size_t at = 0;
+    while (at + FRAME_HEADER_SIZE <= len) {
+        const char* p = data + at;
+        if ((get_u32(p + 4) >> 24) == FRAME_MESSAGE) {
+            cost += FRAME_HEADER_SIZE + (long long)get_u32(p + 16) * sizeof(int) + get_u32(p + 20);
+        }
+        at += FRAME_LENGTH_SIZE + get_u32(p);
+    }
+    return cost;
+}
+
+void encode_close(int sender_id, std::vector<char>& out) {
+    append_header(out, FRAME_CLOSE, sender_id, 0, 0, 0, 0);
+}
+
+void encode_timestamp(const TimestampFrame& ts, std::vector<char>& out) {
+    char* p = append_header(out, FRAME_TIMESTAMP, ts.sender_id, 0, 0, 8, 0, ts.channel);
+    put_u32(p, ts.sent);
+    put_u32(p + 4, ts.timestamp);
+}
+
+TimestampFrame decode_timestamp(const Message& frame) {
+    if (frame.data.size() != 8) {
+        throw std::runtime_error("Malformed timestamp frame: " + std::to_string(frame.data.size()) + " bytes");
+    }
+    TimestampFrame ts;
+    ts.sender_id = frame.sender_id;
+    ts.channel = frame.channel;
+    ts.sent = (int)get_u32(frame.data.data());
+    ts.timestamp = (int)get_u32(frame.data.data() + 4);
+    return ts;
+}
+
+void begin_batch(std::vector<char>& out) {
+    out.resize(out.size() + FRAME_HEADER_SIZE);
+}
+
+void end_batch(std::vector<char>& out, size_t batch_start, int sender_id, int count) {
+    // Fill in the header reserved by begin_batch; the frames after it are
+    // the batch's data
+    uint32_t data_size = out.size() - batch_start - FRAME_HEADER_SIZE;
+    write_header(&out[batch_start], FRAME_BATCH, 0, 0, sender_id, count, 0, 0, data_size, 0);
+}
+
+FrameDecoder::FrameDecoder() : start(0), end(0), in_batch(false), base_key(0), base(NULL), batch_end(0) {}
+
+char* FrameDecoder::write_ptr(size_t min_space) {
+    if (buf.size() - end < min_space) {
+        // Compact first, grow only if that is not enough
+        if (start > 0) {
+            memmove(&buf[0], &buf[start], end - start);
+            end -= start;
+            start = 0;
+        }
+        if (buf.size() - end < min_space) {
+            buf.resize(end + min_space);
+        }
+    }
+    return &buf[end];
+}
+
+size_t FrameDecoder::write_space() const {
+    return buf.size() - end;
+}
+
+void FrameDecoder::commit(size_t n) {
+    end += n;
+}
+
+void FrameDecoder::reset() {
+    start = end = 0;
+    in_batch = false;
+    batch_end = 0;
+    clock_bases.clear();
+    base = NULL;
+}
+
+std::vector<int>& FrameDecoder::clock_base(uint32_t sender_id, uint32_t channel) {
+    uint64_t key = (uint64_t)sender_id << 16 | channel;
+    if (!base || key != base_key) {
+        base = &clock_bases[key];
+        base_key = key;
+    }
+    return *base;
+}
+
+bool FrameDecoder::next(Message& msg, FrameType& frame_type) {
+    while (true) {
+        // Inside a batch, frames are read from the batch body only
+        size_t limit = in_batch ? batch_end : end;
+        size_t avail = limit - start;
+        if (in_batch && avail == 0) {
+            in_batch = false;
+            continue;
+        }
+        if (avail < FRAME_LENGTH_SIZE) {
+            if (in_batch) {
+                throw std::runtime_error("Truncated frame in batch");
+            }
+            return false;
+        }
+
+        const char* p = &buf[start];
+        uint32_t body_size = get_u32(p);
+        if (body_size < FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE || body_size > MAX_FRAME_SIZE) {
+            throw std::runtime_error("Invalid frame length: " + std::to_string(body_size));
+        }
+
+        if (avail < FRAME_LENGTH_SIZE + body_size) {
+            if (in_batch) {
+                throw std::runtime_error("Truncated frame in batch");
+            }
+            // Make sure the rest of this frame will fit on the next recv()
+            write_ptr(FRAME_LENGTH_SIZE + body_size - avail);
+            return false;
+        }
+        p = &buf[start];
+
+        uint32_t type = get_u32(p + 4) >> 24;
+        uint32_t flags = (get_u32(p + 4) >> 16) & 0xff;
+        uint32_t channel = get_u32(p + 4) & 0xffff;
+        uint32_t vc_size = get_u32(p + 16);
+        uint32_t data_size = get_u32(p + 20);
+        if (type > FRAME_TIMESTAMP) {
+            throw std::runtime_error("Unknown frame type: " + std::to_string(type));
+        }
+        bool delta = (flags & FRAME_FLAG_DELTA_CLOCK) != 0;
+        uint32_t seq_size = (flags & FRAME_FLAG_CHANNEL_SEQ) ? 4 : 0;
+        uint64_t fixed_size = FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE + seq_size + (uint64_t)data_size;
+        if (delta ? (fixed_size >= body_size || vc_size > MAX_FRAME_SIZE / 4)
+                  : (fixed_size + (uint64_t)vc_size * 4 != body_size)) {
+            throw std::runtime_error("Inconsistent frame: vc_size=" + std::to_string(vc_size)
+                                     + ", data_size=" + std::to_string(data_size));
+        }
+
+        if (type == FRAME_BATCH) {
+            // Step into the batch body; its frames are returned one by one
+            if (in_batch) {
+                throw std::runtime_error("Nested batch frame");
+            }
+            in_batch = true;
+            batch_end = start + FRAME_LENGTH_SIZE + body_size;
+            start += FRAME_HEADER_SIZE;
+            continue;
+        }
+        if (in_batch && type != FRAME_MESSAGE) {
+            throw std::runtime_error("Unexpected frame type in batch: " + std::to_string(type));
+        }
+
+        frame_type = (FrameType)type;
+        msg.sender_id = get_u32(p + 8);
+        msg.seq_number = get_u32(p + 12);
+        msg.channel = channel;
+        msg.send_time_ns = get_u64(p + 24);
+        p += FRAME_HEADER_SIZE;
+        msg.channel_seq = msg.seq_number;
+        if (seq_size > 0) {
+            msg.channel_seq = get_u32(p);
+            p += 4;
+        }
+
+        const char* frame_end = &buf[start] + FRAME_LENGTH_SIZE + body_size;
+        if (delta) {
+            // Apply the changed entries to the sender's previous clock in
+            // the channel on this link
+            const char* clock_end = frame_end - data_size;
+            std::vector<int>& clock_base = this->clock_base(msg.sender_id, channel);
+            clock_base.resize(vc_size, 0);
+            uint32_t changed = get_varint(p, clock_end);
+            uint32_t index = 0;
+            for (uint32_t k = 0; k < changed; k++) {
+                index += get_varint(p, clock_end);
+                if (index >= vc_size) {
+                    throw std::runtime_error("Clock index out of range: " + std::to_string(index));
+                }
+                clock_base[index] += get_varint(p, clock_end);
+            }
+            if (p != clock_end) {
+                throw std::runtime_error("Trailing bytes in delta clock");
+            }
+            msg.vector_clock.assign(clock_base.begin(), clock_base.end());
+        } else {
+            msg.vector_clock.resize(vc_size);
+            for (uint32_t i = 0; i < vc_size; i++) {
+                msg.vector_clock[i] = get_u32(p);
+                p += 4;
+            }
+            if (frame_type == FRAME_MESSAGE && vc_size > 0) {
+                clock_base(msg.sender_id, channel).assign(msg.vector_clock.begin(), msg.vector_clock.end());
+            }
+        }
+        msg.data.assign(p, data_size);
+
+        start += FRAME_LENGTH_SIZE + body_size;
+        if (in_batch && start == batch_end) {
+            in_batch = false;
+        }
+        if (!in_batch && start == end) {
+            start = end = 0;
+        }
+        return true;
+    }
+}
+
+OutboundQueue::OutboundQueue() : start(0) {}
+
+void OutboundQueue::append(const char* data, size_t len) {
+    if (start > 0 && start == buf.size()) {
+        buf.clear();
+        start = 0;
+    }
+    if (buf.size() + len > buf.capacity()) {
+        // Grow geometrically from a floor: an emptied vector would otherwise
+        // be resized to fit exactly, and reallocate for every larger frame
+        buf.reserve(std::max(buf.size() + len, std::max(2 * buf.capacity(), MIN_OUTBOUND_CAPACITY)));
+    }
+    buf.insert(buf.end(), data, data + len);
+}
+
+void OutboundQueue::consume(size_t n) {
+    start += n;
+    if (start == buf.size()) {
+        buf.clear();
+        start = 0;
+    } else if (start > buf.size() / 2) {
+        // Drop the taken prefix, as flush() does, so the queue does not creep
+        buf.erase(buf.begin(), buf.begin() + start);
+        start = 0;
+    }
+}
+
+bool OutboundQueue::flush(int sock, IoCounters* counters) {
+    while (start < buf.size()) {
+        ssize_t n = send(sock, &buf[start], buf.size() - start, MSG_NOSIGNAL);
+        if (counters) {
+            count(counters->send_calls);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Drop the already-sent prefix so the queue does not creep
+                if (start > buf.size() / 2) {
+                    buf.erase(buf.begin(), buf.begin() + start);
+                    start = 0;
+                }
+                return false;
+            }
+            throw std::runtime_error("Error sending frame: " + std::string(strerror(errno)));
+        }
+        start += n;
+        if (counters) {
+            count(counters->bytes_sent, n);
+        }
+    }
+    buf.clear();
+    start = 0;
+    return true;
+}
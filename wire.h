@@ -0,0 +1,212 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+#include "message.h"
+#include "metrics.h"
+
+// Wire format for one frame, all integers in network byte order:
+//
+//   u32 frame_len      bytes that follow this field
+//   u8  type           FrameType
+//   u8  flags          FrameFlags
+//   u16 channel        broadcast group of a message or timestamp, else 0
+//   u32 sender_id
+//   u32 seq_number
+//   u32 vc_size
+//   u32 data_size
+//   u64 send_time_ns   sender's CLOCK_REALTIME when the message was broadcast
+//   i32 vector_clock[vc_size]
+//   u8  data[data_size]
+//
+// seq_number counts all of a sender's messages. A message whose number
+// within its channel differs from that (FRAME_FLAG_CHANNEL_SEQ) carries it
+// in a u32 channel_seq between the header and the clock, so a process using
+// a single channel sends exactly the frames it always has.
+//
+// With FRAME_FLAG_DELTA_CLOCK the clock is instead sent as the entries that
+// changed since the previous message from the same sender in the same
+// channel on the connection:
+//
+//   varint changed
+//   { varint index_gap, varint increase } x changed
+//
+// vc_size still gives the full clock size. This relies on TCP delivering a
+// link's frames in order, and on every message from a sender going down
+// every link that carries any of them, so one base clock per sender and
+// channel serves all of those links. That holds for a sender's own links,
+// and for a relay passing its messages on (sender_id stays the one that
+// broadcast it). A message with a full clock also becomes the base for its
+// sender and channel on the link, which is how a sender puts a new
+// connection back in step.
+//
+// Control frames that carry more than a count keep it in their body, with
+// vc_size 0 and send_time_ns 0:
+//
+//   FRAME_CREDIT     u64 delivered_bytes
+//   FRAME_TIMESTAMP  u32 sent, i32 timestamp (channel in the header)
+//
+// A whole frame is encoded into one contiguous buffer so it can be written
+// with a single send() call.
+
+// Network byte order, for frames and for anything else sent between
+// processes
+inline void put_u32(char* p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+const size_t FRAME_LENGTH_SIZE = 4;
+const size_t FRAME_HEADER_SIZE = 32;
+const uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+enum FrameType {
+    FRAME_MESSAGE = 0,                // A broadcast message
+    FRAME_DONE = 1,                   // Sender has finished; seq_number = messages it sent
+    FRAME_BATCH = 2,                  // data holds seq_number complete FRAME_MESSAGE frames
+    FRAME_CREDIT = 3,                 // Flow control report, in the body (see CreditFrame)
+    FRAME_CLOSE = 4,                  // Sender is finished and closes the connection next
+    FRAME_TIMESTAMP = 5               // Total order announcement, in the body (see TimestampFrame)
+};
+
+enum FrameFlags {
+    FRAME_FLAG_DELTA_CLOCK = 0x01,    // Clock encoded against the previous one from the sender in the channel
+    FRAME_FLAG_CHANNEL_SEQ = 0x02     // channel_seq follows the header
+};
+
+// Channel IDs fit the header's u16
+const int MAX_CHANNELS = 65536;
+
+// Append the encoded frame for msg to out. With clock_base, the last clock
+// sent in msg's channel, the clock is delta-encoded against it and
+// clock_base is updated to msg's clock.
+void encode_frame(const Message& msg, std::vector<char>& out, std::vector<int>* clock_base = NULL);
+
+// Append a FRAME_DONE announcing that sender_id broadcast total messages
+void encode_done(int sender_id, long long total, std::vector<char>& out);
+
+// Flow control report carried by a FRAME_CREDIT
+struct CreditFrame {
+    int sender_id;                    // Process that delivered
+    long long delivered_bytes;        // Total size (see message_cost) of the receiver's messages
+                                      // it has delivered so far
+};
+
+// Append a FRAME_CREDIT from sender_id reporting delivered_bytes
+void encode_credit(int sender_id, long long delivered_bytes, std::vector<char>& out);
+
+// Read the report from a FRAME_CREDIT as FrameDecoder::next returned it;
+// throws std::runtime_error on a malformed body
+CreditFrame decode_credit(const Message& frame);
+
+// Append a FRAME_CLOSE from sender_id
+void encode_close(int sender_id, std::vector<char>& out);
+
+// Total order announcement carried by a FRAME_TIMESTAMP: the sender's
+// messages in the channel after the first sent all carry Lamport timestamps
+// above timestamp
+struct TimestampFrame {
+    int sender_id;
+    int channel;
+    int sent;                         // Sender's messages in the channel so far
+    int timestamp;
+};
+
+// Append a FRAME_TIMESTAMP for ts
+void encode_timestamp(const TimestampFrame& ts, std::vector<char>& out);
+
+// Read the announcement from a FRAME_TIMESTAMP as FrameDecoder::next
+// returned it; throws std::runtime_error on a malformed body
+TimestampFrame decode_timestamp(const Message& frame);
+
+// Size a message is charged against flow control credit: roughly what it
+// occupies in memory while it waits for causal delivery
+inline long long message_cost(const Message& msg) {
+    return FRAME_HEADER_SIZE + msg.vector_clock.size() * sizeof(int) + msg.data.size();
+}
+
+// Total message_cost of the messages among len bytes of whole frames, read
+// from their headers; channel_seq and a delta clock's encoding do not count
+long long frames_cost(const char* data, size_t len);
+
+// Batches: begin_batch reserves a header at the end of out, frames are then
+// appended with encode_frame, and end_batch fills in the header. The decoder
+// returns the frames inside a batch one at a time, in order.
+void begin_batch(std::vector<char>& out);
+void end_batch(std::vector<char>& out, size_t batch_start, int sender_id, int count);
+
+// Per-connection reassembly buffer. Bytes from recv() are appended as they
+// arrive and complete frames are decoded from the front, so short reads and
+// several frames per recv() are both handled. The buffer is allocated on
+// first use, as large as the caller asks for, so the links of a large
+// simulated cluster cost only what they carry.
+class FrameDecoder {
+private:
+    std::vector<char> buf;
+    size_t start;                     // First unconsumed byte
+    size_t end;                       // One past the last received byte
+    bool in_batch;                    // Returning frames from inside a FRAME_BATCH
+    // Per sender and channel: last clock received, for delta-encoded
+    // clocks. A link usually carries one sender, so the last one used is
+    // kept at hand.
+    std::unordered_map<uint64_t, std::vector<int> > clock_bases;
+    uint64_t base_key;
+    std::vector<int>* base;
+    size_t batch_end;                 // One past the batch body
+
+    std::vector<int>& clock_base(uint32_t sender_id, uint32_t channel);
+
+public:
+    FrameDecoder();
+
+    // Space to recv() into; at least min_space bytes are guaranteed
+    char* write_ptr(size_t min_space);
+    size_t write_space() const;
+    void commit(size_t n);
+
+    // Decode the next complete frame into msg and its type into type.
+    // Returns false if more bytes are needed; throws std::runtime_error on a
+    // malformed frame.
+    bool next(Message& msg, FrameType& type);
+
+    size_t buffered() const { return end - start; }
+
+    // Drop any partial frame and the clock bases, for a new connection
+    void reset();
+};
+
+// Per-connection outbound byte queue for non-blocking sockets. Frames are
+// appended whole and drained with as few send() calls as the socket allows;
+// whatever does not fit stays queued until the socket is writable again.
+class OutboundQueue {
+private:
+    std::vector<char> buf;
+    size_t start;                     // First unsent byte
+
+public:
+    OutboundQueue();
+
+    void append(const char* data, size_t len);
+
+    // Write as much as the socket accepts, counting the calls and bytes in
+    // counters if given. Returns true once the queue is empty; throws
+    // std::runtime_error on a socket error.
+    bool flush(int sock, IoCounters* counters = NULL);
+
+    // Or hand the bytes over some other way: the first unsent byte, and
+    // drop n of them once taken
+    const char* front() const { return buf.data() + start; }
+    void consume(size_t n);
+
+    bool empty() const { return start == buf.size(); }
+    size_t pending() const { return buf.size() - start; }
+};
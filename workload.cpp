@@ -0,0 +1,168 @@
+#include "workload.h"
+#include "wire.h"
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+WorkloadConfig::WorkloadConfig() :
+    message_count(100),
+    duration_s(0),
+    arrivals(ARRIVAL_RANDOM_GAP),
+    rate(0),
+    payload(PAYLOAD_TEXT),
+    payload_min(0),
+    payload_max(0) {}
+
+static double parse_number(const std::string& option, const std::string& value) {
+    char* end = NULL;
+    double number = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || number < 0) {
+        throw std::invalid_argument("Invalid value for " + option + ": " + value);
+    }
+    return number;
+}
+
+int WorkloadConfig::parse_option(int argc, char* argv[], int i) {
+    std::string option = argv[i];
+    if (option == "--max-throughput") {
+        arrivals = ARRIVAL_UNTHROTTLED;
+        return 1;
+    }
+    if (option != "--messages" && option != "--duration" && option != "--rate"
+        && option != "--arrivals" && option != "--payload") {
+        return 0;
+    }
+    if (i + 1 >= argc) {
+        throw std::invalid_argument("Missing value for " + option);
+    }
+    std::string value = argv[i + 1];
+
+    if (option == "--messages") {
+        message_count = (long long)parse_number(option, value);
+    } else if (option == "--duration") {
+        duration_s = parse_number(option, value);
+    } else if (option == "--rate") {
+        rate = parse_number(option, value);
+        if (arrivals == ARRIVAL_RANDOM_GAP) {
+            arrivals = ARRIVAL_FIXED_RATE;
+        }
+    } else if (option == "--arrivals") {
+        if (value == "random") {
+            arrivals = ARRIVAL_RANDOM_GAP;
+        } else if (value == "fixed") {
+            arrivals = ARRIVAL_FIXED_RATE;
+        } else if (value == "poisson") {
+            arrivals = ARRIVAL_POISSON;
+        } else if (value == "max") {
+            arrivals = ARRIVAL_UNTHROTTLED;
+        } else {
+            throw std::invalid_argument("Unknown arrival mode: " + value);
+        }
+    } else {
+        // text | <bytes> | <min>-<max> | exp:<mean>[-<max>]
+        size_t dash = value.find('-');
+        if (value == "text") {
+            payload = PAYLOAD_TEXT;
+        } else if (value.compare(0, 4, "exp:") == 0) {
+            payload = PAYLOAD_EXPONENTIAL;
+            std::string rest = value.substr(4);
+            dash = rest.find('-');
+            payload_min = (int)parse_number(option, rest.substr(0, dash));
+            payload_max = dash == std::string::npos ? payload_min * 16
+                                                    : (int)parse_number(option, rest.substr(dash + 1));
+        } else if (dash != std::string::npos) {
+            payload = PAYLOAD_UNIFORM;
+            payload_min = (int)parse_number(option, value.substr(0, dash));
+            payload_max = (int)parse_number(option, value.substr(dash + 1));
+        } else {
+            payload = PAYLOAD_FIXED;
+            payload_min = payload_max = (int)parse_number(option, value);
+        }
+    }
+    return 2;
+}
+
+void WorkloadConfig::validate() const {
+    if (message_count == 0 && duration_s == 0) {
+        throw std::invalid_argument("Either a message count or a duration is required");
+    }
+    if ((arrivals == ARRIVAL_FIXED_RATE || arrivals == ARRIVAL_POISSON) && rate <= 0) {
+        throw std::invalid_argument("Fixed and Poisson arrivals need --rate");
+    }
+    if (payload != PAYLOAD_TEXT && (payload_min > payload_max || payload_max > (int)(MAX_FRAME_SIZE / 2))) {
+        throw std::invalid_argument("Invalid payload size range");
+    }
+}
+
+const char* WorkloadConfig::usage() {
+    return "Workload options:\n"
+           "  --messages <n>        messages each process broadcasts (default 100, 0 = until --duration)\n"
+           "  --duration <seconds>  stop broadcasting after this long\n"
+           "  --rate <msg/s>        open-loop send rate per process (implies --arrivals fixed)\n"
+           "  --arrivals <mode>     random (1-10 ms gap, default) | fixed | poisson | max\n"
+           "  --max-throughput      send as fast as the connections allow\n"
+           "  --payload <spec>      text (default) | <bytes> | <min>-<max> | exp:<mean>[-<max>]\n";
+}
+
+Workload::Workload(const WorkloadConfig& workload_config, unsigned seed) :
+    config(workload_config),
+    gen(seed) {
+    if (config.payload != PAYLOAD_TEXT) {
+        pattern.resize(config.payload_max);
+        for (size_t i = 0; i < pattern.size(); i++) {
+            pattern[i] = 'a' + i % 26;
+        }
+    }
+}
+
+std::chrono::nanoseconds Workload::next_gap() {
+    switch (config.arrivals) {
+    case ARRIVAL_RANDOM_GAP: {
+        std::uniform_int_distribution<> dist(1, 10);
+        return std::chrono::milliseconds(dist(gen));
+    }
+    case ARRIVAL_FIXED_RATE:
+        return std::chrono::nanoseconds((long long)(1e9 / config.rate));
+    case ARRIVAL_POISSON: {
+        std::exponential_distribution<> dist(config.rate);
+        return std::chrono::nanoseconds((long long)(dist(gen) * 1e9));
+    }
+    default:
+        return std::chrono::nanoseconds(0);
+    }
+}
+
+bool Workload::done(long long sent, std::chrono::steady_clock::duration elapsed) const {
+    if (config.message_count > 0 && sent >= config.message_count) {
+        return true;
+    }
+    return config.duration_s > 0 && std::chrono::duration<double>(elapsed).count() >= config.duration_s;
+}
+
+void Workload::make_payload(int sender, int seq, std::string& out) {
+    int size;
+    switch (config.payload) {
+    case PAYLOAD_TEXT: {
+        // Formatted in place so a recycled string is reused
+        char text[64];
+        int len = snprintf(text, sizeof(text), "Message from P%d #%d", sender, seq);
+        out.assign(text, len);
+        return;
+    }
+    case PAYLOAD_FIXED:
+        size = config.payload_min;
+        break;
+    case PAYLOAD_UNIFORM: {
+        std::uniform_int_distribution<> dist(config.payload_min, config.payload_max);
+        size = dist(gen);
+        break;
+    }
+    default: {
+        std::exponential_distribution<> dist(1.0 / std::max(1, config.payload_min));
+        size = std::min(config.payload_max, (int)dist(gen));
+        break;
+    }
+    }
+    out.assign(pattern, 0, size);
+}
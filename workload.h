@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <random>
+#include <chrono>
+
+// How broadcasts are spaced in time
+enum ArrivalMode {
+    ARRIVAL_RANDOM_GAP,   // Uniform 1-10 ms pause after each send (closed loop)
+    ARRIVAL_FIXED_RATE,   // Evenly spaced at `rate` per second (open loop)
+    ARRIVAL_POISSON,      // Exponential gaps averaging `rate` per second (open loop)
+    ARRIVAL_UNTHROTTLED   // As fast as the outbound queues drain
+};
+
+// How payload sizes are drawn
+enum PayloadMode {
+    PAYLOAD_TEXT,         // "Message from P<id> #<seq>"
+    PAYLOAD_FIXED,        // Always payload_min bytes
+    PAYLOAD_UNIFORM,      // Uniform in [payload_min, payload_max]
+    PAYLOAD_EXPONENTIAL   // Exponential with mean payload_min, capped at payload_max
+};
+
+// Workload each process runs. The defaults reproduce the original fixed run:
+// 100 text messages with a random 1-10 ms gap.
+struct WorkloadConfig {
+    long long message_count;          // Messages each process broadcasts; 0 = until duration ends
+    double duration_s;                // Stop broadcasting after this many seconds; 0 = no limit
+    ArrivalMode arrivals;
+    double rate;                      // Messages per second for the open-loop modes
+    PayloadMode payload;
+    int payload_min;
+    int payload_max;
+
+    WorkloadConfig();
+
+    // Apply one command line option (e.g. "--rate", "5000"). Returns the
+    // number of arguments consumed, 0 if the option is not a workload option;
+    // throws std::invalid_argument on bad values.
+    int parse_option(int argc, char* argv[], int i);
+
+    // Throws std::invalid_argument on an inconsistent combination
+    void validate() const;
+
+    static const char* usage();
+};
+
+// Per-process generator for send times and payloads
+class Workload {
+private:
+    WorkloadConfig config;
+    std::mt19937 gen;
+    std::string pattern;              // Filler bytes that sized payloads are cut from
+
+public:
+    Workload(const WorkloadConfig& workload_config, unsigned seed);
+
+    const WorkloadConfig& settings() const { return config; }
+    bool unthrottled() const { return config.arrivals == ARRIVAL_UNTHROTTLED; }
+    bool open_loop() const {
+        return config.arrivals == ARRIVAL_FIXED_RATE || config.arrivals == ARRIVAL_POISSON;
+    }
+
+    // Gap before the next broadcast (zero when unthrottled)
+    std::chrono::nanoseconds next_gap();
+
+    // True once the configured count or duration has been reached
+    bool done(long long sent, std::chrono::steady_clock::duration elapsed) const;
+
+    // Fill out with the payload for message seq from sender
+    void make_payload(int sender, int seq, std::string& out);
+};